@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+#include <webp/encode.h>
+
+#include "clock.hpp"
+#include "context.hpp"
+#include "events.hpp"
+#include "image.hpp"
+#include "root_window.hpp"
+#include "thread_pool.hpp"
+#include "window.hpp"
+
+// the inputs are generated in memory, so that the numbers do not depend on
+// the files of the machine or on the page cache
+
+namespace
+{
+using namespace imgv;
+
+constexpr int image_size = 512;
+constexpr int gif_frame_count = 8;
+
+// a smooth gradient with some noise, so that lossy encoders have something to
+// do without the image being incompressible
+auto test_rgba(int width, int height, int seed) -> vector<u8>
+{
+  vector<u8> pixels(static_cast<usize>(width) * static_cast<usize>(height)
+                    * 4);
+  u32 noise = 0x9e3779b9U * static_cast<u32>(seed + 1);
+  auto* out = pixels.data();
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      noise = noise * 1664525U + 1013904223U;
+      const auto grain = static_cast<int>(noise >> 28U);
+      *out++ = static_cast<u8>((x + seed * 16) + grain);
+      *out++ = static_cast<u8>(y + grain);
+      *out++ = static_cast<u8>((x + y) / 2);
+      *out++ = 255;
+    }
+  }
+  return pixels;
+}
+
+auto put_be32(vector<u8>& out, u32 value) -> void
+{
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<u8>(value >> static_cast<u32>(shift)));
+  }
+}
+
+auto put_le16(vector<u8>& out, u32 value) -> void
+{
+  out.push_back(static_cast<u8>(value));
+  out.push_back(static_cast<u8>(value >> 8U));
+}
+
+auto crc32(const u8* data, usize size) -> u32
+{
+  static const auto table = []
+  {
+    array<u32, 256> t {};
+    for (u32 n = 0; n < 256; ++n) {
+      auto c = n;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1U) != 0 ? 0xedb88320U ^ (c >> 1U) : c >> 1U;
+      }
+      t[n] = c;
+    }
+    return t;
+  }();
+
+  u32 c = 0xffffffffU;
+  for (usize i = 0; i < size; ++i) {
+    c = table[(c ^ data[i]) & 0xffU] ^ (c >> 8U);
+  }
+  return c ^ 0xffffffffU;
+}
+
+auto put_png_chunk(vector<u8>& out, const char* type, const vector<u8>& data)
+    -> void
+{
+  put_be32(out, static_cast<u32>(data.size()));
+  const auto start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  put_be32(out, crc32(out.data() + start, out.size() - start));
+}
+
+// RGBA PNG with stored deflate blocks: stbi still inflates and unfilters it,
+// without a zlib dependency here
+auto encode_png(const vector<u8>& rgba, int width, int height) -> vector<u8>
+{
+  const auto row_size = static_cast<usize>(width) * 4;
+  vector<u8> raw;
+  for (int y = 0; y < height; ++y) {
+    // filter type none
+    raw.push_back(0);
+    const auto* row = rgba.data() + static_cast<usize>(y) * row_size;
+    raw.insert(raw.end(), row, row + row_size);
+  }
+
+  vector<u8> zlib {0x78, 0x01};
+  constexpr usize max_stored = 65535;
+  for (usize pos = 0; pos < raw.size(); pos += max_stored) {
+    const auto size = std::min(max_stored, raw.size() - pos);
+    zlib.push_back(static_cast<u8>(pos + size == raw.size() ? 1 : 0));
+    put_le16(zlib, static_cast<u32>(size));
+    put_le16(zlib, static_cast<u32>(~size & 0xffffU));
+    const auto begin = raw.begin() + static_cast<std::ptrdiff_t>(pos);
+    zlib.insert(zlib.end(), begin, begin + static_cast<std::ptrdiff_t>(size));
+  }
+  u32 a = 1, b = 0;
+  for (const auto byte : raw) {
+    a = (a + byte) % 65521U;
+    b = (b + a) % 65521U;
+  }
+  put_be32(zlib, (b << 16U) | a);
+
+  vector<u8> png {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  vector<u8> header;
+  put_be32(header, static_cast<u32>(width));
+  put_be32(header, static_cast<u32>(height));
+  // 8 bits per channel, RGBA, deflate, adaptive filtering, not interlaced
+  header.insert(header.end(), {8, 6, 0, 0, 0});
+  put_png_chunk(png, "IHDR", header);
+  put_png_chunk(png, "IDAT", zlib);
+  put_png_chunk(png, "IEND", {});
+  return png;
+}
+
+// animated GIF whose LZW streams only hold literals, with a clear code often
+// enough that the codes stay 9 bits wide
+auto encode_gif(int width, int height, int frames) -> vector<u8>
+{
+  vector<u8> gif {'G', 'I', 'F', '8', '9', 'a'};
+  put_le16(gif, static_cast<u32>(width));
+  put_le16(gif, static_cast<u32>(height));
+  // global palette of 256 colors
+  gif.insert(gif.end(), {0xf7, 0, 0});
+  for (u32 i = 0; i < 256; ++i) {
+    gif.insert(gif.end(),
+               {static_cast<u8>(i),
+                static_cast<u8>(255 - i),
+                static_cast<u8>(i * 7)});
+  }
+  // loop forever
+  gif.insert(gif.end(), {0x21, 0xff, 11});
+  const char* netscape = "NETSCAPE2.0";
+  gif.insert(gif.end(), netscape, netscape + 11);
+  gif.insert(gif.end(), {3, 1, 0, 0, 0});
+
+  constexpr u32 clear_code = 256, end_code = 257;
+  constexpr usize literals_per_clear = 250;
+  for (int frame = 0; frame < frames; ++frame) {
+    // graphic control: keep, no transparency, 4 centiseconds
+    gif.insert(gif.end(), {0x21, 0xf9, 4, 0x04, 4, 0, 0, 0});
+    gif.push_back(0x2c);
+    put_le16(gif, 0);
+    put_le16(gif, 0);
+    put_le16(gif, static_cast<u32>(width));
+    put_le16(gif, static_cast<u32>(height));
+    gif.push_back(0);
+    gif.push_back(8);
+
+    vector<u8> codes;
+    u32 bits = 0, bit_count = 0;
+    const auto put_code = [&](u32 code)
+    {
+      bits |= code << bit_count;
+      bit_count += 9;
+      while (bit_count >= 8) {
+        codes.push_back(static_cast<u8>(bits));
+        bits >>= 8U;
+        bit_count -= 8;
+      }
+    };
+    const auto pixel_count =
+        static_cast<usize>(width) * static_cast<usize>(height);
+    for (usize i = 0; i < pixel_count; ++i) {
+      if (i % literals_per_clear == 0) {
+        put_code(clear_code);
+      }
+      const auto x = static_cast<int>(i % static_cast<usize>(width));
+      const auto y = static_cast<int>(i / static_cast<usize>(width));
+      put_code(static_cast<u32>((x + y + frame * 8) & 0xff));
+    }
+    put_code(end_code);
+    if (bit_count > 0) {
+      codes.push_back(static_cast<u8>(bits));
+    }
+
+    for (usize pos = 0; pos < codes.size(); pos += 255) {
+      const auto size = std::min<usize>(255, codes.size() - pos);
+      gif.push_back(static_cast<u8>(size));
+      const auto begin = codes.begin() + static_cast<std::ptrdiff_t>(pos);
+      gif.insert(gif.end(), begin, begin + static_cast<std::ptrdiff_t>(size));
+    }
+    gif.push_back(0);
+  }
+  gif.push_back(0x3b);
+  return gif;
+}
+
+auto encode_webp(const vector<u8>& rgba, int width, int height) -> vector<u8>
+{
+  u8* output = nullptr;
+  const auto size =
+      WebPEncodeRGBA(rgba.data(), width, height, width * 4, 80.0F, &output);
+  if (size == 0) {
+    IMGV_ERROR("unable to encode the WebP input");
+  }
+  vector<u8> webp {output, output + size};
+  WebPFree(output);
+  return webp;
+}
+
+struct inputs
+{
+  vector<u8> png, gif, webp;
+};
+
+auto test_inputs() -> const inputs&
+{
+  static const inputs all = []
+  {
+    const auto rgba = test_rgba(image_size, image_size, 0);
+    return inputs {encode_png(rgba, image_size, image_size),
+                   encode_gif(image_size, image_size, gif_frame_count),
+                   encode_webp(rgba, image_size, image_size)};
+  }();
+  return all;
+}
+
+auto decode(benchmark::State& state, const vector<u8>& file) -> void
+{
+  thread_pool workers;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto contents = file;
+    state.ResumeTiming();
+    auto image = decode_image("bench", move(contents), &workers);
+    if (!image.has_value()) {
+      state.SkipWithError("not decoded");
+      break;
+    }
+    benchmark::DoNotOptimize(image);
+  }
+  state.SetBytesProcessed(state.iterations()
+                          * static_cast<i64>(file.size()));
+}
+
+auto bench_decode_png(benchmark::State& state) -> void
+{
+  decode(state, test_inputs().png);
+}
+BENCHMARK(bench_decode_png)->Unit(benchmark::kMillisecond);
+
+auto bench_decode_gif(benchmark::State& state) -> void
+{
+  decode(state, test_inputs().gif);
+}
+BENCHMARK(bench_decode_gif)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+auto bench_decode_webp(benchmark::State& state) -> void
+{
+  decode(state, test_inputs().webp);
+}
+BENCHMARK(bench_decode_webp)->Unit(benchmark::kMillisecond);
+
+auto bench_sniff_image(benchmark::State& state) -> void
+{
+  const auto& all = test_inputs();
+  const auto header = [](const vector<u8>& file)
+  {
+    return vector<u8> {file.begin(),
+                       file.begin() + static_cast<std::ptrdiff_t>(
+                           std::min(image_header_size, file.size()))};
+  };
+  // the last one is not an image
+  const array<vector<u8>, 4> headers {header(all.png),
+                                      header(all.gif),
+                                      header(all.webp),
+                                      vector<u8>(image_header_size, 'x')};
+  for (auto _ : state) {
+    for (const auto& h : headers) {
+      benchmark::DoNotOptimize(sniff_image(h));
+    }
+  }
+  state.SetItemsProcessed(state.iterations()
+                          * static_cast<i64>(headers.size()));
+}
+BENCHMARK(bench_sniff_image);
+
+// what an animated window asks its clock every frame
+auto bench_state_clock(benchmark::State& state) -> void
+{
+  state_clock c;
+  c.update_speed({{}, {change_mode::set, 1.5}});
+  c.update_seek({{}, {change_mode::add_or_cycle, 12.5}});
+  const chr::nanoseconds duration {chr::milliseconds {1234}};
+  for (auto _ : state) {
+    const auto now = c.now();
+    benchmark::DoNotOptimize(loop_position(now, duration));
+    benchmark::DoNotOptimize(c.rescale(chr::milliseconds {40}));
+  }
+}
+BENCHMARK(bench_state_clock);
+
+// producers stand for the render update callbacks of mpv, which run on
+// threads of mpv, and the consumer for the main loop: every iteration, each
+// producer pushes a batch while the consumer drains until it has everything
+//
+// GLFW is not initialized here, so the wake up of the main loop on the first
+// push of a drain returns early and is not part of the timing
+auto bench_event_queue(benchmark::State& state) -> void
+{
+  constexpr usize batch = 1024;
+  const auto producers = static_cast<usize>(state.range(0));
+  event_queue queue;
+  std::atomic<u64> generation {0};
+  std::atomic_bool stop {false};
+  vector<std::thread> threads;
+  for (usize p = 0; p < producers; ++p) {
+    threads.emplace_back(
+        [&, p]
+        {
+          u64 seen = 0;
+          while (true) {
+            auto current = generation.load(std::memory_order_acquire);
+            while (current == seen && !stop.load(std::memory_order_relaxed)) {
+              std::this_thread::yield();
+              current = generation.load(std::memory_order_acquire);
+            }
+            if (stop.load(std::memory_order_relaxed)) {
+              return;
+            }
+
+            seen = current;
+            for (usize i = 0; i < batch; ++i) {
+              queue.push(
+                  mpv_render_update_event {{static_cast<window_id>(p)}});
+            }
+          }
+        });
+  }
+
+  const auto expected = producers * batch;
+  for (auto _ : state) {
+    generation.fetch_add(1, std::memory_order_release);
+    usize received = 0;
+    while (received < expected) {
+      const auto count =
+          queue.drain([](event& e) { benchmark::DoNotOptimize(e); });
+      // the main loop sleeps when the queue is empty, it must not take the
+      // core of a producer
+      if (count == 0) {
+        std::this_thread::yield();
+      }
+      received += count;
+    }
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto& t : threads) {
+    t.join();
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<i64>(expected));
+}
+BENCHMARK(bench_event_queue)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// decoding is left out of the timing, the textures are deleted outside of it
+// too and the GL commands are finished inside it
+auto upload(benchmark::State& state, const vector<u8>& file) -> void
+{
+  bool run = false;
+  optional<context> c;
+  optional<window> w;
+  try {
+    c.emplace(vector<const char*> {}, run);
+    w.emplace(&*c);
+  } catch (exception& ex) {
+    state.SkipWithError(ex.what());
+    return;
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto image = decode_image("bench", file, &c->workers());
+    if (!image.has_value()) {
+      state.SkipWithError("not decoded");
+      break;
+    }
+    state.ResumeTiming();
+
+    {
+      const auto uploaded = upload_image(&*w, move(*image));
+      w->use_gl([](const GladGLContext& gl) { gl.Finish(); });
+      state.PauseTiming();
+    }
+    state.ResumeTiming();
+  }
+}
+
+auto bench_upload_png(benchmark::State& state) -> void
+{
+  upload(state, test_inputs().png);
+}
+BENCHMARK(bench_upload_png)->Unit(benchmark::kMillisecond);
+
+auto bench_upload_gif(benchmark::State& state) -> void
+{
+  upload(state, test_inputs().gif);
+}
+BENCHMARK(bench_upload_gif)->Unit(benchmark::kMillisecond);
+
+auto bench_upload_webp(benchmark::State& state) -> void
+{
+  upload(state, test_inputs().webp);
+}
+BENCHMARK(bench_upload_webp)->Unit(benchmark::kMillisecond);
+}  // namespace
+
+auto main(int argc, char** argv) -> int
+{
+  // uploads go through OSMesa, so that they can be compared between machines
+  // and run without a display server
+  set_gl_backend(gl_backend::osmesa);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,5 +1,15 @@
 include(cmake/folders.cmake)
 
+include(CTest)
+if(BUILD_TESTING)
+  add_subdirectory(test)
+endif()
+
+option(BUILD_BENCHMARKS "Build the imgv-cpp_bench target" ON)
+if(BUILD_BENCHMARKS)
+  add_subdirectory(bench)
+endif()
+
 add_custom_target(
     run-exe
     COMMAND imgv-cpp_exe
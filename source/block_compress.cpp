@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cmath>
+
+#include "block_compress.hpp"
+
+#include "texture_stream.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+constexpr int block_size = 4;
+constexpr usize block_pixels = 16;
+constexpr usize block_bytes = 8;
+// pixels below are transparent in BC1 with 1-bit alpha
+constexpr u8 alpha_threshold = 128;
+
+using color = array<float, 3>;
+
+// the 16 pixels of the block at bx, by, edges repeated
+struct block
+{
+  array<color, block_pixels> colors {};
+  array<u8, block_pixels> values {};
+  // BC1 only, pixels below alpha_threshold
+  array<bool, block_pixels> hidden {};
+  bool transparent {false};
+
+  block(const u8* pixels,
+        int width,
+        int height,
+        usize stride,
+        usize channels,
+        int bx,
+        int by)
+  {
+    for (usize i = 0; i < block_pixels; ++i) {
+      const auto x = std::min(bx + static_cast<int>(i % 4), width - 1);
+      const auto y = std::min(by + static_cast<int>(i / 4), height - 1);
+      const auto* p = pixels + static_cast<usize>(y) * stride
+          + static_cast<usize>(x) * channels;
+      values.at(i) = p[0];
+      if (channels >= 3) {
+        colors.at(i) = {static_cast<float>(p[0]),
+                        static_cast<float>(p[1]),
+                        static_cast<float>(p[2])};
+      }
+      if (channels == 4 && p[3] < alpha_threshold) {
+        hidden.at(i) = true;
+        transparent = true;
+      }
+    }
+  }
+};
+
+auto distance(const color& a, const color& b) -> float
+{
+  float sum = 0.0F;
+  for (usize c = 0; c < 3; ++c) {
+    sum += (a.at(c) - b.at(c)) * (a.at(c) - b.at(c));
+  }
+  return sum;
+}
+
+auto to_565(const color& c) -> u32
+{
+  const auto quantize = [](float value, float levels)
+  {
+    return static_cast<u32>(
+        std::lround(std::clamp(value, 0.0F, 255.0F) * levels / 255.0F));
+  };
+  return (quantize(c[0], 31.0F) << 11U) | (quantize(c[1], 63.0F) << 5U)
+      | quantize(c[2], 31.0F);
+}
+
+auto from_565(u32 value) -> color
+{
+  const auto r = (value >> 11U) & 31U;
+  const auto g = (value >> 5U) & 63U;
+  const auto b = value & 31U;
+  return {static_cast<float>((r << 3U) | (r >> 2U)),
+          static_cast<float>((g << 2U) | (g >> 4U)),
+          static_cast<float>((b << 3U) | (b >> 2U))};
+}
+
+auto mix(const color& a, const color& b, float t) -> color
+{
+  return {a[0] + (b[0] - a[0]) * t,
+          a[1] + (b[1] - a[1]) * t,
+          a[2] + (b[2] - a[2]) * t};
+}
+
+// the endpoints are the pixels furthest apart along the principal axis of
+// the colors, found by power iteration on their covariance
+auto endpoints(const block& b, const vector<usize>& pixels)
+    -> tuple<color, color>
+{
+  color mean {0.0F, 0.0F, 0.0F};
+  for (const auto i : pixels) {
+    for (usize c = 0; c < 3; ++c) {
+      mean.at(c) += b.colors.at(i).at(c);
+    }
+  }
+  for (auto& c : mean) {
+    c /= static_cast<float>(pixels.size());
+  }
+
+  array<float, 6> cov {};
+  for (const auto i : pixels) {
+    const auto& p = b.colors.at(i);
+    const color d {p[0] - mean[0], p[1] - mean[1], p[2] - mean[2]};
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+
+  color axis {1.0F, 1.0F, 1.0F};
+  for (int iteration = 0; iteration < 4; ++iteration) {
+    const color next {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                      cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                      cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    const auto length = std::max({std::fabs(next[0]),
+                                  std::fabs(next[1]),
+                                  std::fabs(next[2])});
+    // the colors do not vary along axis (a flat block), normalizing would
+    // only amplify rounding errors
+    if (length < 1e-6F) {
+      break;
+    }
+    axis = {next[0] / length, next[1] / length, next[2] / length};
+  }
+
+  auto low = pixels.front(), high = pixels.front();
+  auto low_dot = 0.0F, high_dot = 0.0F;
+  for (const auto i : pixels) {
+    const auto& p = b.colors.at(i);
+    const auto dot = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2];
+    if (i == pixels.front() || dot < low_dot) {
+      low = i;
+      low_dot = dot;
+    }
+    if (i == pixels.front() || dot > high_dot) {
+      high = i;
+      high_dot = dot;
+    }
+  }
+
+  return {b.colors.at(high), b.colors.at(low)};
+}
+
+auto write_le(u8* out, u64 value, usize bytes) -> void
+{
+  for (usize i = 0; i < bytes; ++i) {
+    out[i] = static_cast<u8>(value >> (8U * i));
+  }
+}
+
+auto encode_bc1(const block& b, u8* out) -> void
+{
+  vector<usize> pixels;
+  for (usize i = 0; i < block_pixels; ++i) {
+    if (!b.hidden.at(i)) {
+      pixels.push_back(i);
+    }
+  }
+
+  auto c0 = 0U, c1 = 0U;
+  if (!pixels.empty()) {
+    const auto [high, low] = endpoints(b, pixels);
+    c0 = to_565(high);
+    c1 = to_565(low);
+  }
+
+  // 4 colors when c0 > c1, 3 colors and transparency otherwise
+  if (b.transparent ? c0 > c1 : c0 < c1) {
+    std::swap(c0, c1);
+  }
+  const auto p0 = from_565(c0), p1 = from_565(c1);
+  vector<color> palette {p0, p1};
+  if (c0 > c1) {
+    palette.push_back(mix(p0, p1, 1.0F / 3.0F));
+    palette.push_back(mix(p0, p1, 2.0F / 3.0F));
+  } else {
+    palette.push_back(mix(p0, p1, 0.5F));
+  }
+
+  u64 indices = 0;
+  for (usize i = 0; i < block_pixels; ++i) {
+    u64 index = 0;
+    if (b.hidden.at(i)) {
+      index = 3;
+    } else if (c0 != c1) {
+      auto best = distance(b.colors.at(i), palette.front());
+      for (usize j = 1; j < palette.size(); ++j) {
+        const auto d = distance(b.colors.at(i), palette.at(j));
+        if (d < best) {
+          best = d;
+          index = j;
+        }
+      }
+    }
+    indices |= index << (2U * i);
+  }
+
+  write_le(out, c0, 2);
+  write_le(out + 2, c1, 2);
+  write_le(out + 4, indices, 4);
+}
+
+auto encode_bc4(const block& b, u8* out) -> void
+{
+  const auto [min, max] =
+      std::minmax_element(b.values.begin(), b.values.end());
+  const auto r0 = static_cast<float>(*max), r1 = static_cast<float>(*min);
+  // with r0 > r1, index 0 is r0, 1 is r1 and 2 to 7 go from r0 to r1
+  array<float, 8> palette {r0, r1};
+  for (usize j = 2; j < palette.size(); ++j) {
+    palette.at(j) =
+        (static_cast<float>(8 - j) * r0 + static_cast<float>(j - 1) * r1)
+        / 7.0F;
+  }
+
+  u64 indices = 0;
+  for (usize i = 0; i < block_pixels; ++i) {
+    const auto value = static_cast<float>(b.values.at(i));
+    u64 index = 0;
+    for (usize j = 1; j < palette.size(); ++j) {
+      if (std::fabs(value - palette.at(j))
+          < std::fabs(value - palette.at(index)))
+      {
+        index = j;
+      }
+    }
+    indices |= index << (3U * i);
+  }
+
+  out[0] = *max;
+  out[1] = *min;
+  write_le(out + 2, indices, 6);
+}
+
+template<typename Encode>
+auto compress_blocks(const u8* pixels,
+                     int width,
+                     int height,
+                     usize stride,
+                     usize channels,
+                     Encode&& encode) -> vector<u8>
+{
+  const auto columns =
+      static_cast<usize>((width + block_size - 1) / block_size);
+  const auto rows =
+      static_cast<usize>((height + block_size - 1) / block_size);
+  vector<u8> result(columns * rows * block_bytes);
+  auto* out = result.data();
+  for (int by = 0; by < height; by += block_size) {
+    for (int bx = 0; bx < width; bx += block_size) {
+      encode(block {pixels, width, height, stride, channels, bx, by}, out);
+      out += block_bytes;
+    }
+  }
+
+  return result;
+}
+}  // namespace
+
+auto compressed_texture::byte_size() const -> usize
+{
+  usize size = 0;
+  for (const auto& level : levels) {
+    size += level.size();
+  }
+  return size;
+}
+
+auto compress_bc1(const u8* pixels,
+                  int width,
+                  int height,
+                  usize stride,
+                  usize channels) -> vector<u8>
+{
+  return compress_blocks(
+      pixels, width, height, stride, channels, encode_bc1);
+}
+
+auto compress_bc4(const u8* pixels, int width, int height, usize stride)
+    -> vector<u8>
+{
+  return compress_blocks(pixels, width, height, stride, 1, encode_bc4);
+}
+
+auto compress_texture(const u8* pixels,
+                      int width,
+                      int height,
+                      usize stride,
+                      usize channels,
+                      GLenum internal_format) -> compressed_texture
+{
+  const trace_span span {"block compress"};
+  const auto compress = [&](const u8* level, int w, int h, usize s)
+  {
+    return channels == 1 ? compress_bc4(level, w, h, s)
+                         : compress_bc1(level, w, h, s, channels);
+  };
+
+  compressed_texture result;
+  result.internal_format = internal_format;
+  result.width = width;
+  result.height = height;
+  result.levels.push_back(compress(pixels, width, height, stride));
+  for (const auto& level :
+       build_mip_tail(pixels, width, height, stride, channels))
+  {
+    result.levels.push_back(compress(level.pixels.data(),
+                                     level.width,
+                                     level.height,
+                                     static_cast<usize>(level.width)
+                                         * channels));
+  }
+
+  return result;
+}
+}  // namespace imgv
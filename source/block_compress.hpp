@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gl_wrapper.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+// the mipmap chain of a texture in a block compressed format, ready for
+// glCompressedTexImage2D
+struct compressed_texture
+{
+  GLenum internal_format {0};
+  int width {0}, height {0};
+  // from level 0 down to 1x1
+  vector<vector<u8>> levels;
+
+  // compressed bytes of every level
+  auto byte_size() const -> usize;
+};
+
+// BC1 (DXT1) blocks of RGB or RGBA pixels, in rows of stride bytes, blocks
+// with a transparent pixel keep 1-bit alpha
+auto compress_bc1(const u8* pixels,
+                  int width,
+                  int height,
+                  usize stride,
+                  usize channels) -> vector<u8>;
+
+// BC4 (RGTC1) blocks of single channel pixels, in rows of stride bytes
+auto compress_bc4(const u8* pixels, int width, int height, usize stride)
+    -> vector<u8>;
+
+// the pixels and the mipmaps of width x height pixels, in BC1 when they have
+// 3 or 4 channels and in BC4 when they have one, as the driver would compress
+// them to internal_format
+//
+// takes a few hundred milliseconds per 10 MP, it runs on the workers
+auto compress_texture(const u8* pixels,
+                      int width,
+                      int height,
+                      usize stride,
+                      usize channels,
+                      GLenum internal_format) -> compressed_texture;
+}  // namespace imgv
@@ -0,0 +1,144 @@
+#include "budget.hpp"
+
+#include "stats.hpp"
+
+namespace imgv
+{
+memory_budget::memory_budget(usize limit)
+    : m_limit {limit}
+{
+}
+
+auto memory_budget::report(window_id id, const memory_usage& usage) -> void
+{
+  auto& s = state(id);
+  subtract(s.usage);
+  s.usage = usage;
+  add(s.usage);
+  publish(id);
+}
+
+auto memory_budget::remove(window_id id) -> void
+{
+  if (auto it = m_windows.find(id); it != m_windows.end()) {
+    subtract(it->second.usage);
+    m_windows.erase(it);
+  }
+  publish(id);
+
+  if (m_focused == id) {
+    m_focused.reset();
+  }
+}
+
+auto memory_budget::window_bytes(window_id id) const -> usize
+{
+  const auto it = m_windows.find(id);
+  return it == m_windows.end()
+      ? 0
+      : it->second.usage.image_bytes + it->second.usage.cache_bytes;
+}
+
+auto memory_budget::focus(window_id id) -> void
+{
+  state(id).last_focus = ++m_focus_clock;
+  m_focused = id;
+}
+
+auto memory_budget::set_hidden(window_id id, bool hidden) -> void
+{
+  state(id).hidden = hidden;
+}
+
+auto memory_budget::next_eviction() const
+    -> optional<std::pair<window_id, memory_kind>>
+{
+  if (m_used <= m_limit) {
+    return nullopt;
+  }
+
+  // least recently focused window that matches, by tier
+  const auto pick = [this](auto&& matches) -> optional<window_id>
+  {
+    optional<window_id> victim;
+    std::uint64_t victim_focus = 0;
+    for (const auto& [id, s] : m_windows) {
+      if (matches(id, s) && (!victim || s.last_focus < victim_focus)) {
+        victim = id;
+        victim_focus = s.last_focus;
+      }
+    }
+
+    return victim;
+  };
+
+  if (auto id = pick([](window_id, const window_state& s)
+                     { return s.usage.cache_bytes > 0; }))
+  {
+    return std::make_pair(*id, memory_kind::cache);
+  }
+
+  if (auto id = pick([](window_id, const window_state& s)
+                     { return s.hidden && s.usage.image_bytes > 0; }))
+  {
+    return std::make_pair(*id, memory_kind::image);
+  }
+
+  if (auto id = pick(
+          [this](window_id candidate, const window_state& s)
+          {
+            return candidate != m_focused && !s.usage.animating
+                && s.usage.image_bytes > 0;
+          }))
+  {
+    return std::make_pair(*id, memory_kind::image);
+  }
+
+  return nullopt;
+}
+
+auto memory_budget::state(window_id id) -> window_state&
+{
+  auto [it, inserted] = m_windows.try_emplace(id);
+  if (inserted) {
+    // new windows count as just focused, they usually are
+    it->second.last_focus = ++m_focus_clock;
+  }
+
+  return it->second;
+}
+
+auto memory_budget::add(const memory_usage& usage) -> void
+{
+  m_used += usage.image_bytes + usage.cache_bytes;
+  for (const auto& part : usage.shared) {
+    // already counted if another window holds the textures, only its size
+    // is updated
+    auto& textures = m_shared[part.textures];
+    m_used -= textures.bytes;
+    textures.bytes = part.bytes;
+    ++textures.holders;
+  }
+}
+
+auto memory_budget::subtract(const memory_usage& usage) -> void
+{
+  for (const auto& part : usage.shared) {
+    m_used += part.bytes;
+    const auto it = m_shared.find(part.textures);
+    if (--it->second.holders == 0) {
+      m_used -= it->second.bytes;
+      m_shared.erase(it);
+    }
+  }
+  m_used -= usage.image_bytes + usage.cache_bytes;
+}
+
+auto memory_budget::publish(window_id id) -> void
+{
+  counters().texture_bytes.store(m_used, std::memory_order_relaxed);
+  if (auto* slot = find_window_counters(id); slot != nullptr) {
+    slot->texture_bytes.store(window_bytes(id), std::memory_order_relaxed);
+  }
+}
+}  // namespace imgv
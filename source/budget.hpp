@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include "events.hpp"
+#include "types.hpp"
+
+// video memory the windows may use for their textures together, in bytes
+#ifndef IMGV_TEXTURE_BUDGET
+// NOLINTNEXTLINE(*-macro-usage)
+#  define IMGV_TEXTURE_BUDGET 1073741824
+#endif
+
+namespace imgv
+{
+struct gpu_textures;
+
+constexpr usize texture_budget = IMGV_TEXTURE_BUDGET;
+
+// what a window can give back when the budget is exceeded
+enum class memory_kind
+{
+  // images kept around for navigation, free to drop
+  cache,
+  // the image being shown, reloaded from its file when needed again
+  image,
+};
+
+// textures a window holds through the texture registry, which other windows
+// may hold too
+struct shared_memory
+{
+  const gpu_textures* textures {nullptr};
+  usize bytes {0};
+};
+
+// texture memory reported by a window
+struct memory_usage
+{
+  usize image_bytes {0};
+  usize cache_bytes {0};
+  // the image changes on its own, so it is needed even when not focused
+  bool animating {false};
+  // the part of image_bytes and cache_bytes in shared textures, counted once
+  // in the total however many windows hold them
+  vector<shared_memory> shared {};
+
+  auto share(const gpu_textures* textures, usize bytes) -> void
+  {
+    if (textures != nullptr) {
+      shared.push_back({textures, bytes});
+    }
+  }
+};
+
+// keeps track of the texture memory of every window and decides which
+// window has to release what when the total exceeds the limit
+//
+// caches go first, then the images of minimized windows, then the images of
+// the least recently focused windows (the focused window and visible
+// animations are never evicted)
+class memory_budget
+{
+public:
+  explicit memory_budget(usize limit = texture_budget);
+
+  auto report(window_id id, const memory_usage& usage) -> void;
+  auto remove(window_id id) -> void;
+
+  auto focus(window_id id) -> void;
+  auto set_hidden(window_id id, bool hidden) -> void;
+
+  auto used() const -> usize { return m_used; }
+  auto limit() const -> usize { return m_limit; }
+  // reported by id, shared textures included
+  auto window_bytes(window_id id) const -> usize;
+
+  // the next window that has to release memory, nullopt if the usage is
+  // under the limit or nothing can be released
+  auto next_eviction() const -> optional<std::pair<window_id, memory_kind>>;
+
+private:
+  struct window_state
+  {
+    memory_usage usage;
+    std::uint64_t last_focus {0};
+    bool hidden {false};
+  };
+
+  struct shared_state
+  {
+    // as last reported, the upload of large images changes it
+    usize bytes {0};
+    usize holders {0};
+  };
+
+  usize m_limit;
+  usize m_used {0};
+  std::uint64_t m_focus_clock {0};
+  optional<window_id> m_focused;
+  std::unordered_map<window_id, window_state> m_windows;
+  std::unordered_map<const gpu_textures*, shared_state> m_shared;
+
+  auto state(window_id id) -> window_state&;
+  // count usage in m_used, or stop counting it
+  auto add(const memory_usage& usage) -> void;
+  auto subtract(const memory_usage& usage) -> void;
+  // mirror the usage of id and the total into the runtime counters
+  auto publish(window_id id) -> void;
+};
+}  // namespace imgv
@@ -1,61 +1,100 @@
 #include <cmath>
+#include <cstdlib>
 #include <limits>
 
 #include "clock.hpp"
 
 namespace imgv
 {
-clock::clock()
-    : m_start {underlying_clock::now()}
+static auto to_nanoseconds(double seconds) -> chr::nanoseconds
 {
+  return chr::round<chr::nanoseconds>(chr::duration<double>(seconds));
 }
 
-auto clock::now() const -> double
+auto playback_speed::from_double(double speed) -> playback_speed
 {
-  return calc_now(underlying_clock::now());
+  playback_speed ret;
+  ret.m_numerator = static_cast<i64>(
+      std::llround(speed * static_cast<double>(playback_speed::denominator)));
+  return ret;
 }
 
-auto clock::get_speed() const -> double
+auto playback_speed::to_double() const -> double
 {
-  return m_speed;
+  return static_cast<double>(m_numerator) / static_cast<double>(denominator);
 }
 
-auto clock::set_speed(double speed) -> void
+auto playback_speed::scale(chr::nanoseconds time) const -> chr::nanoseconds
 {
-  save_state();
-  m_speed = speed;
+  // split the multiplication so that weeks worth of nanoseconds do not
+  // overflow
+  const auto count = time.count();
+  return chr::nanoseconds {count / denominator * m_numerator
+                           + count % denominator * m_numerator / denominator};
 }
 
-auto clock::seek_forwards(double time) -> void
+auto playback_speed::unscale(chr::nanoseconds time) const -> chr::nanoseconds
+{
+  const auto speed = std::llabs(m_numerator);
+  const auto count = time.count();
+  return chr::nanoseconds {count / speed * denominator
+                           + count % speed * denominator / speed};
+}
+
+clock::clock()
+    : clock {underlying_clock::now()}
 {
-  m_offset += time;
 }
 
-auto clock::save_state() -> void
+clock::clock(time_point start)
+    : m_start {start}
 {
-  auto now = underlying_clock::now();
-  m_offset = calc_now(now);
-  m_start = now;
 }
 
-auto clock::calc_now(time_point time) const -> double
+auto clock::now() const -> chr::nanoseconds
+{
+  return at(underlying_clock::now());
+}
+
+auto clock::at(time_point time) const -> chr::nanoseconds
 {
   return m_offset
-      + m_speed
-      * chr::duration_cast<chr::duration<double>>(time - m_start).count();
+      + m_speed.scale(chr::duration_cast<chr::nanoseconds>(time - m_start));
+}
+
+auto clock::get_speed() const -> playback_speed
+{
+  return m_speed;
+}
+
+auto clock::set_speed(playback_speed speed) -> void
+{
+  set_speed(speed, underlying_clock::now());
+}
+
+auto clock::set_speed(playback_speed speed, time_point time) -> void
+{
+  m_offset = at(time);
+  m_start = time;
+  m_speed = speed;
+}
+
+auto clock::seek_forwards(chr::nanoseconds time) -> void
+{
+  m_offset += time;
 }
 
 auto state_clock::update_play_pause(const play_pause_event& e) -> void
 {
   e.update(m_playing);
-  m_base.set_speed(m_playing ? m_last_speed : 0.0);
+  m_base.set_speed(playback_speed::from_double(m_playing ? m_last_speed : 0.0));
 }
 
 auto state_clock::update_speed(const speed_event& e) -> void
 {
   e.update(m_last_speed);
   if (m_playing) {
-    m_base.set_speed(m_last_speed);
+    m_base.set_speed(playback_speed::from_double(m_last_speed));
   }
 }
 
@@ -63,25 +102,32 @@ auto state_clock::update_seek(const seek_event& e) -> void
 {
   auto last_seek = m_total_seek;
   e.update(m_total_seek);
-  m_base.seek_forwards(m_total_seek - last_seek);
+  // both totals are rounded the same way, so repeated seeks do not drift
+  m_base.seek_forwards(to_nanoseconds(m_total_seek)
+                       - to_nanoseconds(last_seek));
 }
 
-auto state_clock::now() const -> double
+auto state_clock::now() const -> chr::nanoseconds
 {
   return m_base.now();
 }
 
-auto state_clock::rescale(double time) const -> double
+auto state_clock::speed() const -> playback_speed
+{
+  return m_base.get_speed();
+}
+
+auto state_clock::rescale(chr::nanoseconds time) const -> double
 {
-  if (time <= 0) {
+  if (time <= chr::nanoseconds::zero()) {
     return 0;
   }
   auto speed = m_base.get_speed();
-  if (std::fabs(speed) < 1e-3) {
+  if (speed.paused()) {
     return std::numeric_limits<double>::infinity();
   }
 
-  return time / speed;
+  return chr::duration<double>(speed.unscale(time)).count();
 }
 
 }  // namespace imgv
@@ -7,27 +7,59 @@
 namespace imgv
 {
 namespace chr = std::chrono;
-class clock
+
+// playback speed as an exact fixed point ratio
+// speed_event changes the speed in steps of 0.1, which doubles cannot
+// represent exactly, so the speed is quantized to 1/denominator
+class playback_speed
 {
 public:
-  clock();
-  auto now() const -> double;
+  static constexpr i64 denominator = 1000;
 
-  auto get_speed() const -> double;
+  constexpr playback_speed() = default;
 
-  auto set_speed(double speed) -> void;
+  static auto from_double(double speed) -> playback_speed;
 
-  auto seek_forwards(double time) -> void;
+  auto to_double() const -> double;
+  auto paused() const -> bool { return m_numerator == 0; }
+  auto reversed() const -> bool { return m_numerator < 0; }
+
+  // time * speed, rounded towards zero
+  auto scale(chr::nanoseconds time) const -> chr::nanoseconds;
+  // time / |speed|, the speed must not be zero
+  auto unscale(chr::nanoseconds time) const -> chr::nanoseconds;
 
 private:
+  i64 m_numerator {denominator};
+};
+
+// playback position on an integer nanosecond timeline
+// positions are computed from the last speed change, so no error builds up
+// while the clock runs, however long it runs
+class clock
+{
+public:
   using underlying_clock = chr::steady_clock;
   using time_point = typename underlying_clock::time_point;
-  time_point m_start;
 
-  double m_speed {1.0}, m_offset {0.0};
+  clock();
+  explicit clock(time_point start);
+
+  auto now() const -> chr::nanoseconds;
+  auto at(time_point time) const -> chr::nanoseconds;
+
+  auto get_speed() const -> playback_speed;
+
+  auto set_speed(playback_speed speed) -> void;
+  auto set_speed(playback_speed speed, time_point time) -> void;
+
+  auto seek_forwards(chr::nanoseconds time) -> void;
 
-  auto save_state() -> void;
-  auto calc_now(time_point time) const -> double;
+private:
+  time_point m_start;
+
+  playback_speed m_speed {};
+  chr::nanoseconds m_offset {0};
 };
 
 // clock that remembers state
@@ -40,9 +72,12 @@ public:
   auto update_speed(const speed_event& e) -> void;
   auto update_seek(const seek_event& e) -> void;
 
-  auto now() const -> double;
+  auto now() const -> chr::nanoseconds;
+  auto speed() const -> playback_speed;
 
-  auto rescale(double time) const -> double;
+  // convert a timeline duration to the wall clock time (in seconds) it takes
+  // to play it
+  auto rescale(chr::nanoseconds time) const -> double;
 
 private:
   clock m_base;
@@ -50,4 +85,12 @@ private:
   double m_last_speed {1.0};
   double m_total_seek {0.0};
 };
+
+// position of time on a timeline looping every duration, in [0, duration)
+inline auto loop_position(chr::nanoseconds time, chr::nanoseconds duration)
+    -> chr::nanoseconds
+{
+  auto pos = time % duration;
+  return pos < chr::nanoseconds::zero() ? pos + duration : pos;
+}
 }  // namespace imgv
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 
 #include "context.hpp"
 
@@ -7,7 +8,10 @@
 #include <nfd.hpp>
 
 #include "mpv_window.hpp"
+#include "navigator.hpp"
 #include "root_window.hpp"
+#include "tile_window.hpp"
+#include "trace.hpp"
 
 namespace imgv
 {
@@ -25,79 +29,350 @@ context::context(const vector<const char*>& args, bool& would_run)
     fmt::print(
         "Usage: imgv [paths to media files]...\n"
         "If no arguments, the program will automatically launch a file dialog"
-        " for the user to choose the media files.\n");
+        " for the user to choose the media files.\n"
+        "With --headless (or --headless=osmesa for software rendering), no"
+        " display server is used and the program exits once every file is"
+        " drawn and no animation is left.\n"
+        "If IMGV_TRACE is set, timings are recorded and written to the file"
+        " it names as Chrome trace JSON on exit and when F12 is pressed.\n"
+        "With --tile, the images are shown side by side in a single window.\n"
+        "With --deferred-compression, images are shown uncompressed first"
+        " and compressed in the background.\n"
+        "F3 shows a performance overlay, its font is read from IMGV_FONT if"
+        " set.\n"
+        "S cycles the scaling filter of an image: nearest, bicubic, lanczos"
+        " and ewa.\n"
+        "The mouse wheel zooms an image inside its window, dragging then"
+        " pans it and 0 fits it again.\n"
+        "On Linux, statistics are written to stderr as JSON on SIGUSR1, and"
+        " served on the UNIX socket named by IMGV_STATS_SOCKET if it is"
+        " set.\n");
     would_run = false;
     return;
   }
 
-  for (const auto& arg : args) {
-    open(arg);
+  if (!headless()) {
+    m_nfd.emplace();
   }
 
-  if (args.empty()) {
-    for (const auto& path : open_dialog()) {
-      open(path.c_str());
+  try {
+    // NOLINTNEXTLINE(concurrency-mt-unsafe)
+    const auto* socket_path = std::getenv("IMGV_STATS_SOCKET");
+    m_stats.emplace(socket_path != nullptr ? socket_path : "",
+                    *m_queue,
+                    m_workers);
+  } catch (std::exception& ex) {
+    fmt::print("warn: unable to start the statistics server\n");
+    dump_exception(ex);
+  }
+
+  vector<string> paths;
+  for (const auto* arg : args) {
+    if (std::strcmp("--tile", arg) == 0) {
+      m_tiled = true;
+    } else if (std::strcmp("--deferred-compression", arg) == 0) {
+      m_textures.defer_compression(m_workers);
+    } else {
+      paths.emplace_back(arg);
     }
   }
 
+  if (paths.empty() && !headless()) {
+    paths = open_dialog();
+  }
+  open(paths);
+
   would_run = !m_windows.empty();
 }
 
+context::~context()
+{
+  while (!m_windows.empty()) {
+    destroy_last_window();
+  }
+}
+
 auto context::open(const char* path) -> void
 {
   try {
-    m_windows.push_back(create_window(this, path));
+    add_window(create_window(this, path));
   } catch (exception& ex) {
-    const auto msg = fmt::format("error opening media file '{}'", path);
-    boxer::show(
-        ex.what(), msg.c_str(), boxer::Style::Error, boxer::Buttons::OK);
+    show_error(fmt::format("error opening media file '{}'", path), ex);
   }
 }
 
-auto context::run() -> void
+auto context::open(const vector<string>& paths) -> void
 {
-  while (!m_windows.empty()) {
-    m_windows.erase(std::remove_if(m_windows.begin(),
-                                   m_windows.end(),
-                                   [](const auto& w) { return w->dead(); }),
-                    m_windows.end());
-
-    for (auto e = m_queue->pop(); e.has_value(); e = m_queue->pop()) {
-      if (auto* media_evt = std::get_if<media_open_event>(&*e);
-          media_evt != nullptr)
-      {
-        for (const auto& path : media_evt->paths) {
-          open(path.c_str());
-        }
-
-        continue;
-      }
-      if (auto w = handler(*e); w.has_value()) {
-        if (w.value()) {
-          w->get()->handle_event(*e);
-        }
-      } else {
-        for (auto& win : m_windows) {
-          win->handle_event(*e);
-        }
-      }
-    }
-
-    // 10 seconds at most
-    auto wait_time = 10.0;
-    for (auto& window : m_windows) {
-      auto window_wait_time = window->render();
-      wait_time = std::min(window_wait_time, wait_time);
+  if (!m_tiled || paths.size() < 2) {
+    for (const auto& path : paths) {
+      open(path.c_str());
     }
+    return;
+  }
 
-    if (wait_time < 0) {
-      glfwPollEvents();
+  // the images are read in one batch and decoded in parallel, anything else
+  // gets its own window
+  vector<string> files, others;
+  for (const auto& path : paths) {
+    std::error_code error;
+    if (fs::is_directory(path, error)) {
+      others.push_back(path);
+    } else if (std::find(files.begin(), files.end(), path) == files.end()) {
+      files.push_back(path);
+    }
+  }
+
+  // only the images are read whole, a video goes to its own window without
+  // being read first
+  const auto not_images =
+      std::stable_partition(files.begin(), files.end(), sniff_image_file);
+  others.insert(others.end(),
+                std::make_move_iterator(not_images),
+                std::make_move_iterator(files.end()));
+  files.erase(not_images, files.end());
+
+  auto decodes = decode_async(this, nullopt, files);
+  vector<decoded_image> images;
+  for (usize i = 0; i < files.size(); ++i) {
+    if (auto image = wait_decode(decodes[i]); image.has_value()) {
+      images.push_back(move(*image));
     } else {
-      glfwWaitEventsTimeout(wait_time);
+      others.push_back(files[i]);
+    }
+  }
+
+  if (!images.empty()) {
+    try {
+      add_window(std::make_shared<tile_window>(this, move(images)));
+    } catch (exception& ex) {
+      show_error("error opening images in tile_window", ex);
+    }
+  }
+
+  for (const auto& path : others) {
+    open(path.c_str());
+  }
+}
+
+auto context::add_window(shared_ptr<window> w) -> void
+{
+  m_dispatch.emplace(w->id(), w.get());
+  m_scheduler.schedule_now(w->id());
+  m_windows.push_back(move(w));
+}
+
+auto context::show_error(const string& msg, const exception& ex) -> void
+{
+  if (headless()) {
+    fmt::print(stderr, "{}\n", msg);
+    dump_exception(ex);
+    return;
+  }
+  boxer::show(ex.what(), msg.c_str(), boxer::Style::Error, boxer::Buttons::OK);
+}
+
+auto context::remove_dead_windows() -> void
+{
+  // partitioned rather than removed, so that the dead windows are still
+  // there to be destroyed one at a time
+  const auto it =
+      std::stable_partition(m_windows.begin(),
+                            m_windows.end(),
+                            [](const auto& w) { return !w->dead(); });
+  const auto dead_count = std::distance(it, m_windows.end());
+  for (auto dead = it; dead != m_windows.end(); ++dead) {
+    m_dispatch.erase((*dead)->id());
+    m_scheduler.cancel((*dead)->id());
+    m_budget.remove((*dead)->id());
+  }
+
+  for (auto i = dead_count; i > 0; --i) {
+    destroy_last_window();
+  }
+}
+
+auto context::destroy_last_window() -> void
+{
+  auto closing = move(m_windows.back());
+  m_windows.pop_back();
+
+  // any window of the share group can delete the textures, a live one is
+  // preferred as the dead ones are about to be destroyed too
+  window* heir = nullptr;
+  for (const auto& w : m_windows) {
+    heir = w.get();
+    if (!w->dead()) {
+      break;
+    }
+  }
+  m_textures.transfer(closing.get(), heir);
+}
+
+auto context::dispatch(event& e) -> void
+{
+  if (auto* media_evt = std::get_if<media_open_event>(&e);
+      media_evt != nullptr)
+  {
+    open(media_evt->paths);
+    return;
+  }
+
+  // the windows are told once the index is up to date
+  if (auto* changed = std::get_if<directory_changed_event>(&e);
+      changed != nullptr
+      && !m_directories.update(changed->directory, m_workers))
+  {
+    return;
+  }
+
+  if (auto id = handler(e); id.has_value()) {
+    // events of closed windows are dropped
+    if (auto it = m_dispatch.find(*id); it != m_dispatch.end()) {
+      it->second->handle_event(e);
+      m_scheduler.schedule_now(*id);
+    }
+  } else {
+    for (auto& win : m_windows) {
+      win->handle_event(e);
+      m_scheduler.schedule_now(win->id());
+    }
+  }
+}
+
+auto context::render_due_windows() -> void
+{
+  using clock_type = deadline_scheduler::clock_type;
+  m_scheduler.expire(clock_type::now(), m_due);
+  for (const auto id : m_due) {
+    auto it = m_dispatch.find(id);
+    if (it == m_dispatch.end()) {
+      continue;
+    }
+
+    // <0 indicates vsync, infinity means the window only needs to be
+    // rendered again when something happens to it
+    const auto wait_time = [&]
+    {
+      const trace_span span {"render"};
+      increment(counters().renders);
+      return it->second->render();
+    }();
+    if (wait_time < 0) {
+      m_scheduler.schedule_now(id);
+    } else if (std::isfinite(wait_time)) {
+      m_scheduler.schedule(
+          id,
+          clock_type::now()
+              + chr::duration_cast<clock_type::duration>(
+                  chr::duration<double>(wait_time)));
+    }
+  }
+
+  m_due.clear();
+}
+
+auto context::enforce_budget() -> void
+{
+  while (auto eviction = m_budget.next_eviction()) {
+    const auto [id, kind] = *eviction;
+    const auto it = m_dispatch.find(id);
+    if (it == m_dispatch.end()) {
+      m_budget.remove(id);
+      continue;
+    }
+
+    // textures shared with other windows are only freed once they all
+    // release them, so progress is measured on the window itself
+    const auto held = m_budget.window_bytes(id);
+    it->second->release_memory(kind);
+    if (m_budget.window_bytes(id) >= held) {
+      // the window could not release anything, the budget stays exceeded
+      // until something else changes
+      break;
     }
   }
 }
 
+auto context::wait_events(optional<deadline_scheduler::time_point> until)
+    -> void
+{
+  using clock_type = deadline_scheduler::clock_type;
+  auto deadline = m_scheduler.next_deadline();
+  if (until.has_value() && (!deadline.has_value() || *until < *deadline)) {
+    deadline = until;
+  }
+
+  // every wait below ends in a wakeup
+  increment(counters().wakeups);
+  if (headless()) {
+    // the null platform does not wake up for glfwPostEmptyEvent, wait on the
+    // event queue instead, polling only while background jobs may finish
+    // without pushing an event
+    if (!m_reader.idle() || !m_workers.idle()) {
+      const auto poll = clock_type::now() + headless_poll_interval;
+      deadline = deadline.has_value() ? std::min(*deadline, poll) : poll;
+    }
+    m_queue->wait(deadline);
+    glfwPollEvents();
+    return;
+  }
+
+  if (!deadline.has_value()) {
+    // nothing is animating, sleep until glfw or the event queue wakes us up
+    glfwWaitEvents();
+    return;
+  }
+
+  const auto wait_time =
+      chr::duration<double>(*deadline - clock_type::now()).count();
+  if (wait_time <= 0) {
+    glfwPollEvents();
+  } else {
+    glfwWaitEventsTimeout(wait_time);
+  }
+}
+
+auto context::run() -> void
+{
+  loop(nullopt);
+}
+
+auto context::run_until(deadline_scheduler::time_point deadline) -> void
+{
+  loop(deadline);
+}
+
+auto context::loop(optional<deadline_scheduler::time_point> until) -> void
+{
+  remove_dead_windows();
+  while (!m_windows.empty()) {
+    {
+      const trace_span span {"events"};
+      m_queue->drain([this](event& e) { dispatch(e); });
+    }
+    render_due_windows();
+    enforce_budget();
+    if (until.has_value()
+            ? deadline_scheduler::clock_type::now() >= *until
+            : headless() && idle())
+    {
+      // nobody can interact with headless windows, so once everything is
+      // drawn and no animation or job is left, the run is over
+      break;
+    }
+    wait_events(until);
+    remove_dead_windows();
+  }
+}
+
+auto context::idle() -> bool
+{
+  // in the order work flows: finished reads are decoded by the workers, whose
+  // last jobs may still push events
+  return m_reader.idle() && m_workers.idle() && m_queue->empty()
+      && !m_scheduler.next_deadline().has_value();
+}
+
 auto context::open_dialog() -> vector<string>
 {
   vector<string> paths;
@@ -2,11 +2,19 @@
 
 #include <filesystem>
 #include <string_view>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #include <fmt/core.h>
 
+#include "budget.hpp"
+#include "directory_index.hpp"
+#include "file_reader.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
+#include "texture_registry.hpp"
+#include "thread_pool.hpp"
 #include "types.hpp"
 #include "window.hpp"
 
@@ -18,23 +26,95 @@ namespace imgv
 
 using nfd = NFD::Guard;
 
+// how often a headless main loop checks for background jobs that finish
+// without pushing an event
+constexpr chr::milliseconds headless_poll_interval {1};
+
 class root_window;
 class context
 {
 public:
   context(const vector<const char*>& args, bool& would_run);
+  ~context();
+
+  context(const context&) = delete;
+  context(context&&) = delete;
+
+  auto operator=(const context&) = delete;
+  auto operator=(context&&) = delete;
+
   auto run() -> void;
+  // run the main loop until deadline, even once everything is idle, which
+  // lets tests watch an idle loop for a while
+  auto run_until(deadline_scheduler::time_point deadline) -> void;
 
   auto open_dialog() -> vector<string>;
 
   auto push_event(event&& e) { m_queue->push(move(e)); }
 
+  // called by window constructors
+  auto allocate_window_id() -> window_id { return m_next_window_id++; }
+
+  // render the window on the next main loop iteration
+  // must be called from the main thread
+  auto request_render(window_id id) -> void { m_scheduler.schedule_now(id); }
+
+  // background jobs, which may push events to wake up the main loop
+  auto workers() -> thread_pool& { return m_workers; }
+  // reads files ahead of their decoding on the workers
+  auto reader() -> file_reader& { return m_reader; }
+  // the listings of the directories opened so far, must be used from the
+  // main thread
+  auto directories() -> directory_indexes& { return m_directories; }
+
+  // windows report their texture memory here
+  auto budget() -> memory_budget& { return m_budget; }
+  // the textures shared by the windows showing the same file
+  auto textures() -> texture_registry& { return m_textures; }
+
 private:
-  nfd m_nfd;
+  // not initialized when headless, where there is no dialog to show
+  optional<nfd> m_nfd;
   shared_ptr<root_window> m_root_window;
   vector<shared_ptr<window>> m_windows;
+  // window id -> window, for routing windowed events
+  std::unordered_map<window_id, window*> m_dispatch;
+  window_id m_next_window_id {0};
   shared_event_queue m_queue;
+  deadline_scheduler m_scheduler;
+  memory_budget m_budget;
+  texture_registry m_textures;
+  // scratch buffer for the windows due in the current iteration
+  vector<window_id> m_due;
+  // the images opened together share a tile_window
+  bool m_tiled {false};
+  // the workers are stopped before anything they may use is destroyed
+  thread_pool m_workers;
+  // stopped before the workers, which receive its reads
+  file_reader m_reader {m_workers};
+  // pushes an event when a directory changes
+  directory_indexes m_directories {*m_queue};
+  // last member: reads the queue and the workers until it is stopped
+  optional<stats_server> m_stats;
 
   auto open(const char* path) -> void;
+  auto open(const vector<string>& paths) -> void;
+  auto add_window(shared_ptr<window> w) -> void;
+  // in a message box, or on stderr when headless
+  auto show_error(const string& msg, const exception& ex) -> void;
+  auto dispatch(event& e) -> void;
+  auto remove_dead_windows() -> void;
+  // destroy the last window of m_windows, after handing the textures it
+  // created over to a window that stays
+  auto destroy_last_window() -> void;
+  auto render_due_windows() -> void;
+  // make windows release memory until the budget is met
+  auto enforce_budget() -> void;
+  auto loop(optional<deadline_scheduler::time_point> until) -> void;
+  // sleep until an event, the next window deadline or until, whichever
+  // comes first
+  auto wait_events(optional<deadline_scheduler::time_point> until) -> void;
+  // nothing is left to draw and nothing can change on its own
+  auto idle() -> bool;
 };
 }  // namespace imgv
@@ -0,0 +1,625 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <numeric>
+
+#include "directory_index.hpp"
+
+#include <fmt/core.h>
+
+#ifdef __linux__
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/inotify.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include "image.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+// fewer files per sniffing job are not worth a job
+constexpr usize min_sniff_chunk = 64;
+// past this many changes at once the directory is scanned again instead
+constexpr usize max_incremental_changes = 1024;
+
+#ifdef __linux__
+// bytes of directory entries read by one getdents64 call
+constexpr usize getdents_buffer_size = 256 * 1024;
+constexpr u32 watch_mask = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO
+    | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR;
+constexpr char wake_stop = 'q';
+
+// fixed part of a linux_dirent64 record, the name follows d_type
+struct dirent_header
+{
+  u64 d_ino;
+  i64 d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+};
+
+constexpr usize dirent_name_offset = offsetof(dirent_header, d_type) + 1;
+#endif
+
+auto is_digit(char c) -> bool
+{
+  return c >= '0' && c <= '9';
+}
+
+auto to_lower(char c) -> unsigned char
+{
+  return static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+auto digits_end(string_view text, usize start) -> usize
+{
+  while (start < text.size() && is_digit(text[start])) {
+    ++start;
+  }
+  return start;
+}
+
+auto sniff_header(vector<u8> header) -> file_kind
+{
+  return !header.empty() && sniff_image(header) ? file_kind::image
+                                                : file_kind::other;
+}
+
+#ifdef __linux__
+// the file name of directory, relative to the directory descriptor, is a
+// regular file (following symbolic links)
+auto is_regular_file(int directory, const char* name) -> bool
+{
+  struct stat info {};
+  return ::fstatat(directory, name, &info, 0) == 0 && S_ISREG(info.st_mode);
+}
+
+auto sniff(int directory, const char* name) -> file_kind
+{
+  const auto fd = ::openat(directory, name, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+  if (fd < 0) {
+    return file_kind::other;
+  }
+
+  vector<u8> header(image_header_size);
+  const auto count = ::pread(fd, header.data(), header.size(), 0);
+  ::close(fd);
+  if (count <= 0) {
+    return file_kind::other;
+  }
+
+  header.resize(static_cast<usize>(count));
+  return sniff_header(move(header));
+}
+#else
+auto sniff(const fs::path& file) -> file_kind
+{
+  std::ifstream stream {file, std::ios::binary};
+  vector<u8> header(image_header_size);
+  stream.read(reinterpret_cast<char*>(header.data()),
+              static_cast<std::streamsize>(header.size()));
+  header.resize(static_cast<usize>(stream.gcount()));
+  return sniff_header(move(header));
+}
+#endif
+}  // namespace
+
+auto natural_less(string_view lhs, string_view rhs) -> bool
+{
+  usize i = 0, j = 0;
+  while (i < lhs.size() && j < rhs.size()) {
+    if (is_digit(lhs[i]) && is_digit(rhs[j])) {
+      // without leading zeros, the longer number is the larger one
+      while (i < lhs.size() && lhs[i] == '0') {
+        ++i;
+      }
+      while (j < rhs.size() && rhs[j] == '0') {
+        ++j;
+      }
+
+      const auto lhs_end = digits_end(lhs, i), rhs_end = digits_end(rhs, j);
+      if (lhs_end - i != rhs_end - j) {
+        return lhs_end - i < rhs_end - j;
+      }
+      if (const auto order =
+              lhs.substr(i, lhs_end - i).compare(rhs.substr(j, rhs_end - j));
+          order != 0)
+      {
+        return order < 0;
+      }
+
+      i = lhs_end;
+      j = rhs_end;
+      continue;
+    }
+
+    if (to_lower(lhs[i]) != to_lower(rhs[j])) {
+      return to_lower(lhs[i]) < to_lower(rhs[j]);
+    }
+    ++i;
+    ++j;
+  }
+
+  if (i < lhs.size() || j < rhs.size()) {
+    return j < rhs.size();
+  }
+
+  return lhs < rhs;
+}
+
+directory_index::directory_index(string directory)
+    : m_directory {move(directory)}
+{
+}
+
+auto directory_index::scan(thread_pool& workers) -> void
+{
+  const trace_span span {"scan directory"};
+#ifdef __linux__
+  const auto fd =
+      ::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    IMGV_ERROR(fmt::format(
+        "unable to open '{}': {}", m_directory, std::strerror(errno)));
+  }
+
+  clear();
+  vector<char> buffer(getdents_buffer_size);
+  while (true) {
+    const auto read =
+        ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+    if (read < 0) {
+      const auto error = errno;
+      ::close(fd);
+      IMGV_ERROR(fmt::format(
+          "unable to list '{}': {}", m_directory, std::strerror(error)));
+    }
+    if (read == 0) {
+      break;
+    }
+
+    for (usize offset = 0; offset < static_cast<usize>(read);) {
+      dirent_header entry {};
+      std::memcpy(&entry, &buffer[offset], sizeof(entry));
+      const auto* name = &buffer[offset + dirent_name_offset];
+      offset += entry.d_reclen;
+      if (entry.d_type == DT_REG
+          || ((entry.d_type == DT_LNK || entry.d_type == DT_UNKNOWN)
+              && is_regular_file(fd, name)))
+      {
+        append(name, file_kind::unknown);
+      }
+    }
+  }
+
+  sniff_all(workers, [fd](const char* name) { return sniff(fd, name); });
+  ::close(fd);
+#else
+  // without getdents64, listed by the standard library, which stats every
+  // entry
+  std::error_code error;
+  fs::directory_iterator it {m_directory, error};
+  if (error) {
+    IMGV_ERROR(fmt::format(
+        "unable to open '{}': {}", m_directory, error.message()));
+  }
+
+  clear();
+  for (; it != fs::directory_iterator {}; it.increment(error)) {
+    if (error) {
+      IMGV_ERROR(fmt::format(
+          "unable to list '{}': {}", m_directory, error.message()));
+    }
+
+    std::error_code ignored;
+    if (it->is_regular_file(ignored)) {
+      append(it->path().filename().string(), file_kind::unknown);
+    }
+  }
+
+  sniff_all(workers,
+            [this](const char* name)
+            { return sniff(fs::path {m_directory} / name); });
+#endif
+
+  m_order.resize(m_kinds.size());
+  std::iota(m_order.begin(), m_order.end(), u32 {0});
+  std::sort(m_order.begin(),
+            m_order.end(),
+            [this](u32 lhs, u32 rhs)
+            { return natural_less(slot_name(lhs), slot_name(rhs)); });
+}
+
+auto directory_index::clear() -> void
+{
+  m_names.clear();
+  m_name_offsets.clear();
+  m_name_sizes.clear();
+  m_kinds.clear();
+  m_removed = 0;
+  ++m_version;
+}
+
+auto directory_index::sniff_all(
+    thread_pool& workers,
+    const std::function<file_kind(const char* name)>& sniff_file) -> void
+{
+  // the kinds are written by the jobs, each to its own range of slots
+  const auto count = m_kinds.size();
+  const auto jobs_wanted = 4 * std::max<usize>(workers.size(), 1);
+  const auto chunk = std::max(min_sniff_chunk, count / jobs_wanted);
+  vector<std::future<void>> jobs;
+  for (usize first = 0; first < count; first += chunk) {
+    jobs.push_back(workers.submit(
+        [this, &sniff_file, first, last = std::min(count, first + chunk)]
+        {
+          for (auto slot = first; slot < last; ++slot) {
+            m_kinds[slot] =
+                sniff_file(slot_name(static_cast<u32>(slot)).data());
+          }
+        }));
+  }
+  for (auto& job : jobs) {
+    job.wait();
+  }
+}
+
+auto directory_index::name(usize position) const -> string_view
+{
+  return slot_name(m_order.at(position));
+}
+
+auto directory_index::path(usize position) const -> string
+{
+  return fmt::format("{}/{}", m_directory, name(position));
+}
+
+auto directory_index::kind(usize position) const -> file_kind
+{
+  return m_kinds[m_order.at(position)];
+}
+
+auto directory_index::find(string_view name) const -> optional<usize>
+{
+  const auto position = lower_bound(name);
+  if (position < m_order.size() && slot_name(m_order[position]) == name) {
+    return position;
+  }
+
+  return nullopt;
+}
+
+auto directory_index::lower_bound(string_view name) const -> usize
+{
+  const auto it =
+      std::lower_bound(m_order.begin(),
+                       m_order.end(),
+                       name,
+                       [this](u32 slot, string_view value)
+                       { return natural_less(slot_name(slot), value); });
+  return static_cast<usize>(std::distance(m_order.begin(), it));
+}
+
+auto directory_index::add(string_view name) -> void
+{
+  const string file {name};
+#ifdef __linux__
+  const auto fd =
+      ::open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  const auto regular = fd >= 0 && is_regular_file(fd, file.c_str());
+  const auto kind = regular ? sniff(fd, file.c_str()) : file_kind::other;
+  if (fd >= 0) {
+    ::close(fd);
+  }
+#else
+  const auto path = fs::path {m_directory} / file;
+  std::error_code ignored;
+  const auto regular = fs::is_regular_file(path, ignored);
+  const auto kind = regular ? sniff(path) : file_kind::other;
+#endif
+
+  if (!regular) {
+    // replaced by a directory, or already gone again
+    remove(name);
+    return;
+  }
+
+  ++m_version;
+  if (const auto position = find(name); position.has_value()) {
+    m_kinds[m_order[*position]] = kind;
+    return;
+  }
+
+  const auto slot = append(name, kind);
+  m_order.insert(
+      m_order.begin() + static_cast<std::ptrdiff_t>(lower_bound(name)), slot);
+}
+
+auto directory_index::remove(string_view name) -> void
+{
+  const auto position = find(name);
+  if (!position.has_value()) {
+    return;
+  }
+
+  ++m_version;
+  m_order.erase(m_order.begin() + static_cast<std::ptrdiff_t>(*position));
+  ++m_removed;
+  compact();
+}
+
+auto directory_index::slot_name(u32 slot) const -> string_view
+{
+  return {&m_names[m_name_offsets[slot]], m_name_sizes[slot]};
+}
+
+auto directory_index::append(string_view name, file_kind kind) -> u32
+{
+  const auto slot = static_cast<u32>(m_kinds.size());
+  m_name_offsets.push_back(static_cast<u32>(m_names.size()));
+  m_name_sizes.push_back(static_cast<u32>(name.size()));
+  m_kinds.push_back(kind);
+  // NUL terminated for the system calls
+  m_names.append(name);
+  m_names.push_back('\0');
+  return slot;
+}
+
+auto directory_index::compact() -> void
+{
+  if (m_removed * 2 <= m_kinds.size()) {
+    return;
+  }
+
+  string names;
+  vector<u32> offsets, sizes;
+  vector<file_kind> kinds;
+  names.swap(m_names);
+  offsets.swap(m_name_offsets);
+  sizes.swap(m_name_sizes);
+  kinds.swap(m_kinds);
+  for (auto& slot : m_order) {
+    slot = append(string_view {&names[offsets[slot]], sizes[slot]},
+                  kinds[slot]);
+  }
+  m_removed = 0;
+}
+
+directory_indexes::directory_indexes(event_queue& queue)
+    : m_queue {queue}
+{
+#ifdef __linux__
+  m_inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_inotify < 0
+      || ::pipe2(m_wake_pipe.data(), O_CLOEXEC | O_NONBLOCK) != 0)
+  {
+    fmt::print("warn: directories are not watched for changes: {}\n",
+               std::strerror(errno));
+    if (m_inotify >= 0) {
+      ::close(m_inotify);
+      m_inotify = -1;
+    }
+    return;
+  }
+
+  m_thread = std::thread {[this] { watch(); }};
+#endif
+}
+
+directory_indexes::~directory_indexes()
+{
+#ifdef __linux__
+  if (m_thread.joinable()) {
+    [[maybe_unused]] const auto written =
+        ::write(m_wake_pipe[1], &wake_stop, 1);
+    m_thread.join();
+  }
+
+  for (const auto fd : {m_inotify, m_wake_pipe[0], m_wake_pipe[1]}) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+#endif
+}
+
+auto directory_indexes::get(const string& directory, thread_pool& workers)
+    -> shared_ptr<const directory_index>
+{
+  prune();
+  auto key = directory_key(directory);
+  if (auto it = m_indexes.find(key); it != m_indexes.end()) {
+    return it->second.index;
+  }
+
+  // watched before scanning, so that nothing changed during the scan is
+  // missed
+  watched entry {std::make_shared<directory_index>(key), -1};
+  add_watch(key, entry);
+  try {
+    entry.index->scan(workers);
+  } catch (...) {
+    remove_watch(key, entry);
+    throw;
+  }
+
+  auto index = entry.index;
+  m_indexes.emplace(move(key), move(entry));
+  return index;
+}
+
+auto directory_indexes::update(const string& directory, thread_pool& workers)
+    -> bool
+{
+  const auto it = m_indexes.find(directory);
+  pending_changes pending;
+  {
+    const scoped_lock lock {m_mutex};
+    const auto changes = m_changes.find(directory);
+    if (changes == m_changes.end()) {
+      return false;
+    }
+
+    pending = move(changes->second);
+    m_changes.erase(changes);
+  }
+
+  if (it == m_indexes.end()) {
+    return false;
+  }
+
+  auto& index = *it->second.index;
+  if (pending.rescan || pending.changes.size() > max_incremental_changes) {
+    try {
+      index.scan(workers);
+    } catch (std::exception& ex) {
+      fmt::print("warn: unable to scan '{}' again\n", directory);
+      dump_exception(ex);
+    }
+    return true;
+  }
+
+  for (const auto& [name, removed] : pending.changes) {
+    if (removed) {
+      index.remove(name);
+    } else {
+      index.add(name);
+    }
+  }
+
+  return true;
+}
+
+#ifdef __linux__
+auto directory_indexes::watch() -> void
+{
+  set_trace_thread_name("inotify");
+  array<pollfd, 2> fds {pollfd {m_wake_pipe[0], POLLIN, 0},
+                        pollfd {m_inotify, POLLIN, 0}};
+  alignas(inotify_event) array<char, 64 * 1024> buffer {};
+  while (true) {
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      return;
+    }
+
+    // a directory is announced once until update() takes its changes
+    vector<string> announce;
+    {
+      const scoped_lock lock {m_mutex};
+      ssize_t length = 0;
+      while ((length = ::read(m_inotify, buffer.data(), buffer.size())) > 0) {
+        for (usize offset = 0; offset < static_cast<usize>(length);) {
+          inotify_event header {};
+          std::memcpy(&header, &buffer[offset], sizeof(header));
+          const auto* name = &buffer[offset + sizeof(header)];
+          offset += sizeof(header) + header.len;
+
+          if ((header.mask & IN_Q_OVERFLOW) != 0) {
+            for (const auto& [watch, directory] : m_watches) {
+              auto& pending = m_changes[directory];
+              if (!pending.rescan && pending.changes.empty()) {
+                announce.push_back(directory);
+              }
+              pending.rescan = true;
+            }
+            continue;
+          }
+
+          const auto it = m_watches.find(header.wd);
+          if (it == m_watches.end() || header.len == 0) {
+            continue;
+          }
+
+          auto& pending = m_changes[it->second];
+          if (!pending.rescan && pending.changes.empty()) {
+            announce.push_back(it->second);
+          }
+          pending.changes.push_back(
+              {name, (header.mask & (IN_DELETE | IN_MOVED_FROM)) != 0});
+        }
+      }
+    }
+
+    for (auto& directory : announce) {
+      m_queue.push(directory_changed_event {move(directory)});
+    }
+  }
+}
+#endif
+
+auto directory_indexes::prune() -> void
+{
+  for (auto it = m_indexes.begin(); it != m_indexes.end();) {
+    if (it->second.index.use_count() > 1) {
+      ++it;
+      continue;
+    }
+
+    remove_watch(it->first, it->second);
+    it = m_indexes.erase(it);
+  }
+}
+
+auto directory_indexes::add_watch([[maybe_unused]] const string& directory,
+                                  [[maybe_unused]] watched& entry) -> void
+{
+#ifdef __linux__
+  if (m_inotify >= 0) {
+    const scoped_lock lock {m_mutex};
+    entry.watch =
+        ::inotify_add_watch(m_inotify, directory.c_str(), watch_mask);
+    if (entry.watch >= 0) {
+      m_watches[entry.watch] = directory;
+    }
+  }
+#else
+  // without inotify, changes are only seen when the directory is opened
+  // again once nothing uses its index anymore
+#endif
+}
+
+auto directory_indexes::remove_watch([[maybe_unused]] const string& directory,
+                                     [[maybe_unused]] watched& entry) -> void
+{
+#ifdef __linux__
+  if (entry.watch >= 0) {
+    const scoped_lock lock {m_mutex};
+    ::inotify_rm_watch(m_inotify, entry.watch);
+    m_watches.erase(entry.watch);
+    m_changes.erase(directory);
+    entry.watch = -1;
+  }
+#endif
+}
+
+auto directory_key(const string& directory) -> string
+{
+  std::error_code error;
+  const auto absolute =
+      fs::absolute(directory.empty() ? "." : directory, error);
+  if (error) {
+    return directory;
+  }
+
+  const auto canonical = fs::weakly_canonical(absolute, error);
+  return (error ? absolute.lexically_normal() : canonical).string();
+}
+}  // namespace imgv
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+#include "events.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+class thread_pool;
+
+// "img2" < "img10": runs of digits compare by value, everything else ASCII
+// case-insensitively, ties are broken bytewise so that only equal strings
+// compare equal
+auto natural_less(string_view lhs, string_view rhs) -> bool;
+
+enum class file_kind : u8
+{
+  // not sniffed yet, treated as a possible image
+  unknown,
+  image,
+  // anything no image loader accepts, including empty files
+  other,
+};
+
+// the regular files of a directory in natural order, with their kinds sniffed
+// from the first bytes
+//
+// the entries are stored as a structure of arrays (names packed in one
+// string, then offsets, sizes and kinds) addressed by slot, and ordered by a
+// separate array of slots, so that a folder of 200k files stays a handful of
+// allocations and inserting a file only moves 4 bytes per later entry
+class directory_index
+{
+public:
+  // an empty index, filled by scan()
+  explicit directory_index(string directory);
+
+  // list the directory (with getdents64 on Linux) and sniff the files on
+  // workers, waiting for them, throws if the directory cannot be read
+  auto scan(thread_pool& workers) -> void;
+
+  auto directory() const -> const string& { return m_directory; }
+  auto size() const -> usize { return m_order.size(); }
+  auto empty() const -> bool { return m_order.empty(); }
+  auto name(usize position) const -> string_view;
+  auto path(usize position) const -> string;
+  auto kind(usize position) const -> file_kind;
+  // position of name, nullopt if it is not listed
+  auto find(string_view name) const -> optional<usize>;
+  // position name would be inserted at
+  auto lower_bound(string_view name) const -> usize;
+  // incremented by every change, so users know when positions moved
+  auto version() const -> u64 { return m_version; }
+
+  // add name (or sniff it again if it is listed), it is removed instead if it
+  // is not a regular file anymore
+  auto add(string_view name) -> void;
+  auto remove(string_view name) -> void;
+
+private:
+  string m_directory;
+  string m_names;
+  vector<u32> m_name_offsets;
+  vector<u32> m_name_sizes;
+  vector<file_kind> m_kinds;
+  // slots in natural order of their names, removed slots are left out
+  vector<u32> m_order;
+  usize m_removed {0};
+  u64 m_version {0};
+
+  auto slot_name(u32 slot) const -> string_view;
+  auto append(string_view name, file_kind kind) -> u32;
+  // forget every entry, before a scan
+  auto clear() -> void;
+  // set the kind of every slot with sniff_file, called with the names on the
+  // workers
+  auto sniff_all(thread_pool& workers,
+                 const std::function<file_kind(const char* name)>& sniff_file)
+      -> void;
+  // drop the names of removed slots once they are the majority
+  auto compact() -> void;
+};
+
+// the indexes of the directories opened so far, shared by the windows so that
+// a directory is only scanned once, and kept up to date from an inotify
+// watch on Linux (elsewhere, they are not watched)
+//
+// a thread waits for the inotify events and pushes a directory_changed_event,
+// the index itself is only touched by the main thread, in update()
+class directory_indexes
+{
+public:
+  explicit directory_indexes(event_queue& queue);
+  ~directory_indexes();
+
+  directory_indexes(const directory_indexes&) = delete;
+  directory_indexes(directory_indexes&&) = delete;
+
+  auto operator=(const directory_indexes&) = delete;
+  auto operator=(directory_indexes&&) = delete;
+
+  // the index of directory, scanned (and watched) the first time, throws if
+  // it cannot be read
+  auto get(const string& directory, thread_pool& workers)
+      -> shared_ptr<const directory_index>;
+
+  // apply the changes reported for directory, returns false if there were
+  // none
+  auto update(const string& directory, thread_pool& workers) -> bool;
+
+private:
+  struct watched
+  {
+    shared_ptr<directory_index> index;
+    int watch {-1};
+  };
+
+  struct change
+  {
+    string name;
+    bool removed;
+  };
+
+  // read by the thread, applied by update()
+  struct pending_changes
+  {
+    vector<change> changes;
+    // inotify dropped events, the directory is scanned again
+    bool rescan {false};
+  };
+
+  event_queue& m_queue;
+  int m_inotify {-1};
+  array<int, 2> m_wake_pipe {-1, -1};
+  std::unordered_map<string, watched> m_indexes;
+
+  mutex m_mutex;
+  // watch descriptor -> directory, and the changes not applied yet
+  std::unordered_map<int, string> m_watches;
+  std::unordered_map<string, pending_changes> m_changes;
+  std::thread m_thread;
+
+  // the thread reading inotify, Linux only
+  auto watch() -> void;
+  auto add_watch(const string& directory, watched& entry) -> void;
+  auto remove_watch(const string& directory, watched& entry) -> void;
+  // drop the indexes nobody uses anymore
+  auto prune() -> void;
+};
+
+// the path an index of directory is kept under, absolute and without
+// symbolic links when it exists
+auto directory_key(const string& directory) -> string;
+}  // namespace imgv
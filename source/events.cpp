@@ -8,23 +8,63 @@
 namespace imgv
 {
 
+event_queue::~event_queue()
+{
+  const node_chain chain {take_all()};
+}
+
+event_queue::node_chain::~node_chain()
+{
+  while (head != nullptr) {
+    delete std::exchange(head, head->next);
+  }
+}
+
 auto event_queue::push(event e) -> void
 {
-  const scoped_lock lock {m_mutex};
-  m_events.push_back(move(e));
-  glfwPostEmptyEvent();
+  auto* n = new node {move(e), nullptr};
+  m_size.fetch_add(1, std::memory_order_relaxed);
+  auto* head = m_head.load(std::memory_order_relaxed);
+  do {
+    n->next = head;
+  } while (!m_head.compare_exchange_weak(
+      head, n, std::memory_order_release, std::memory_order_relaxed));
+
+  if (head == nullptr) {
+    glfwPostEmptyEvent();
+    // wait() checks empty() with the mutex held, so the push is either seen
+    // by that check or notified once it waits
+    { const scoped_lock lock {m_wait_mutex}; }
+    m_wake.notify_one();
+  }
 }
 
-auto event_queue::pop() -> optional<event>
+auto event_queue::wait(optional<std::chrono::steady_clock::time_point> deadline)
+    -> void
 {
-  const scoped_lock lock {m_mutex};
-  if (m_events.empty()) {
-    return nullopt;
+  std::unique_lock lock {m_wait_mutex};
+  const auto ready = [this] { return !empty(); };
+  if (deadline.has_value()) {
+    m_wake.wait_until(lock, *deadline, ready);
+  } else {
+    m_wake.wait(lock, ready);
+  }
+}
+
+auto event_queue::take_all() -> node*
+{
+  auto* head = m_head.exchange(nullptr, std::memory_order_acquire);
+
+  // the stack is in LIFO order, reverse it
+  node* reversed = nullptr;
+  while (head != nullptr) {
+    auto* next = head->next;
+    head->next = reversed;
+    reversed = head;
+    head = next;
   }
 
-  auto e = m_events.front();
-  m_events.pop_front();
-  return e;
+  return reversed;
 }
 
 }  // namespace imgv
@@ -1,6 +1,10 @@
 #pragma once
 
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <type_traits>
 
 #include <mpv/client.h>
@@ -11,22 +15,26 @@
 namespace imgv
 {
 
-class window;
+// stable window identifier, assigned by context when the window is created
+// and never reused, events address windows through it
+using window_id = std::uint32_t;
 
 struct windowed_event
 {
-  weak_ptr<window> handler_window;
+  window_id handler_window;
 
-  auto handler() const -> optional<shared_ptr<window>>
-  {
-    return handler_window.lock();
-  }
+  auto handler() const -> optional<window_id> { return handler_window; }
 };
 
 struct mpv_render_update_event : public windowed_event
 {
 };
 
+// mpv has events waiting to be drained with mpv_wait_event
+struct mpv_wakeup_event : public windowed_event
+{
+};
+
 enum class change_mode
 {
   set,
@@ -80,31 +88,103 @@ struct seek_event
 {
 };
 
+// move to the image offset files away in the directory of the current one
+struct navigate_event : public windowed_event
+{
+  int offset;
+};
+
+// a background decode requested by the window has finished
+struct prefetch_event : public windowed_event
+{
+};
+
 struct media_open_event
 {
   vector<string> paths;
 
-  auto handler() -> optional<shared_ptr<window>> { return nullopt; }
+  auto handler() const -> optional<window_id> { return nullopt; }
+};
+
+// files were added to or removed from a directory with an index, handled by
+// context (which updates the index) and then by every window
+struct directory_changed_event
+{
+  // as returned by directory_key()
+  string directory;
+
+  auto handler() const -> optional<window_id> { return nullopt; }
 };
 
 using event = variant<mpv_render_update_event,
+                      mpv_wakeup_event,
                       play_pause_event,
                       speed_event,
                       seek_event,
-                      media_open_event>;
+                      navigate_event,
+                      prefetch_event,
+                      media_open_event,
+                      directory_changed_event>;
 
-inline auto handler(event& e) -> optional<shared_ptr<window>>
+// nullopt means the event is not bound to any window
+inline auto handler(const event& e) -> optional<window_id>
 {
-  return visit([](auto& ev) { return ev.handler(); }, e);
+  return visit([](const auto& ev) { return ev.handler(); }, e);
 }
 
+// lock-free multi-producer single-consumer queue
+// producers push onto an intrusive stack, the consumer detaches the whole
+// stack at once and replays it in push order, so events are moved (never
+// copied) and the consumer never contends with the producers
 class event_queue
 {
 public:
   event_queue() = default;
+  ~event_queue();
+
+  event_queue(const event_queue&) = delete;
+  event_queue(event_queue&&) = delete;
+
+  auto operator=(const event_queue&) = delete;
+  auto operator=(event_queue&&) = delete;
 
+  // the main loop is only woken up when the queue goes from empty to
+  // non-empty, later pushes will be picked up by the same drain
   auto push(event e) -> void;
-  auto pop() -> optional<event>;
+
+  // handle every pending event in push order, returns the number of
+  // handled events
+  // must only be called from the consumer thread
+  template<typename Func>
+  auto drain(Func&& func) -> usize
+  {
+    node_chain chain {take_all()};
+    usize count = 0;
+    while (chain.head != nullptr) {
+      const unique_ptr<node> current {
+          std::exchange(chain.head, chain.head->next)};
+      m_size.fetch_sub(1, std::memory_order_relaxed);
+      std::invoke(func, current->value);
+      ++count;
+    }
+
+    return count;
+  }
+
+  // no event is waiting, may be outdated as soon as it returns unless every
+  // producer is known to be idle
+  auto empty() const -> bool
+  {
+    return m_head.load(std::memory_order_acquire) == nullptr;
+  }
+
+  // events pushed and not handled yet, for statistics
+  auto size() const -> usize { return m_size.load(std::memory_order_relaxed); }
+
+  // block until an event is waiting or deadline (if any) has passed, for a
+  // consumer that glfwPostEmptyEvent does not wake up (the null platform of
+  // headless runs)
+  auto wait(optional<std::chrono::steady_clock::time_point> deadline) -> void;
 
   template<typename T, typename... Args>
   auto emplace(Args&&... args) -> void
@@ -114,8 +194,29 @@ public:
   }
 
 private:
-  std::mutex m_mutex;
-  std::deque<event> m_events {};
+  struct node
+  {
+    event value;
+    node* next;
+  };
+
+  // frees the nodes left behind if an event handler throws
+  // NOLINTNEXTLINE(*-special-member-functions)
+  struct node_chain
+  {
+    node* head;
+
+    ~node_chain();
+  };
+
+  std::atomic<node*> m_head {nullptr};
+  std::atomic<usize> m_size {0};
+  // only taken on the empty to non-empty transition, to hand it to wait()
+  mutex m_wait_mutex;
+  std::condition_variable m_wake;
+
+  // detach every pushed node, returned in push order
+  auto take_all() -> node*;
 };
 
 using weak_event_queue = weak_ptr<event_queue>;
@@ -0,0 +1,640 @@
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <thread>
+
+#include "file_reader.hpp"
+
+#include <fmt/core.h>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#ifdef IMGV_IO_URING
+#  include <linux/io_uring.h>
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#endif
+
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+constexpr auto relaxed = std::memory_order_relaxed;
+
+auto count_read(usize bytes, i64 start) -> void
+{
+  auto& all = counters();
+  increment(all.file_reads);
+  all.file_read_bytes.fetch_add(bytes, relaxed);
+  all.file_read_nanoseconds.fetch_add(static_cast<u64>(stats_now() - start),
+                                      relaxed);
+}
+
+#ifdef __linux__
+// closes fd on destruction
+struct descriptor
+{
+  int fd {-1};
+
+  descriptor() = default;
+  explicit descriptor(int value)
+      : fd {value}
+  {
+  }
+  ~descriptor()
+  {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  descriptor(const descriptor&) = delete;
+  descriptor(descriptor&&) = delete;
+
+  auto operator=(const descriptor&) = delete;
+  auto operator=(descriptor&&) = delete;
+};
+
+// size of the regular file open as fd, nullopt for anything else
+auto regular_file_size(int fd) -> optional<usize>
+{
+  struct stat info {};
+  if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    return nullopt;
+  }
+
+  return static_cast<usize>(info.st_size);
+}
+#endif
+}  // namespace
+
+#ifdef IMGV_IO_URING
+namespace
+{
+// reads in flight at once, which also bounds the memory of the ring
+constexpr unsigned ring_entries = 64;
+// user_data of the poll on the wake eventfd, reads use their request address
+constexpr u64 wake_tag = 0;
+
+struct mapping
+{
+  void* address {MAP_FAILED};
+  usize size {0};
+
+  mapping() = default;
+  mapping(int fd, usize length, u64 offset)
+      : address {::mmap(nullptr,
+                        length,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        fd,
+                        static_cast<off_t>(offset))}
+      , size {length}
+  {
+    if (address == MAP_FAILED) {
+      IMGV_ERROR(fmt::format("unable to map io_uring: {}",
+                             std::strerror(errno)));
+    }
+  }
+  ~mapping()
+  {
+    if (address != MAP_FAILED) {
+      ::munmap(address, size);
+    }
+  }
+
+  mapping(const mapping&) = delete;
+  mapping(mapping&&) = delete;
+
+  auto operator=(const mapping&) = delete;
+  auto operator=(mapping&&) = delete;
+
+  template<typename T>
+  auto at(u64 offset) const -> T*
+  {
+    return reinterpret_cast<T*>(static_cast<char*>(address) + offset);
+  }
+};
+}  // namespace
+
+// io_uring driven by raw system calls, so that liburing is not needed
+//
+// every file goes through IORING_OP_OPENAT, IORING_OP_STATX and one
+// IORING_OP_READV (resubmitted after a short read), so that a slow open does
+// not hold up the rest of the batch, new batches wake the thread through an
+// eventfd polled by the ring itself, so it only ever blocks in io_uring_enter
+class file_reader::ring
+{
+public:
+  // throws if the kernel does not provide io_uring, or one of its operations
+  // used here (Linux 5.6 and later)
+  explicit ring(std::atomic<usize>& pending)
+      : m_pending {pending}
+  {
+    io_uring_params params {};
+    m_fd.fd = static_cast<int>(
+        ::syscall(__NR_io_uring_setup, ring_entries, &params));
+    if (m_fd.fd < 0) {
+      IMGV_ERROR(fmt::format("io_uring_setup failed: {}",
+                             std::strerror(errno)));
+    }
+
+    m_entries = params.sq_entries;
+    const auto sq_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const auto cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    m_sq_map.emplace(m_fd.fd,
+                     single ? std::max(sq_size, cq_size) : sq_size,
+                     IORING_OFF_SQ_RING);
+    if (!single) {
+      m_cq_map.emplace(m_fd.fd, cq_size, IORING_OFF_CQ_RING);
+    }
+    const auto& cq_map = single ? *m_sq_map : *m_cq_map;
+    m_sqe_map.emplace(m_fd.fd,
+                      params.sq_entries * sizeof(io_uring_sqe),
+                      IORING_OFF_SQES);
+
+    m_sq_tail = m_sq_map->at<unsigned>(params.sq_off.tail);
+    m_sq_mask = *m_sq_map->at<unsigned>(params.sq_off.ring_mask);
+    m_sq_array = m_sq_map->at<unsigned>(params.sq_off.array);
+    m_sqes = m_sqe_map->at<io_uring_sqe>(0);
+    m_cq_head = cq_map.at<unsigned>(params.cq_off.head);
+    m_cq_tail = cq_map.at<unsigned>(params.cq_off.tail);
+    m_cq_mask = *cq_map.at<unsigned>(params.cq_off.ring_mask);
+    m_cqes = cq_map.at<io_uring_cqe>(params.cq_off.cqes);
+    check_operations();
+
+    m_wake.fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wake.fd < 0) {
+      IMGV_ERROR(fmt::format("unable to create eventfd: {}",
+                             std::strerror(errno)));
+    }
+
+    m_thread = std::thread {[this] { run(); }};
+  }
+
+  ~ring()
+  {
+    {
+      const scoped_lock lock {m_mutex};
+      m_stopping = true;
+    }
+
+    ::eventfd_write(m_wake.fd, 1);
+    m_thread.join();
+  }
+
+  ring(const ring&) = delete;
+  ring(ring&&) = delete;
+
+  auto operator=(const ring&) = delete;
+  auto operator=(ring&&) = delete;
+
+  auto submit(vector<string> paths, const shared_ptr<callback>& done) -> void
+  {
+    {
+      const scoped_lock lock {m_mutex};
+      for (auto& path : paths) {
+        auto& r = m_queue.emplace_back(std::make_unique<request>());
+        r->path = move(path);
+        r->done = done;
+      }
+    }
+
+    ::eventfd_write(m_wake.fd, 1);
+  }
+
+private:
+  // the operation a request waits for, or needs an entry for
+  enum class stage
+  {
+    open,
+    stat,
+    read,
+  };
+
+  struct request
+  {
+    string path;
+    shared_ptr<callback> done;
+    stage next {stage::open};
+    descriptor file;
+    struct statx info {};
+    vector<u8> contents;
+    // bytes read so far
+    usize offset {0};
+    // the rest of contents, for the read in flight
+    iovec rest {};
+    i64 start {0}, trace_start {0};
+  };
+
+  std::atomic<usize>& m_pending;
+  descriptor m_fd, m_wake;
+  optional<mapping> m_sq_map, m_cq_map, m_sqe_map;
+  unsigned m_entries {0};
+  unsigned *m_sq_tail {nullptr}, *m_sq_array {nullptr};
+  unsigned *m_cq_head {nullptr}, *m_cq_tail {nullptr};
+  unsigned m_sq_mask {0}, m_cq_mask {0};
+  io_uring_sqe* m_sqes {nullptr};
+  io_uring_cqe* m_cqes {nullptr};
+
+  mutex m_mutex;
+  std::deque<unique_ptr<request>> m_queue;
+  bool m_stopping {false};
+  std::thread m_thread;
+
+  // the thread of the ring owns everything below
+  // opened, or waiting to be opened, without a free entry yet
+  std::deque<unique_ptr<request>> m_waiting;
+  // reads submitted and not completed yet
+  unsigned m_in_flight {0};
+  // queued in the submission ring but not taken by the kernel yet
+  unsigned m_unsubmitted {0};
+  bool m_wake_armed {false};
+
+  auto run() -> void
+  {
+    set_trace_thread_name("io");
+    while (true) {
+      bool stopping = false;
+      {
+        const scoped_lock lock {m_mutex};
+        stopping = m_stopping;
+        while (!m_queue.empty()) {
+          m_waiting.push_back(move(m_queue.front()));
+          m_queue.pop_front();
+        }
+      }
+
+      if (stopping) {
+        // reads in flight still write into their buffers, wait for them
+        m_pending.fetch_sub(m_waiting.size(), relaxed);
+        m_waiting.clear();
+        if (m_in_flight == 0) {
+          return;
+        }
+      } else if (!m_wake_armed) {
+        prepare_wake();
+      }
+
+      // one entry stays free for the wake poll
+      while (!m_waiting.empty() && m_in_flight + 1 < m_entries) {
+        auto r = move(m_waiting.front());
+        m_waiting.pop_front();
+        prepare(move(r));
+      }
+
+      const auto submitted = static_cast<int>(
+          ::syscall(__NR_io_uring_enter,
+                    m_fd.fd,
+                    m_unsubmitted,
+                    1,
+                    IORING_ENTER_GETEVENTS,
+                    nullptr,
+                    0));
+      if (submitted >= 0) {
+        m_unsubmitted -= static_cast<unsigned>(submitted);
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        // the reads in flight keep their buffers, leaking them is the only
+        // safe option left
+        fmt::print("warn: io_uring_enter failed: {}\n", std::strerror(errno));
+        return;
+      }
+
+      reap();
+    }
+  }
+
+  auto next_entry() -> io_uring_sqe&
+  {
+    // only this thread writes the tail
+    const auto tail = *m_sq_tail;
+    const auto index = tail & m_sq_mask;
+    auto& entry = m_sqes[index];
+    entry = {};
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++m_unsubmitted;
+    return entry;
+  }
+
+  auto prepare_wake() -> void
+  {
+    auto& entry = next_entry();
+    entry.opcode = IORING_OP_POLL_ADD;
+    entry.fd = m_wake.fd;
+    entry.poll_events = POLLIN;
+    entry.user_data = wake_tag;
+    m_wake_armed = true;
+  }
+
+  auto check_operations() -> void
+  {
+    constexpr usize op_count = 256;
+    vector<u8> buffer(sizeof(io_uring_probe)
+                      + op_count * sizeof(io_uring_probe_op));
+    auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (::syscall(__NR_io_uring_register,
+                  m_fd.fd,
+                  IORING_REGISTER_PROBE,
+                  probe,
+                  op_count)
+        != 0)
+    {
+      IMGV_ERROR(fmt::format("unable to probe io_uring: {}",
+                             std::strerror(errno)));
+    }
+
+    for (const auto op : {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READV})
+    {
+      if (op > probe->last_op
+          || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+      {
+        IMGV_ERROR(fmt::format("io_uring does not support operation {}",
+                               static_cast<int>(op)));
+      }
+    }
+  }
+
+  // submit the next operation of r, which the ring owns until it completes
+  auto prepare(unique_ptr<request> r) -> void
+  {
+    auto& entry = next_entry();
+    switch (r->next) {
+      case stage::open:
+        r->start = stats_now();
+        r->trace_start = tracing() ? detail::trace_now() : 0;
+        entry.opcode = IORING_OP_OPENAT;
+        entry.fd = AT_FDCWD;
+        entry.addr = reinterpret_cast<u64>(r->path.c_str());
+        entry.open_flags = O_RDONLY | O_CLOEXEC;
+        break;
+      case stage::stat:
+        // of the open file itself, with an empty path
+        entry.opcode = IORING_OP_STATX;
+        entry.fd = r->file.fd;
+        entry.addr = reinterpret_cast<u64>("");
+        entry.len = STATX_TYPE | STATX_SIZE;
+        entry.statx_flags = AT_EMPTY_PATH;
+        entry.off = reinterpret_cast<u64>(&r->info);
+        break;
+      case stage::read:
+        r->rest.iov_base = r->contents.data() + r->offset;
+        r->rest.iov_len = r->contents.size() - r->offset;
+        entry.opcode = IORING_OP_READV;
+        entry.fd = r->file.fd;
+        entry.addr = reinterpret_cast<u64>(&r->rest);
+        entry.len = 1;
+        entry.off = r->offset;
+        break;
+    }
+
+    entry.user_data = reinterpret_cast<u64>(r.release());
+    ++m_in_flight;
+  }
+
+  // move r to its next stage once an operation succeeded with result
+  auto advance(unique_ptr<request> r, int result) -> void
+  {
+    switch (r->next) {
+      case stage::open:
+        r->file.fd = result;
+        r->next = stage::stat;
+        break;
+      case stage::stat:
+        if (!S_ISREG(r->info.stx_mode)) {
+          finish(*r, false);
+          return;
+        }
+        r->contents.resize(static_cast<usize>(r->info.stx_size));
+        if (r->contents.empty()) {
+          finish(*r, true);
+          return;
+        }
+        r->next = stage::read;
+        break;
+      case stage::read:
+        if (result == 0) {
+          // the file shrank since it was opened
+          r->contents.resize(r->offset);
+          finish(*r, true);
+          return;
+        }
+        r->offset += static_cast<usize>(result);
+        if (r->offset == r->contents.size()) {
+          finish(*r, true);
+          return;
+        }
+        break;
+    }
+
+    m_waiting.push_front(move(r));
+  }
+
+  auto reap() -> void
+  {
+    auto head = *m_cq_head;
+    const auto tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const auto& completion = m_cqes[head & m_cq_mask];
+      if (completion.user_data == wake_tag) {
+        eventfd_t ignored = 0;
+        ::eventfd_read(m_wake.fd, &ignored);
+        m_wake_armed = false;
+        continue;
+      }
+
+      --m_in_flight;
+      unique_ptr<request> r {
+          reinterpret_cast<request*>(completion.user_data)};
+      const auto result = completion.res;
+      if (result == -EINTR || result == -EAGAIN) {
+        m_waiting.push_front(move(r));
+      } else if (result < 0) {
+        finish(*r, false);
+      } else {
+        advance(move(r), result);
+      }
+    }
+
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  auto finish(request& r, bool success) -> void
+  {
+    if (success) {
+      count_read(r.contents.size(), r.start);
+      if (r.trace_start != 0) {
+        detail::trace_record(
+            "read file", r.trace_start, detail::trace_now() - r.trace_start);
+      }
+    }
+
+    (*r.done)(r.path,
+              success ? optional<vector<u8>> {move(r.contents)} : nullopt);
+    m_pending.fetch_sub(1, relaxed);
+  }
+};
+#else
+// only declared so that unique_ptr<ring> can be destroyed
+class file_reader::ring
+{
+public:
+  auto submit(vector<string> /*paths*/, const shared_ptr<callback>& /*done*/)
+      -> void
+  {
+  }
+};
+#endif
+
+file_reader::file_reader(thread_pool& fallback)
+    : m_fallback {fallback}
+    , m_pending {std::make_shared<std::atomic<usize>>(0)}
+{
+#ifdef IMGV_IO_URING
+  try {
+    m_ring = std::make_unique<ring>(*m_pending);
+  } catch (std::exception& ex) {
+    fmt::print("warn: io_uring is not available, reading files on workers\n");
+    dump_exception(ex);
+  }
+#endif
+}
+
+file_reader::~file_reader() = default;
+
+auto file_reader::read(vector<string> paths, callback done) -> void
+{
+  m_pending->fetch_add(paths.size(), relaxed);
+  auto shared = std::make_shared<callback>(move(done));
+  if (m_ring) {
+    m_ring->submit(move(paths), shared);
+    return;
+  }
+
+  for (auto& path : paths) {
+    m_fallback.post(
+        [pending = m_pending, shared, path = move(path)]
+        {
+          (*shared)(path, read_file(path));
+          pending->fetch_sub(1, relaxed);
+        });
+  }
+}
+
+auto read_file(const string& path) -> optional<vector<u8>>
+{
+  const trace_span span {"read file"};
+  const auto start = stats_now();
+#ifdef __linux__
+  const descriptor file {::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  const auto size =
+      file.fd >= 0 ? regular_file_size(file.fd) : optional<usize> {};
+  if (!size.has_value()) {
+    return nullopt;
+  }
+
+  vector<u8> contents(*size);
+  usize offset = 0;
+  while (offset < contents.size()) {
+    const auto count = ::pread(file.fd,
+                               contents.data() + offset,
+                               contents.size() - offset,
+                               static_cast<off_t>(offset));
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      return nullopt;
+    }
+    if (count == 0) {
+      // the file shrank since it was opened
+      contents.resize(offset);
+      break;
+    }
+    offset += static_cast<usize>(count);
+  }
+#else
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    return nullopt;
+  }
+
+  const auto size = fs::file_size(path, error);
+  std::ifstream stream {path, std::ios::binary};
+  if (error || !stream) {
+    return nullopt;
+  }
+
+  vector<u8> contents(static_cast<usize>(size));
+  stream.read(reinterpret_cast<char*>(contents.data()),
+              static_cast<std::streamsize>(contents.size()));
+  if (stream.bad()) {
+    return nullopt;
+  }
+  // the file shrank since its size was read
+  contents.resize(static_cast<usize>(stream.gcount()));
+#endif
+
+  count_read(contents.size(), start);
+  return contents;
+}
+
+auto read_file_header(const string& path, usize size) -> optional<vector<u8>>
+{
+  const trace_span span {"read file header"};
+  const auto start = stats_now();
+  vector<u8> header(size);
+#ifdef __linux__
+  // non-blocking so that a FIFO without writer is rejected, not waited on
+  const descriptor file {
+      ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK)};
+  if (file.fd < 0 || !regular_file_size(file.fd).has_value()) {
+    return nullopt;
+  }
+
+  auto count = ::pread(file.fd, header.data(), header.size(), 0);
+  while (count < 0 && errno == EINTR) {
+    count = ::pread(file.fd, header.data(), header.size(), 0);
+  }
+  if (count < 0) {
+    return nullopt;
+  }
+  header.resize(static_cast<usize>(count));
+#else
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    return nullopt;
+  }
+
+  std::ifstream stream {path, std::ios::binary};
+  if (!stream) {
+    return nullopt;
+  }
+
+  stream.read(reinterpret_cast<char*>(header.data()),
+              static_cast<std::streamsize>(header.size()));
+  if (stream.bad()) {
+    return nullopt;
+  }
+  header.resize(static_cast<usize>(stream.gcount()));
+#endif
+
+  count_read(header.size(), start);
+  return header;
+}
+}  // namespace imgv
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include "types.hpp"
+
+namespace imgv
+{
+class thread_pool;
+
+// reads whole files ahead of their decoding, so that decoding never waits for
+// the disk
+//
+// with io_uring (built with IMGV_IO_URING, on Linux 5.6 or later) the opens,
+// stats and reads of a batch are submitted together and completed on the
+// thread of the reader, which keeps the whole batch in flight at once,
+// otherwise every file is read by a worker of the fallback pool
+class file_reader
+{
+public:
+  // the contents of path, nullopt if it cannot be read
+  using callback =
+      std::function<void(const string& path, optional<vector<u8>> contents)>;
+
+  explicit file_reader(thread_pool& fallback);
+  ~file_reader();
+
+  file_reader(const file_reader&) = delete;
+  file_reader(file_reader&&) = delete;
+
+  auto operator=(const file_reader&) = delete;
+  auto operator=(file_reader&&) = delete;
+
+  // read every path, done is called once per path in completion order, from
+  // the thread of the reader or from a worker, so it must not block
+  //
+  // reads still pending when the reader is destroyed are dropped without
+  // calling done
+  auto read(vector<string> paths, callback done) -> void;
+
+  // no read is pending
+  auto idle() const -> bool
+  {
+    return m_pending->load(std::memory_order_relaxed) == 0;
+  }
+
+  auto uses_io_uring() const -> bool { return m_ring != nullptr; }
+
+private:
+  // defined in file_reader.cpp
+  class ring;
+
+  thread_pool& m_fallback;
+  // shared with the jobs of the fallback pool, which may outlive the reader
+  shared_ptr<std::atomic<usize>> m_pending;
+  // null when reading on the fallback pool
+  unique_ptr<ring> m_ring;
+};
+
+// read path on the calling thread, nullopt if it cannot be read
+auto read_file(const string& path) -> optional<vector<u8>>;
+// read the first size bytes of path (fewer if it is shorter) on the calling
+// thread, nullopt if it cannot be read
+auto read_file_header(const string& path, usize size)
+    -> optional<vector<u8>>;
+}  // namespace imgv
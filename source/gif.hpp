@@ -1,89 +1,328 @@
 #pragma once
 
-#include <cassert>
-
-#include <EasyGifReader.h>
+#include <algorithm>
+#include <chrono>
 
+#include "gif_decoder.hpp"
 #include "texture_load_common.hpp"
+#include "texture_stream.hpp"
+#include "trace.hpp"
 #include "types.hpp"
 
 namespace imgv
 {
+// the delays are cumulative, delay is in centiseconds
+inline auto push_gif_delay(frame_delays& delays, int delay) -> void
+{
+  auto last_delay =
+      delays.empty() ? std::chrono::nanoseconds {0} : delays.back();
+  delays.push_back(last_delay + std::chrono::milliseconds {10 * delay});
+}
+
+// composites animated GIFs as 8-bit palette indices, expanded to colors by
+// the fragment shader
+//
+// every frame is drawn with a single palette (one per distinct color map),
+// which rules out animations that draw over a canvas of another palette
+// without fully replacing it, those go through gif_rgba_composer instead
+class gif_index_compositor
+{
+public:
+  static constexpr usize palette_size = 256;
+
+  // nullopt if the frames of gif cannot be composited this way
+  static auto open(const gif_decoder& gif) -> optional<gif_index_compositor>
+  {
+    gif_index_compositor compositor;
+    if (!compositor.analyze(gif)) {
+      return nullopt;
+    }
+
+    return compositor;
+  }
+
+  auto upload(window* w,
+              const GladGLContext& gl,
+              const gif_decoder& gif,
+              frame_delays& delays) -> paged_texture
+  {
+    const auto& frames = gif.frames();
+    const auto canvas_width = static_cast<usize>(gif.width());
+    paged_texture_builder builder {w,
+                                   gl,
+                                   palette_index_format,
+                                   gif.width(),
+                                   gif.height(),
+                                   frames.size()};
+    vector<u8> canvas(canvas_width * static_cast<usize>(gif.height()),
+                      m_clear_index.front());
+    vector<u8> saved;
+    vector<GLint> frame_palettes;
+    frame_palettes.reserve(frames.size());
+
+    auto row = [&](const gif_frame& frame, int y)
+    {
+      return canvas.data() + static_cast<usize>(frame.top + y) * canvas_width
+          + static_cast<usize>(frame.left);
+    };
+
+    for (usize i = 0; i < frames.size(); ++i) {
+      const auto& frame = frames[i];
+      const auto palette = m_frame_palettes[i];
+      if (frame.disposal == gif_disposal::previous) {
+        saved = canvas;
+      }
+
+      {
+        const trace_span span {"compose frame"};
+        const auto width = static_cast<usize>(frame.width);
+        for (int y = 0; y < frame.height; ++y) {
+          blend_indices(row(frame, y),
+                        frame.indices.data() + static_cast<usize>(y) * width,
+                        width,
+                        frame.transparent);
+        }
+      }
+
+      builder.push_frame(canvas.data());
+      frame_palettes.push_back(static_cast<GLint>(palette));
+      push_gif_delay(delays, frame.delay);
+
+      if (frame.disposal == gif_disposal::background) {
+        for (int y = 0; y < frame.height; ++y) {
+          std::fill_n(row(frame, y), frame.width, m_clear_index[palette]);
+        }
+      } else if (frame.disposal == gif_disposal::previous) {
+        canvas.swap(saved);
+      }
+    }
+
+    auto texture = builder.finish();
+    texture.palettes = gl_texture::create(w);
+    texture.frame_palettes = move(frame_palettes);
+    gl.BindTexture(GL_TEXTURE_2D, *texture.palettes);
+    gl.TexImage2D(GL_TEXTURE_2D,
+                  0,
+                  GL_RGBA8,
+                  static_cast<GLsizei>(palette_size),
+                  static_cast<GLsizei>(m_palette_colors.size()
+                                       / (palette_size * 4)),
+                  0,
+                  GL_RGBA,
+                  GL_UNSIGNED_BYTE,
+                  m_palette_colors.data());
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    texture.byte_size += m_palette_colors.size();
+    return texture;
+  }
+
+private:
+  // per frame, into m_palettes
+  vector<usize> m_frame_palettes;
+  // the distinct palettes of the file, into gif_decoder::palettes()
+  vector<usize> m_palettes;
+  // palette_size RGBA colors per palette
+  vector<u8> m_palette_colors;
+  // per palette: index whose color is fully transparent
+  vector<u8> m_clear_index;
+
+  gif_index_compositor() = default;
+
+  auto find_palette(const gif_decoder& gif, usize palette) -> usize
+  {
+    const auto& palettes = gif.palettes();
+    auto it = std::find_if(m_palettes.begin(),
+                           m_palettes.end(),
+                           [&](usize other)
+                           { return palettes[other] == palettes[palette]; });
+    if (it == m_palettes.end()) {
+      it = m_palettes.insert(it, palette);
+    }
+
+    return static_cast<usize>(std::distance(m_palettes.begin(), it));
+  }
+
+  // check whether every composited frame can be expressed with the palette
+  // of that frame, and find the transparent index of every palette
+  auto analyze(const gif_decoder& gif) -> bool
+  {
+    const auto& frames = gif.frames();
+    if (frames.size() <= 1) {
+      return false;
+    }
+
+    vector<bool> needs_clear;
+    usize canvas_palette = 0;
+    for (usize i = 0; i < frames.size(); ++i) {
+      const auto& frame = frames[i];
+      const auto& colors = gif.palettes().at(frame.palette);
+      if (colors.size() > 3 * palette_size || frame.left < 0 || frame.top < 0
+          || frame.left + frame.width > gif.width()
+          || frame.top + frame.height > gif.height())
+      {
+        return false;
+      }
+
+      const auto palette = find_palette(gif, frame.palette);
+      needs_clear.resize(m_palettes.size(), false);
+
+      const auto replaces_canvas = frame.left == 0 && frame.top == 0
+          && frame.width == gif.width() && frame.height == gif.height()
+          && frame.transparent < 0;
+      if (i == 0) {
+        // the canvas starts (and may be restored to) fully transparent
+        canvas_palette = palette;
+        needs_clear.at(palette) =
+            !replaces_canvas || frame.disposal == gif_disposal::previous;
+      } else if (palette != canvas_palette && !replaces_canvas) {
+        return false;
+      }
+
+      if (frame.disposal == gif_disposal::background) {
+        needs_clear.at(palette) = true;
+      }
+      if (frame.disposal != gif_disposal::previous) {
+        canvas_palette = palette;
+      }
+
+      m_frame_palettes.push_back(palette);
+    }
+
+    for (usize p = 0; p < m_palettes.size(); ++p) {
+      const auto& colors = gif.palettes()[m_palettes[p]];
+      const auto color_count = colors.size() / 3;
+
+      // an unused index is transparent, otherwise a transparent index shared
+      // by every frame of the palette is never written to the canvas and can
+      // be reused
+      auto clear_index = static_cast<int>(color_count);
+      if (color_count == palette_size) {
+        const auto first =
+            std::find(m_frame_palettes.begin(), m_frame_palettes.end(), p);
+        const auto first_transparent =
+            frames[static_cast<usize>(first - m_frame_palettes.begin())]
+                .transparent;
+        auto shared = true;
+        for (usize i = 0; i < frames.size(); ++i) {
+          shared = shared
+              && (m_frame_palettes[i] != p
+                  || frames[i].transparent == first_transparent);
+        }
+        clear_index = shared ? first_transparent : -1;
+      }
+
+      if (clear_index < 0 && needs_clear[p]) {
+        return false;
+      }
+      m_clear_index.push_back(static_cast<u8>(std::max(clear_index, 0)));
+
+      for (usize c = 0; c < palette_size; ++c) {
+        const auto visible =
+            c < color_count && static_cast<int>(c) != clear_index;
+        const auto* color = c < color_count ? &colors[3 * c] : nullptr;
+        m_palette_colors.insert(
+            m_palette_colors.end(),
+            {color != nullptr ? color[0] : u8 {0},
+             color != nullptr ? color[1] : u8 {0},
+             color != nullptr ? color[2] : u8 {0},
+             static_cast<u8>(visible ? 255 : 0)});
+      }
+    }
+
+    return true;
+  }
+};
 
 struct gif_loader
 {
-  EasyGifReader reader;
-  image_metadata metadata;
-  vector<double> delays;
-
-  explicit gif_loader(const char* path)
-      : reader {EasyGifReader::openFile(path)}
-      , metadata {
-            reader.frameCount() != 1, reader.width(), reader.height(), path}
+  // every frame is LZW-decoded when the file is opened
+  gif_decoder gif;
+  // palette-indexed composition is preferred, gif_rgba_composer handles
+  // still images and the animations it cannot represent
+  optional<gif_index_compositor> indexed;
+  image_metadata metadata {};
+  frame_delays delays;
+  // the RGBA pixels of a still image
+  shared_ptr<vector<u8>> still;
+
+  // contents is the whole file at path, the frames are decoded with the help
+  // of workers if not null
+  gif_loader(const char* path, const vector<u8>& contents, thread_pool* workers)
+      : gif {contents}
   {
+    gif.decode(workers);
+    indexed = gif_index_compositor::open(gif);
+    metadata = {gif.frames().size() > 1,
+                gif.width(),
+                gif.height(),
+                path,
+                indexed.has_value()};
+    if (metadata.animated) {
+      return;
+    }
+
+    gif_rgba_composer composer {gif};
+    const auto* pixels = composer.next();
+    still = std::make_shared<vector<u8>>(
+        pixels,
+        pixels
+            + 4 * static_cast<usize>(gif.width())
+                * static_cast<usize>(gif.height()));
   }
 
-  auto operator()(window* w) -> gl_texture
+  auto operator()(window* w, texture_uploader& uploader) -> gl_texture
   {
     return w->use_gl(
         [&, this](const GladGLContext& gl)
         {
           auto texture = gl_texture::create(w);
-          const GLenum target =
-              metadata.animated ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
-          gl.BindTexture(target, *texture);
-          if (metadata.animated) {
-            GLsizei num_frame = 0;
-            gl.TexImage3D(target,
+          gl.BindTexture(GL_TEXTURE_2D, *texture);
+          const auto size = still->size();
+          uploader.upload(gl,
                           0,
+                          *texture,
                           GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-                          static_cast<GLsizei>(reader.width()),
-                          static_cast<GLsizei>(reader.height()),
-                          static_cast<GLsizei>(reader.frameCount()),
-                          0,
                           GL_RGBA,
-                          GL_UNSIGNED_BYTE,
-                          nullptr);
-
-            for (const auto& frame : reader) {
-              gl.TexSubImage3D(target,
-                               0,
-                               0,
-                               0,
-                               num_frame++,
-                               static_cast<GLsizei>(frame.width()),
-                               static_cast<GLsizei>(frame.height()),
-                               1,
-                               GL_RGBA,
-                               GL_UNSIGNED_BYTE,
-                               frame.pixels());
-              auto last_delay = delays.empty() ? 0.0 : delays.back();
-              delays.push_back(frame.duration().seconds() + last_delay);
-            }
-          } else {
-            auto frame_it = reader.begin();
-            assert(frame_it != reader.end());
-            gl.TexImage2D(target,
-                          0,
-                          GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-                          static_cast<GLsizei>(reader.width()),
-                          static_cast<GLsizei>(reader.height()),
-                          0,
-                          GL_RGBA,
-                          GL_UNSIGNED_BYTE,
-                          frame_it->pixels());
+                          {shared_ptr<const u8> {still, still->data()},
+                           gif.width(),
+                           gif.height(),
+                           4 * static_cast<usize>(gif.width()),
+                           4,
+                           {}});
+          still.reset();
+
+          if (!uploader.deferred()) {
+            dump_texture_compress_size(gl, size, GL_TEXTURE_2D);
           }
-          gen_mipmap_and_set_filters(gl, target);
-          dump_texture_compress_size(
-              gl,
-              sizeof(decltype(*std::declval<EasyGifReader::Frame>().pixels()))
-                  * static_cast<usize>(reader.width() * reader.height()
-                                       * reader.frameCount()),
-              target);
           return texture;
         });
   }
 
-  auto take_delays() -> vector<double> { return move(delays); }
+  auto load_animation(window* w) -> paged_texture
+  {
+    return w->use_gl(
+        [&, this](const GladGLContext& gl)
+        {
+          if (indexed) {
+            return indexed->upload(w, gl, gif, delays);
+          }
+
+          paged_texture_builder builder {w,
+                                         gl,
+                                         compressed_rgba_format,
+                                         gif.width(),
+                                         gif.height(),
+                                         gif.frames().size()};
+          gif_rgba_composer composer {gif};
+          for (const auto& frame : gif.frames()) {
+            builder.push_frame(composer.next());
+            push_gif_delay(delays, frame.delay);
+          }
+          return builder.finish();
+        });
+  }
+
+  auto take_delays() -> frame_delays { return move(delays); }
 };
 }  // namespace imgv
@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+
+#include "gif_decoder.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define IMGV_SSE2
+#endif
+
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+// LZW codes are at most 12 bits
+constexpr usize max_codes = 4096;
+constexpr u32 max_code_size = 12;
+
+constexpr u8 extension_introducer = 0x21;
+constexpr u8 image_separator = 0x2c;
+constexpr u8 trailer = 0x3b;
+constexpr u8 graphic_control_label = 0xf9;
+
+// first row and row step of the passes of an interlaced image
+constexpr array<tuple<int, int>, 4> interlace_passes {
+    tuple {0, 8}, tuple {4, 8}, tuple {2, 4}, tuple {1, 2}};
+
+struct byte_reader
+{
+  const vector<u8>& contents;
+  usize offset {0};
+
+  auto remaining() const -> usize { return contents.size() - offset; }
+
+  auto bytes(usize count) -> const u8*
+  {
+    if (remaining() < count) {
+      IMGV_ERROR("truncated GIF");
+    }
+
+    const auto* result = contents.data() + offset;
+    offset += count;
+    return result;
+  }
+
+  auto byte() -> u8 { return *bytes(1); }
+
+  auto word() -> int
+  {
+    const auto* p = bytes(2);
+    return p[0] | (p[1] << 8U);
+  }
+
+  // the sub-blocks up to their terminator, appended to out if not null,
+  // returns false if the file ends first
+  auto sub_blocks(vector<u8>* out) -> bool
+  {
+    while (remaining() > 0) {
+      const auto size = static_cast<usize>(byte());
+      if (size == 0) {
+        return true;
+      }
+
+      const auto available = std::min(size, remaining());
+      if (out != nullptr) {
+        out->insert(out->end(),
+                    contents.begin() + static_cast<std::ptrdiff_t>(offset),
+                    contents.begin()
+                        + static_cast<std::ptrdiff_t>(offset + available));
+      }
+      offset += available;
+    }
+
+    return false;
+  }
+};
+
+// a color table of 2^(size + 1) colors
+auto read_palette(byte_reader& reader, u8 size) -> vector<u8>
+{
+  const auto count = usize {3} << (size + 1U);
+  const auto* colors = reader.bytes(count);
+  return {colors, colors + count};
+}
+
+// pixels past the end of the codes are left as they are
+auto decode_lzw(const gif_frame& frame, u8* out, usize size) -> void
+{
+  const auto min_code_size = static_cast<u32>(frame.min_code_size);
+  if (min_code_size < 1 || min_code_size > 8) {
+    IMGV_ERROR(fmt::format("invalid LZW code size {}", min_code_size));
+  }
+
+  // every code is a string: the string of its prefix, then its suffix
+  array<std::uint16_t, max_codes> prefix {};
+  array<u8, max_codes> suffix {};
+  array<u8, max_codes> first {};
+  array<std::uint16_t, max_codes> length {};
+  const auto clear = 1U << min_code_size;
+  const auto end = clear + 1;
+  for (u32 code = 0; code < clear; ++code) {
+    suffix.at(code) = static_cast<u8>(code);
+    first.at(code) = static_cast<u8>(code);
+    length.at(code) = 1;
+  }
+
+  auto code_size = min_code_size + 1;
+  auto next = clear + 2;
+  auto previous = end;
+  u64 bits = 0;
+  u32 bit_count = 0;
+  usize input = 0;
+  usize written = 0;
+  const auto& codes = frame.codes;
+  while (written < size) {
+    while (bit_count < code_size) {
+      if (input == codes.size()) {
+        return;
+      }
+      bits |= static_cast<u64>(codes[input++]) << bit_count;
+      bit_count += 8;
+    }
+
+    const auto code = static_cast<u32>(bits & ((1U << code_size) - 1));
+    bits >>= code_size;
+    bit_count -= code_size;
+    if (code == clear) {
+      code_size = min_code_size + 1;
+      next = clear + 2;
+      previous = end;
+      continue;
+    }
+    if (code == end) {
+      return;
+    }
+
+    if (previous == end) {
+      if (code > clear) {
+        IMGV_ERROR(fmt::format("invalid LZW code {}", code));
+      }
+    } else if (next < max_codes) {
+      // a code not in the table yet is the previous string followed by its
+      // own first index
+      if (code > next) {
+        IMGV_ERROR(fmt::format("invalid LZW code {}", code));
+      }
+      prefix.at(next) = static_cast<std::uint16_t>(previous);
+      first.at(next) = first.at(previous);
+      suffix.at(next) = first.at(code == next ? previous : code);
+      length.at(next) = static_cast<std::uint16_t>(length.at(previous) + 1);
+      ++next;
+      if (next == (1U << code_size) && code_size < max_code_size) {
+        ++code_size;
+      }
+    } else if (code >= next) {
+      IMGV_ERROR(fmt::format("invalid LZW code {}", code));
+    }
+
+    // strings are written from their last index
+    const auto count = std::min<usize>(length.at(code), size - written);
+    auto c = code;
+    for (auto i = static_cast<usize>(length.at(code)); i > count; --i) {
+      c = prefix.at(c);
+    }
+    for (auto i = count; i > 0; --i) {
+      out[written + i - 1] = suffix.at(c);
+      c = prefix.at(c);
+    }
+    written += count;
+    previous = code;
+  }
+}
+
+auto decode_frame(gif_frame& frame) -> void
+{
+  const trace_span span {"gif lzw"};
+  const auto width = static_cast<usize>(frame.width);
+  const auto size = width * static_cast<usize>(frame.height);
+  frame.indices.assign(size, static_cast<u8>(std::max(frame.transparent, 0)));
+  if (!frame.interlaced) {
+    decode_lzw(frame, frame.indices.data(), size);
+    frame.codes = {};
+    return;
+  }
+
+  vector<u8> rows(frame.indices);
+  decode_lzw(frame, rows.data(), size);
+  frame.codes = {};
+  const auto* row = rows.data();
+  for (const auto& [start, step] : interlace_passes) {
+    for (auto y = start; y < frame.height; y += step) {
+      std::memcpy(frame.indices.data() + static_cast<usize>(y) * width,
+                  row,
+                  width);
+      row += width;
+    }
+  }
+}
+}  // namespace
+
+gif_decoder::gif_decoder(const vector<u8>& contents)
+{
+  const trace_span span {"gif parse"};
+  byte_reader reader {contents};
+  const auto* signature = reader.bytes(6);
+  if (std::memcmp(signature, "GIF87a", 6) != 0
+      && std::memcmp(signature, "GIF89a", 6) != 0)
+  {
+    IMGV_ERROR("not a GIF");
+  }
+
+  m_width = reader.word();
+  m_height = reader.word();
+  const auto flags = reader.byte();
+  reader.bytes(2);
+  // the global palette, if any, is the first one
+  optional<usize> global;
+  if ((flags & 0x80U) != 0) {
+    m_palettes.push_back(read_palette(reader, static_cast<u8>(flags & 7U)));
+    global = 0;
+  }
+
+  gif_frame control;
+  try {
+    while (reader.remaining() > 0) {
+      const auto introducer = reader.byte();
+      if (introducer == trailer) {
+        break;
+      }
+
+      if (introducer == extension_introducer) {
+        const auto label = reader.byte();
+        if (label != graphic_control_label) {
+          reader.sub_blocks(nullptr);
+          continue;
+        }
+
+        vector<u8> block;
+        reader.sub_blocks(&block);
+        if (block.size() >= 4) {
+          switch ((block[0] >> 2U) & 7U) {
+            case 2:
+              control.disposal = gif_disposal::background;
+              break;
+            case 3:
+              control.disposal = gif_disposal::previous;
+              break;
+            default:
+              control.disposal = gif_disposal::keep;
+          }
+          control.delay = block[1] | (block[2] << 8U);
+          control.transparent = (block[0] & 1U) != 0 ? block[3] : -1;
+        }
+        continue;
+      }
+
+      if (introducer != image_separator) {
+        IMGV_ERROR(fmt::format("unknown GIF block {:#x}", introducer));
+      }
+
+      // the control extension only applies to the image that follows it
+      auto frame = move(control);
+      control = {};
+      frame.left = reader.word();
+      frame.top = reader.word();
+      frame.width = reader.word();
+      frame.height = reader.word();
+      const auto image_flags = reader.byte();
+      frame.interlaced = (image_flags & 0x40U) != 0;
+      if ((image_flags & 0x80U) != 0) {
+        frame.palette = m_palettes.size();
+        m_palettes.push_back(
+            read_palette(reader, static_cast<u8>(image_flags & 7U)));
+      } else if (global.has_value()) {
+        frame.palette = *global;
+      } else {
+        IMGV_ERROR("GIF frame without a palette");
+      }
+
+      frame.min_code_size = reader.byte();
+      const auto complete = reader.sub_blocks(&frame.codes);
+      m_frames.push_back(move(frame));
+      if (!complete) {
+        break;
+      }
+    }
+  } catch (std::exception& ex) {
+    if (m_frames.empty()) {
+      throw;
+    }
+    fmt::print("warn: GIF truncated after {} frames\n", m_frames.size());
+    dump_exception(ex);
+  }
+
+  if (m_frames.empty()) {
+    IMGV_ERROR("GIF without frames");
+  }
+}
+
+auto gif_decoder::decode(thread_pool* workers) -> void
+{
+  const trace_span span {"gif decode"};
+  // frames are claimed one at a time, the helpers that start after every
+  // frame was claimed find nothing left and only touch this state
+  struct progress
+  {
+    vector<gif_frame>* frames;
+    usize count;
+    std::atomic<usize> next {0};
+    mutex lock;
+    std::condition_variable finished;
+    usize done {0};
+    std::exception_ptr error;
+
+    auto run() -> void
+    {
+      for (auto i = next++; i < count; i = next++) {
+        std::exception_ptr failure;
+        try {
+          decode_frame(frames->at(i));
+        } catch (...) {
+          failure = std::current_exception();
+        }
+
+        const scoped_lock locked {lock};
+        if (failure && !error) {
+          error = failure;
+        }
+        if (++done == count) {
+          finished.notify_all();
+        }
+      }
+    }
+  };
+
+  auto state = std::make_shared<progress>();
+  state->frames = &m_frames;
+  state->count = m_frames.size();
+  if (workers != nullptr) {
+    const auto helpers = std::min(workers->size(), m_frames.size() - 1);
+    for (usize i = 0; i < helpers; ++i) {
+      workers->post([state] { state->run(); });
+    }
+  }
+
+  state->run();
+  std::unique_lock locked {state->lock};
+  state->finished.wait(locked,
+                       [&] { return state->done == state->count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+auto blend_indices(u8* dst, const u8* src, usize count, int transparent)
+    -> void
+{
+  if (transparent < 0) {
+    std::memcpy(dst, src, count);
+    return;
+  }
+
+  usize x = 0;
+#ifdef IMGV_SSE2
+  const auto key = _mm_set1_epi8(static_cast<char>(transparent));
+  for (; x + 16 <= count; x += 16) {
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto pixels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    auto* out = reinterpret_cast<__m128i*>(dst + x);
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+    const auto keep = _mm_cmpeq_epi8(pixels, key);
+    _mm_storeu_si128(out,
+                     _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128(out)),
+                                  _mm_andnot_si128(keep, pixels)));
+  }
+#endif
+  for (; x < count; ++x) {
+    if (src[x] != transparent) {
+      dst[x] = src[x];
+    }
+  }
+}
+
+gif_rgba_composer::gif_rgba_composer(const gif_decoder& gif)
+    : m_gif {gif}
+    , m_canvas(static_cast<usize>(gif.width())
+                   * static_cast<usize>(gif.height()),
+               0)
+{
+}
+
+auto gif_rgba_composer::next() -> const u8*
+{
+  const trace_span span {"compose frame"};
+  const auto& frames = m_gif.frames();
+  if (m_next > 0) {
+    dispose(frames.at(m_next - 1));
+  }
+
+  const auto& frame = frames.at(m_next++);
+  if (frame.disposal == gif_disposal::previous) {
+    m_saved = m_canvas;
+  }
+
+  // opaque colors, and opaque black past the end of the palette
+  array<u32, 256> colors {};
+  const auto& palette = m_gif.palettes().at(frame.palette);
+  for (usize c = 0; c < colors.size(); ++c) {
+    array<u8, 4> rgba {0, 0, 0, 255};
+    if (3 * c < palette.size()) {
+      std::memcpy(rgba.data(), palette.data() + 3 * c, 3);
+    }
+    std::memcpy(&colors.at(c), rgba.data(), sizeof(u32));
+  }
+
+  const auto canvas_width = static_cast<usize>(m_gif.width());
+  const auto left = std::clamp(frame.left, 0, m_gif.width());
+  const auto right = std::clamp(frame.left + frame.width, 0, m_gif.width());
+  const auto top = std::clamp(frame.top, 0, m_gif.height());
+  const auto bottom = std::clamp(frame.top + frame.height, 0, m_gif.height());
+  const auto count = static_cast<usize>(right - left);
+  for (auto y = top; y < bottom; ++y) {
+    const auto* src = frame.indices.data()
+        + static_cast<usize>(y - frame.top) * static_cast<usize>(frame.width)
+        + static_cast<usize>(left - frame.left);
+    auto* dst = m_canvas.data() + static_cast<usize>(y) * canvas_width
+        + static_cast<usize>(left);
+    usize x = 0;
+#ifdef IMGV_SSE2
+    // 4 pixels at a time, the colors are looked up one by one but the
+    // transparent ones are masked out together
+    const auto key = _mm_set1_epi32(frame.transparent);
+    const auto zero = _mm_setzero_si128();
+    for (; x + 4 <= count; x += 4) {
+      i32 packed = 0;
+      std::memcpy(&packed, src + x, sizeof(packed));
+      const auto indices = _mm_unpacklo_epi16(
+          _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+      const auto keep = _mm_cmpeq_epi32(indices, key);
+      const auto pixels = _mm_set_epi32(static_cast<i32>(colors[src[x + 3]]),
+                                        static_cast<i32>(colors[src[x + 2]]),
+                                        static_cast<i32>(colors[src[x + 1]]),
+                                        static_cast<i32>(colors[src[x]]));
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      auto* out = reinterpret_cast<__m128i*>(dst + x);
+      _mm_storeu_si128(out,
+                       _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128(out)),
+                                    _mm_andnot_si128(keep, pixels)));
+    }
+#endif
+    for (; x < count; ++x) {
+      if (src[x] != frame.transparent) {
+        dst[x] = colors.at(src[x]);
+      }
+    }
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  return reinterpret_cast<const u8*>(m_canvas.data());
+}
+
+auto gif_rgba_composer::dispose(const gif_frame& frame) -> void
+{
+  if (frame.disposal == gif_disposal::previous) {
+    m_canvas.swap(m_saved);
+    return;
+  }
+  if (frame.disposal != gif_disposal::background) {
+    return;
+  }
+
+  const auto canvas_width = static_cast<usize>(m_gif.width());
+  const auto left = std::clamp(frame.left, 0, m_gif.width());
+  const auto right = std::clamp(frame.left + frame.width, 0, m_gif.width());
+  const auto top = std::clamp(frame.top, 0, m_gif.height());
+  const auto bottom = std::clamp(frame.top + frame.height, 0, m_gif.height());
+  for (auto y = top; y < bottom; ++y) {
+    auto* row = m_canvas.data() + static_cast<usize>(y) * canvas_width;
+    std::fill(row + left, row + right, 0U);
+  }
+}
+}  // namespace imgv
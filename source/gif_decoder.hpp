@@ -0,0 +1,93 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace imgv
+{
+class thread_pool;
+
+// what becomes of the area of a frame once it was shown
+enum class gif_disposal : u8
+{
+  keep,
+  // cleared to transparent
+  background,
+  // restored to what it was before the frame
+  previous,
+};
+
+// one image of a GIF, with its graphic control extension
+struct gif_frame
+{
+  int left {0}, top {0}, width {0}, height {0};
+  gif_disposal disposal {gif_disposal::keep};
+  // index whose pixels leave the canvas unchanged, -1 if none
+  int transparent {-1};
+  // in centiseconds
+  int delay {0};
+  // into gif_decoder::palettes()
+  usize palette {0};
+  // width x height palette indices, from the top row, once decoded
+  vector<u8> indices;
+
+  bool interlaced {false};
+  u8 min_code_size {0};
+  // the LZW codes of the data sub-blocks, without their size bytes
+  vector<u8> codes;
+};
+
+// a GIF parsed from memory
+//
+// the LZW streams of the frames do not depend on each other, only their
+// composition does, so decode() spreads the frames over the workers while
+// the composition is left to the callers, in order
+class gif_decoder
+{
+public:
+  // contents is only read here, IMGV_ERROR if it is not a GIF or has no
+  // frame, a file truncated after its first frame keeps the frames it has
+  explicit gif_decoder(const vector<u8>& contents);
+
+  // LZW-decode every frame, with the help of workers if not null
+  //
+  // the calling thread decodes frames too and only waits for the frames
+  // workers have started, so it may be a worker of the same pool
+  auto decode(thread_pool* workers) -> void;
+
+  auto width() const -> int { return m_width; }
+  auto height() const -> int { return m_height; }
+  auto frames() const -> const vector<gif_frame>& { return m_frames; }
+  // RGB triplets, up to 256 colors per palette
+  auto palettes() const -> const vector<vector<u8>>& { return m_palettes; }
+
+private:
+  int m_width {0}, m_height {0};
+  vector<gif_frame> m_frames;
+  vector<vector<u8>> m_palettes;
+};
+
+// copy the count indices of src over dst, except those equal to transparent
+// (-1 if none), 16 at a time with SSE2
+auto blend_indices(u8* dst, const u8* src, usize count, int transparent)
+    -> void;
+
+// the frames of a decoded GIF drawn one after the other on an RGBA canvas
+class gif_rgba_composer
+{
+public:
+  explicit gif_rgba_composer(const gif_decoder& gif);
+
+  // the canvas with the next frame drawn, tightly packed RGBA pixels valid
+  // until the following call
+  auto next() -> const u8*;
+
+private:
+  const gif_decoder& m_gif;
+  usize m_next {0};
+  vector<u32> m_canvas;
+  // before the last frame, if it is disposed to previous
+  vector<u32> m_saved;
+
+  auto dispose(const gif_frame& frame) -> void;
+};
+}  // namespace imgv
@@ -65,6 +65,12 @@ public:
 
   auto get() const -> handle_t { return m_handle; }
 
+  auto owner() const -> window* { return m_owner; }
+  // objects shared with the other contexts of the share group can be deleted
+  // by any window of the group, this hands the object over to one that
+  // outlives its current owner
+  auto set_owner(window* owner) -> void { m_owner = owner; }
+
   auto operator*() const -> handle_t { return get(); }
 
   template<typename... Args>
@@ -135,10 +141,53 @@ struct shader_trait : gl_common_trait
   { return w.use_gl([=](const auto& gl) { return gl.CreateShader(type); }); };
 };
 
+struct buffer_trait : gl_common_trait
+{
+  static auto type_name() -> const char* { return "buffer"; }
+  static constexpr auto destroy = [](const window& w, handle_t buffer)
+  { w.use_gl([&](const auto& gl) { gl.DeleteBuffers(1, &buffer); }); };
+  static constexpr auto create = [](const window& w)
+  { return w.use_gl([](const auto& gl) { IMGV_GLGEN(gl.GenBuffers, 1); }); };
+};
+
+struct framebuffer_trait : gl_common_trait
+{
+  static auto type_name() -> const char* { return "framebuffer"; }
+  static constexpr auto destroy = [](const window& w, handle_t fbo)
+  { w.use_gl([&](const auto& gl) { gl.DeleteFramebuffers(1, &fbo); }); };
+  static constexpr auto create = [](const window& w) {
+    return w.use_gl([](const auto& gl) { IMGV_GLGEN(gl.GenFramebuffers, 1); });
+  };
+};
+
+struct renderbuffer_trait : gl_common_trait
+{
+  static auto type_name() -> const char* { return "renderbuffer"; }
+  static constexpr auto destroy = [](const window& w, handle_t rbo)
+  { w.use_gl([&](const auto& gl) { gl.DeleteRenderbuffers(1, &rbo); }); };
+  static constexpr auto create = [](const window& w) {
+    return w.use_gl([](const auto& gl)
+                    { IMGV_GLGEN(gl.GenRenderbuffers, 1); });
+  };
+};
+
+struct query_trait : gl_common_trait
+{
+  static auto type_name() -> const char* { return "query"; }
+  static constexpr auto destroy = [](const window& w, handle_t query)
+  { w.use_gl([&](const auto& gl) { gl.DeleteQueries(1, &query); }); };
+  static constexpr auto create = [](const window& w)
+  { return w.use_gl([](const auto& gl) { IMGV_GLGEN(gl.GenQueries, 1); }); };
+};
+
 using gl_vertex_array = gl_object<vertex_array_trait>;
 using gl_texture = gl_object<texture_trait>;
 using gl_program = gl_object<program_trait>;
 using gl_shader = gl_object<shader_trait>;
+using gl_buffer = gl_object<buffer_trait>;
+using gl_framebuffer = gl_object<framebuffer_trait>;
+using gl_renderbuffer = gl_object<renderbuffer_trait>;
+using gl_query = gl_object<query_trait>;
 
 inline auto create_shader(window* owner, GLenum type, const GLchar* source)
     -> gl_shader
@@ -0,0 +1,661 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#include "grid_window.hpp"
+
+#include <fmt/core.h>
+
+#include "context.hpp"
+
+namespace imgv
+{
+namespace
+{
+// gap between two cells, in screen coordinates
+constexpr int cell_padding = 8;
+constexpr int cell_pitch = thumbnail_size + cell_padding;
+constexpr GLsizei atlas_size = 2048;
+constexpr usize cells_per_row = atlas_size / thumbnail_size;
+constexpr usize cells_per_layer = cells_per_row * cells_per_row;
+// 4 layers of 16 MiB, 1024 thumbnails
+constexpr GLsizei atlas_layers = 4;
+constexpr usize atlas_cells = cells_per_layer * atlas_layers;
+// the window starts with this many cells
+constexpr int initial_columns = 6, initial_rows = 4;
+constexpr double double_click_time = 0.4;
+
+// key presses moving the selection
+auto selection_offset(int key, usize columns, usize page) -> optional<i64>
+{
+  switch (key) {
+    case GLFW_KEY_LEFT:
+      return -1;
+    case GLFW_KEY_RIGHT:
+      return 1;
+    case GLFW_KEY_UP:
+      return -static_cast<i64>(columns);
+    case GLFW_KEY_DOWN:
+      return static_cast<i64>(columns);
+    case GLFW_KEY_PAGE_UP:
+      return -static_cast<i64>(page);
+    case GLFW_KEY_PAGE_DOWN:
+      return static_cast<i64>(page);
+    default:
+      return nullopt;
+  }
+}
+}  // namespace
+
+// one instance per visible entry, positioned from the entry index so that
+// scrolling only changes uniforms
+const GLchar* const grid_vertex_shader = R"(
+  #version 430 core
+
+  layout(location = 0) uniform vec2 viewport;
+  layout(location = 1) uniform int first;
+  layout(location = 2) uniform int columns;
+  layout(location = 3) uniform float scroll;
+  layout(location = 4) uniform int selected;
+
+  // cell_pitch
+  const float pitch = 136.0;
+  const vec2 vertices[4] = vec2[](
+    vec2(0,0), vec2(1,0), vec2(0,1), vec2(1,1)
+  );
+
+  layout(std430, binding = 0) readonly buffer entries {
+    ivec4 entry_data[];
+  };
+
+  layout(location = 0) out vec2 cell_pos;
+  layout(location = 1) flat out ivec4 entry;
+  layout(location = 2) flat out int is_selected;
+
+  void main() {
+    int index = first + gl_InstanceID;
+    float margin = (viewport.x - float(columns) * pitch) * 0.5;
+    vec2 origin = vec2(margin + float(index % columns) * pitch,
+                       float(index / columns) * pitch - scroll);
+    cell_pos = vertices[gl_VertexID] * pitch;
+    vec2 pos = (origin + cell_pos) / viewport;
+    gl_Position = vec4(pos.x * 2.0 - 1.0, 1.0 - pos.y * 2.0, 0.0, 1.0);
+    entry = entry_data[index];
+    is_selected = int(index == selected);
+  }
+)";
+
+const GLchar* const grid_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 cell_pos;
+  layout(location = 1) flat in ivec4 entry;
+  layout(location = 2) flat in int is_selected;
+  layout(location = 0) out vec4 color;
+
+  layout(binding = 0) uniform sampler2DArray atlas;
+
+  const float padding = 8.0;
+  const float size = 128.0;
+  const int cells_per_row = 16;
+  const int cells_per_layer = 256;
+  const int ready = 2, failed = 3;
+
+  void main() {
+    vec2 extent = entry.w == ready ? vec2(entry.yz) : vec2(size);
+    vec2 pos = cell_pos - padding * 0.5 - (size - extent) * 0.5;
+    bool inside = all(greaterThanEqual(pos, vec2(0)))
+               && all(lessThan(pos, extent));
+    if (inside && entry.w == ready) {
+      int cell = entry.x % cells_per_layer;
+      vec2 texel = vec2(cell % cells_per_row, cell / cells_per_row) * size
+                 + pos;
+      color = texture(atlas, vec3(texel / (size * float(cells_per_row)),
+                                  float(entry.x / cells_per_layer)));
+    } else if (is_selected != 0) {
+      color = vec4(0.25, 0.45, 0.85, 1.0);
+    } else if (inside) {
+      color = entry.w == failed ? vec4(0.15, 0.05, 0.05, 1.0)
+                                : vec4(0.2, 0.2, 0.2, 1.0);
+    } else {
+      discard;
+    }
+  }
+)";
+
+grid_window::grid_window(context* c, const string& directory)
+    : window {c}
+    , m_vao {gl_vertex_array::create(this)}
+    , m_program {create_program(this, grid_vertex_shader, grid_fragment_shader)}
+    , m_entry_buffer {gl_buffer::create(this)}
+    , m_cell_owners(atlas_cells, npos)
+{
+  m_index = c->directories().get(directory, c->workers());
+  sync_entries();
+
+  show_window(initial_columns * cell_pitch,
+              initial_rows * cell_pitch,
+              directory.c_str());
+  glfwSetWindowAspectRatio(
+      m_window_handle.get(), GLFW_DONT_CARE, GLFW_DONT_CARE);
+  create_atlas();
+  schedule_loads();
+  report_memory();
+}
+
+auto grid_window::handle_event(event& e) -> void
+{
+  if (std::holds_alternative<prefetch_event>(e)) {
+    upload_results();
+    schedule_loads();
+    report_memory();
+  } else if (auto* changed = std::get_if<directory_changed_event>(&e);
+             changed != nullptr && changed->directory == m_index->directory())
+  {
+    sync_entries();
+    schedule_loads();
+    invalidate();
+  }
+}
+
+auto grid_window::render() -> double
+{
+  auto wait_time = window::render();
+  if (!m_redraw) {
+    return wait_time;
+  }
+
+  m_redraw = false;
+  if (*m_atlas == 0) {
+    create_atlas();
+    schedule_loads();
+    report_memory();
+  }
+
+  int width = 0, height = 0, fb_width = 0, fb_height = 0;
+  glfwGetWindowSize(m_window_handle.get(), &width, &height);
+  glfwGetFramebufferSize(m_window_handle.get(), &fb_width, &fb_height);
+  const auto [first, last] = visible_range();
+
+  make_context_current();
+  begin_render_timing();
+  m_gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer());
+  m_gl.Viewport(0, 0, fb_width, fb_height);
+  m_gl.ClearColor(0.1F, 0.1F, 0.1F, 1.0F);
+  m_gl.Clear(GL_COLOR_BUFFER_BIT);
+  if (first < last) {
+    m_gl.UseProgram(*m_program);
+    m_gl.BindVertexArray(*m_vao);
+    m_gl.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_entry_buffer);
+    m_gl.ActiveTexture(GL_TEXTURE0);
+    m_gl.BindTexture(GL_TEXTURE_2D_ARRAY, *m_atlas);
+    m_gl.Uniform2f(
+        0, static_cast<GLfloat>(width), static_cast<GLfloat>(height));
+    m_gl.Uniform1i(1, static_cast<GLint>(first));
+    m_gl.Uniform1i(2, static_cast<GLint>(columns()));
+    m_gl.Uniform1f(3, static_cast<GLfloat>(m_scroll));
+    m_gl.Uniform1i(4, static_cast<GLint>(m_selected));
+    m_gl.DrawArraysInstanced(
+        GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(last - first));
+  }
+
+  end_render_timing();
+  swap_buffers();
+  return wait_time;
+}
+
+auto grid_window::release_memory(memory_kind kind) -> void
+{
+  if (kind != memory_kind::image || *m_atlas == 0) {
+    return;
+  }
+
+  // the thumbnails are read back from the thumbnail cache when the window is
+  // drawn again
+  m_atlas.reset();
+  std::fill(m_cell_owners.begin(), m_cell_owners.end(), npos);
+  for (usize i = 0; i < m_entries.size(); ++i) {
+    if (m_entries[i].state == entry_state::ready) {
+      m_entries[i].state = entry_state::idle;
+      m_entries[i].cell = -1;
+      update_entry(i);
+    }
+  }
+
+  report_memory();
+}
+
+auto grid_window::on_key(int key, int mods) -> bool
+{
+  if (mods != 0 || m_entries.empty()) {
+    return false;
+  }
+
+  int height = 0;
+  glfwGetWindowSize(m_window_handle.get(), nullptr, &height);
+  const auto page =
+      columns() * static_cast<usize>(std::max(1, height / cell_pitch));
+  if (auto offset = selection_offset(key, columns(), page)) {
+    const auto target = std::clamp<i64>(static_cast<i64>(m_selected) + *offset,
+                                        0,
+                                        static_cast<i64>(m_entries.size()) - 1);
+    select(static_cast<usize>(target));
+    return true;
+  }
+
+  switch (key) {
+    case GLFW_KEY_HOME:
+      select(0);
+      return true;
+    case GLFW_KEY_END:
+      select(m_entries.size() - 1);
+      return true;
+    case GLFW_KEY_ENTER:
+    case GLFW_KEY_KP_ENTER:
+      open_selected();
+      return true;
+    default:
+      return false;
+  }
+}
+
+auto grid_window::on_mouse_button(int button, int action, int /*mods*/)
+    -> bool
+{
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+    return false;
+  }
+
+  double x = 0, y = 0;
+  glfwGetCursorPos(m_window_handle.get(), &x, &y);
+  const auto index = entry_at(x, y);
+  if (index == npos) {
+    // the gaps between the cells move the window
+    return false;
+  }
+
+  const auto now = glfwGetTime();
+  const auto double_click = index == m_last_click_entry
+      && now - m_last_click_time < double_click_time;
+  m_last_click_entry = double_click ? npos : index;
+  m_last_click_time = now;
+  select(index);
+  if (double_click) {
+    open_selected();
+  }
+  return true;
+}
+
+auto grid_window::on_scroll(double /*dx*/, double dy) -> bool
+{
+  // with control held, the window is resized
+  if (glfwGetKey(m_window_handle.get(), GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS
+      || glfwGetKey(m_window_handle.get(), GLFW_KEY_RIGHT_CONTROL)
+          == GLFW_PRESS)
+  {
+    return false;
+  }
+
+  scroll_to(m_scroll - dy * cell_pitch / 2);
+  return true;
+}
+
+auto grid_window::columns() const -> usize
+{
+  int width = 0;
+  glfwGetWindowSize(m_window_handle.get(), &width, nullptr);
+  return static_cast<usize>(std::max(1, width / cell_pitch));
+}
+
+auto grid_window::visible_range() const -> tuple<usize, usize>
+{
+  int height = 0;
+  glfwGetWindowSize(m_window_handle.get(), nullptr, &height);
+  const auto first_row = static_cast<usize>(std::max(0.0, m_scroll))
+      / static_cast<usize>(cell_pitch);
+  const auto last_row =
+      static_cast<usize>(std::max(0.0, m_scroll + height) / cell_pitch) + 1;
+  return {std::min(first_row * columns(), m_entries.size()),
+          std::min(last_row * columns(), m_entries.size())};
+}
+
+auto grid_window::entry_at(double x, double y) const -> usize
+{
+  int width = 0;
+  glfwGetWindowSize(m_window_handle.get(), &width, nullptr);
+  const auto cols = columns();
+  const auto margin = (width - static_cast<double>(cols) * cell_pitch) / 2;
+  const auto col = std::floor((x - margin) / cell_pitch);
+  const auto row = std::floor((y + m_scroll) / cell_pitch);
+  if (col < 0 || row < 0 || col >= static_cast<double>(cols)) {
+    return npos;
+  }
+
+  const auto index =
+      static_cast<usize>(row) * cols + static_cast<usize>(col);
+  return index < m_entries.size() ? index : npos;
+}
+
+auto grid_window::scroll_to(double scroll) -> void
+{
+  int height = 0;
+  glfwGetWindowSize(m_window_handle.get(), nullptr, &height);
+  const auto cols = columns();
+  const auto rows = (m_entries.size() + cols - 1) / cols;
+  const auto max_scroll =
+      std::max(0.0, static_cast<double>(rows * cell_pitch) - height);
+  scroll = std::clamp(scroll, 0.0, max_scroll);
+  // a change below a thousandth of a pixel would redraw the same frame
+  if (std::fabs(scroll - m_scroll) >= 1e-3) {
+    m_scroll = scroll;
+    schedule_loads();
+    invalidate();
+  }
+}
+
+auto grid_window::select(usize index) -> void
+{
+  m_selected = index;
+  int height = 0;
+  glfwGetWindowSize(m_window_handle.get(), nullptr, &height);
+  const auto top = static_cast<double>(index / columns() * cell_pitch);
+  if (top < m_scroll) {
+    scroll_to(top);
+  } else if (top + cell_pitch > m_scroll + height) {
+    scroll_to(top + cell_pitch - height);
+  }
+  invalidate();
+}
+
+auto grid_window::open_selected() -> void
+{
+  if (m_selected < m_entries.size()) {
+    push_event(media_open_event {{m_entries[m_selected].path}});
+  }
+}
+
+auto grid_window::sync_entries() -> void
+{
+  const auto selected =
+      m_selected < m_entries.size() ? m_entries[m_selected].path : string {};
+  std::unordered_map<string, entry> previous;
+  for (auto& item : m_entries) {
+    auto path = item.path;
+    previous.emplace(move(path), move(item));
+  }
+
+  m_entries.clear();
+  m_entries.reserve(m_index->size());
+  std::fill(m_cell_owners.begin(), m_cell_owners.end(), npos);
+  for (usize i = 0; i < m_index->size(); ++i) {
+    auto path = m_index->path(i);
+    // non-images are known to fail before any thumbnail job
+    const auto image = m_index->kind(i) != file_kind::other;
+    auto it = previous.find(path);
+    if (it == previous.end()) {
+      m_entries.push_back(
+          entry {move(path), image ? entry_state::idle : entry_state::failed});
+      continue;
+    }
+
+    auto& item = m_entries.emplace_back(move(it->second));
+    if (item.state == entry_state::failed && image) {
+      // sniffed again once written
+      item.state = entry_state::idle;
+    }
+    if (item.cell >= 0) {
+      m_cell_owners[static_cast<usize>(item.cell)] = i;
+    }
+  }
+
+  m_selected = find_entry(m_selected, selected);
+  if (m_selected == npos) {
+    m_selected = 0;
+  }
+  m_last_click_entry = npos;
+  upload_entries();
+}
+
+auto grid_window::find_entry(usize index, const string& path) const -> usize
+{
+  if (index < m_entries.size() && m_entries[index].path == path) {
+    return index;
+  }
+
+  const auto position = m_index->find(fs::path {path}.filename().string());
+  return position.value_or(npos);
+}
+
+auto grid_window::create_atlas() -> void
+{
+  m_atlas = gl_texture::create(this);
+  use_gl(
+      [&](const GladGLContext& gl)
+      {
+        gl.BindTexture(GL_TEXTURE_2D_ARRAY, *m_atlas);
+        gl.TexStorage3D(GL_TEXTURE_2D_ARRAY,
+                        1,
+                        GL_RGBA8,
+                        atlas_size,
+                        atlas_size,
+                        atlas_layers);
+        gl.TexParameteri(
+            GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        gl.TexParameteri(
+            GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      });
+}
+
+auto grid_window::schedule_loads() -> void
+{
+  if (m_entries.empty()) {
+    return;
+  }
+
+  const auto max_in_flight = 2 * m_context->workers().size();
+  const auto [first, last] = visible_range();
+  // the visible entries in order, then alternately one row below and one
+  // row above, until the atlas would be full
+  const auto visible = last - first;
+  const auto lookahead = atlas_cells > visible ? atlas_cells - visible : 0;
+  for (usize i = 0; i < visible + lookahead && m_in_flight < max_in_flight;
+       ++i)
+  {
+    usize index = 0;
+    if (i < visible) {
+      index = first + i;
+    } else {
+      const auto distance = (i - visible) / 2 + 1;
+      if ((i - visible) % 2 == 0) {
+        index = last - 1 + distance;
+      } else if (distance <= first) {
+        index = first - distance;
+      } else {
+        continue;
+      }
+    }
+
+    if (index >= m_entries.size()
+        || m_entries[index].state != entry_state::idle)
+    {
+      continue;
+    }
+
+    m_entries[index].state = entry_state::loading;
+    ++m_in_flight;
+    m_context->workers().post(
+        [c = m_context,
+         owner = id(),
+         done = m_results,
+         index,
+         path = m_entries[index].path]
+        {
+          optional<thumbnail> thumb;
+          try {
+            thumb = load_thumbnail(path);
+          } catch (std::exception& ex) {
+            dump_exception(ex);
+          }
+
+          {
+            scoped_lock lock {done->guard};
+            done->items.push_back({index, path, move(thumb)});
+          }
+          c->push_event(prefetch_event {{owner}});
+        });
+  }
+}
+
+auto grid_window::upload_results() -> void
+{
+  vector<job_results::result> done;
+  {
+    scoped_lock lock {m_results->guard};
+    done.swap(m_results->items);
+  }
+
+  for (auto& [job_index, path, thumb] : done) {
+    --m_in_flight;
+    const auto index = find_entry(job_index, path);
+    if (index == npos) {
+      continue;
+    }
+
+    auto& item = m_entries[index];
+    if (!thumb.has_value()) {
+      item.state = entry_state::failed;
+      update_entry(index);
+      continue;
+    }
+
+    const auto cell = *m_atlas != 0 ? allocate_cell(index) : npos;
+    if (cell == npos) {
+      // scrolled away while loading, loaded again when it comes back
+      item.state = entry_state::idle;
+      continue;
+    }
+
+    use_gl(
+        [&](const GladGLContext& gl)
+        {
+          gl.BindTexture(GL_TEXTURE_2D_ARRAY, *m_atlas);
+          gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+          gl.TexSubImage3D(GL_TEXTURE_2D_ARRAY,
+                           0,
+                           static_cast<GLint>(cell % cells_per_row)
+                               * thumbnail_size,
+                           static_cast<GLint>(cell % cells_per_layer
+                                              / cells_per_row)
+                               * thumbnail_size,
+                           static_cast<GLint>(cell / cells_per_layer),
+                           thumb->width,
+                           thumb->height,
+                           1,
+                           GL_RGBA,
+                           GL_UNSIGNED_BYTE,
+                           thumb->pixels.data());
+          gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        });
+
+    m_cell_owners[cell] = index;
+    item.state = entry_state::ready;
+    item.cell = static_cast<i32>(cell);
+    item.width = thumb->width;
+    item.height = thumb->height;
+    update_entry(index);
+  }
+
+  if (!done.empty()) {
+    m_redraw = true;
+  }
+}
+
+auto grid_window::allocate_cell(usize index) -> usize
+{
+  const auto [first, last] = visible_range();
+  const auto distance = [first = first, last = last](usize i) -> usize
+  { return i < first ? first - i : (i >= last ? i - last + 1 : 0); };
+
+  usize farthest = npos;
+  for (usize cell = 0; cell < m_cell_owners.size(); ++cell) {
+    const auto owner = m_cell_owners[cell];
+    if (owner == npos) {
+      return cell;
+    }
+
+    if (farthest == npos
+        || distance(owner) > distance(m_cell_owners[farthest]))
+    {
+      farthest = cell;
+    }
+  }
+
+  const auto evicted = m_cell_owners[farthest];
+  if (distance(evicted) <= distance(index)) {
+    return npos;
+  }
+
+  m_entries[evicted].state = entry_state::idle;
+  m_entries[evicted].cell = -1;
+  update_entry(evicted);
+  m_cell_owners[farthest] = npos;
+  return farthest;
+}
+
+auto grid_window::update_entry(usize index) -> void
+{
+  const auto& item = m_entries[index];
+  const array<i32, 4> data {
+      item.cell, item.width, item.height, static_cast<i32>(item.state)};
+  use_gl(
+      [&](const GladGLContext& gl)
+      {
+        gl.BindBuffer(GL_SHADER_STORAGE_BUFFER, *m_entry_buffer);
+        gl.BufferSubData(GL_SHADER_STORAGE_BUFFER,
+                         static_cast<GLintptr>(index * sizeof(data)),
+                         sizeof(data),
+                         data.data());
+      });
+}
+
+auto grid_window::upload_entries() -> void
+{
+  vector<array<i32, 4>> data(std::max<usize>(m_entries.size(), 1),
+                             {-1, 0, 0, 0});
+  for (usize i = 0; i < m_entries.size(); ++i) {
+    const auto& item = m_entries[i];
+    data[i] = {
+        item.cell, item.width, item.height, static_cast<i32>(item.state)};
+  }
+
+  use_gl(
+      [&](const GladGLContext& gl)
+      {
+        gl.BindBuffer(GL_SHADER_STORAGE_BUFFER, *m_entry_buffer);
+        gl.BufferData(GL_SHADER_STORAGE_BUFFER,
+                      static_cast<GLsizeiptr>(data.size() * sizeof(data[0])),
+                      data.data(),
+                      GL_DYNAMIC_DRAW);
+      });
+}
+
+auto grid_window::stats() -> window_stats
+{
+  window_stats result;
+  result.texture_bytes = atlas_bytes();
+  return result;
+}
+
+auto grid_window::atlas_bytes() const -> usize
+{
+  return *m_atlas != 0
+      ? static_cast<usize>(atlas_size) * atlas_size * atlas_layers * 4
+      : 0;
+}
+
+auto grid_window::report_memory() -> void
+{
+  m_context->budget().report(id(), {atlas_bytes(), 0, false});
+}
+
+}  // namespace imgv
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "directory_index.hpp"
+#include "gl_wrapper.hpp"
+#include "thumbnail.hpp"
+#include "window.hpp"
+
+namespace imgv
+{
+
+extern const GLchar* const grid_vertex_shader;
+extern const GLchar* const grid_fragment_shader;
+
+// thumbnails of every file in a directory, laid out in a scrollable grid and
+// kept in sync with the shared index of the directory
+//
+// thumbnails are generated (or read from the thumbnail cache) by the workers,
+// starting with the visible ones and moving outward, and packed into the
+// cells of a texture array atlas, the whole grid is a single instanced draw
+class grid_window : public window
+{
+public:
+  grid_window(context* c, const string& directory);
+  ~grid_window() override = default;
+
+  grid_window(const grid_window&) = delete;
+  grid_window(grid_window&&) = delete;
+
+  auto operator=(const grid_window&) = delete;
+  auto operator=(grid_window&&) = delete;
+
+  auto handle_event(event& e) -> void override;
+  auto render() -> double override;
+  auto release_memory(memory_kind kind) -> void override;
+  auto stats() -> window_stats override;
+
+protected:
+  auto on_key(int key, int mods) -> bool override;
+  auto on_mouse_button(int button, int action, int mods) -> bool override;
+  auto on_scroll(double dx, double dy) -> bool override;
+
+private:
+  // values shared with the shaders
+  enum class entry_state : i32
+  {
+    idle,
+    loading,
+    ready,
+    failed,
+  };
+
+  struct entry
+  {
+    string path;
+    entry_state state {entry_state::idle};
+    // atlas cell of a ready entry
+    i32 cell {-1};
+    i32 width {0}, height {0};
+  };
+
+  // thumbnails finished by the workers, waiting to be uploaded
+  struct job_results
+  {
+    struct result
+    {
+      // the entry may have moved since, if files were added or removed
+      usize index;
+      string path;
+      optional<thumbnail> thumb;
+    };
+
+    mutex guard;
+    vector<result> items;
+  };
+
+  static constexpr usize npos = static_cast<usize>(-1);
+
+  shared_ptr<const directory_index> m_index;
+  // one per file of m_index, in the same order
+  vector<entry> m_entries;
+  // shared with the jobs, which may outlive the window
+  shared_ptr<job_results> m_results {std::make_shared<job_results>()};
+  usize m_in_flight {0};
+
+  gl_vertex_array m_vao;
+  gl_program m_program;
+  // texture array of thumbnail cells, deleted to meet the memory budget and
+  // created again when the window is drawn
+  gl_texture m_atlas;
+  // ivec4(cell, width, height, state) per entry
+  gl_buffer m_entry_buffer;
+  // entry index of every atlas cell, or npos if it is free
+  vector<usize> m_cell_owners;
+
+  double m_scroll {0};
+  usize m_selected {0};
+  double m_last_click_time {0};
+  usize m_last_click_entry {npos};
+
+  auto columns() const -> usize;
+  // first and one past the last visible entries
+  auto visible_range() const -> tuple<usize, usize>;
+  auto entry_at(double x, double y) const -> usize;
+  auto scroll_to(double scroll) -> void;
+  auto select(usize index) -> void;
+  auto open_selected() -> void;
+
+  // rebuild the entries from the index, keeping the thumbnails of the files
+  // still listed
+  auto sync_entries() -> void;
+  // position of the entry of path, npos if it is gone
+  auto find_entry(usize index, const string& path) const -> usize;
+  auto create_atlas() -> void;
+  // queue thumbnail jobs from the viewport outward
+  auto schedule_loads() -> void;
+  auto upload_results() -> void;
+  // a free cell, evicting the thumbnail farthest from the viewport if it is
+  // farther than index, npos if there is none
+  auto allocate_cell(usize index) -> usize;
+  auto update_entry(usize index) -> void;
+  auto upload_entries() -> void;
+  auto atlas_bytes() const -> usize;
+  auto report_memory() -> void;
+};
+}  // namespace imgv
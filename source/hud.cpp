@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+
+#include "hud.hpp"
+
+#include <fmt/core.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace chr = std::chrono;
+
+namespace
+{
+constexpr unsigned font_size = 14;
+constexpr int atlas_width = 256;
+constexpr char first_glyph = ' ', last_glyph = '~';
+constexpr float panel_padding = 6;
+// height of the frame time graph, the top is graph_scale milliseconds
+constexpr float graph_height = 48;
+constexpr float graph_bar_width = 2;
+constexpr float graph_scale = 50;
+constexpr float target_frame_time = 1000.0F / 60.0F;
+
+constexpr array<float, 4> panel_color {0.0F, 0.0F, 0.0F, 0.6F};
+constexpr array<float, 4> text_color {1.0F, 1.0F, 1.0F, 1.0F};
+constexpr array<float, 4> line_color {1.0F, 1.0F, 1.0F, 0.3F};
+constexpr array<float, 4> fast_color {0.3F, 0.85F, 0.4F, 0.9F};
+constexpr array<float, 4> slow_color {0.95F, 0.8F, 0.2F, 0.9F};
+constexpr array<float, 4> stall_color {0.95F, 0.3F, 0.25F, 0.9F};
+
+// searched when neither IMGV_FONT nor IMGV_HUD_FONT name a font
+constexpr array font_candidates {
+    "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/liberation/LiberationMono-Regular.ttf",
+    "/usr/share/fonts/truetype/liberation/LiberationMono-Regular.ttf",
+    "/usr/share/fonts/noto/NotoSansMono-Regular.ttf",
+    "/usr/share/fonts/truetype/noto/NotoSansMono-Regular.ttf",
+};
+
+struct ft_library_deleter
+{
+  auto operator()(FT_Library library) { FT_Done_FreeType(library); }
+};
+
+struct ft_face_deleter
+{
+  auto operator()(FT_Face face) { FT_Done_Face(face); }
+};
+
+struct glyph
+{
+  // offset of the bitmap from the pen position on the baseline, and its size
+  float x {0}, y {0}, width {0}, height {0};
+  // texels of the bitmap in the atlas
+  float u {0}, v {0};
+  float advance {0};
+};
+
+// R8 coverage of the printable ASCII glyphs, rows of glyphs packed left to
+// right, texel (0, 0) is opaque and used for solid quads
+struct glyph_atlas
+{
+  int width {atlas_width}, height {0};
+  vector<u8> pixels;
+  array<glyph, last_glyph - first_glyph + 1> glyphs;
+  float ascender {0}, line_height {0};
+};
+
+auto find_font() -> string
+{
+  if (const auto* env = std::getenv("IMGV_FONT"); env != nullptr) {
+    return env;
+  }
+
+  if (const string configured = IMGV_HUD_FONT; !configured.empty()) {
+    return configured;
+  }
+
+  for (const auto* candidate : font_candidates) {
+    if (std::error_code error; fs::exists(candidate, error)) {
+      return candidate;
+    }
+  }
+
+  IMGV_ERROR("no font found, set IMGV_FONT to the path of a font file");
+}
+
+auto rasterize_atlas() -> glyph_atlas
+{
+  const trace_span span {"rasterize glyphs"};
+  const auto path = find_font();
+  FT_Library library_handle = nullptr;
+  if (FT_Init_FreeType(&library_handle) != 0) {
+    IMGV_ERROR("unable to initialize FreeType");
+  }
+  const unique_ptr<FT_LibraryRec_, ft_library_deleter> library {
+      library_handle};
+
+  FT_Face face_handle = nullptr;
+  if (FT_New_Face(library.get(), path.c_str(), 0, &face_handle) != 0) {
+    IMGV_ERROR(fmt::format("unable to open font '{}'", path));
+  }
+  const unique_ptr<FT_FaceRec_, ft_face_deleter> face {face_handle};
+  if (FT_Set_Pixel_Sizes(face.get(), 0, font_size) != 0) {
+    IMGV_ERROR(
+        fmt::format("unable to use font '{}' at {} px", path, font_size));
+  }
+
+  glyph_atlas atlas;
+  const auto& metrics = face->size->metrics;
+  atlas.ascender = static_cast<float>(metrics.ascender >> 6);
+  atlas.line_height = static_cast<float>(metrics.height >> 6);
+
+  // the first texel is left for solid quads, rows grow the atlas downward
+  int pen_x = 2, pen_y = 0, row_height = 1;
+  atlas.pixels.resize(atlas_width);
+  atlas.pixels[0] = 0xFF;
+  for (auto ch = first_glyph; ch <= last_glyph; ++ch) {
+    if (FT_Load_Char(face.get(), static_cast<FT_ULong>(ch), FT_LOAD_RENDER)
+        != 0)
+    {
+      continue;
+    }
+
+    const auto* slot = face->glyph;
+    const auto& bitmap = slot->bitmap;
+    const auto width = static_cast<int>(bitmap.width);
+    const auto height = static_cast<int>(bitmap.rows);
+    if (pen_x + width + 1 > atlas_width) {
+      pen_x = 0;
+      pen_y += row_height + 1;
+      row_height = 0;
+    }
+
+    auto& g = atlas.glyphs.at(static_cast<usize>(ch - first_glyph));
+    g.x = static_cast<float>(slot->bitmap_left);
+    g.y = -static_cast<float>(slot->bitmap_top);
+    g.width = static_cast<float>(width);
+    g.height = static_cast<float>(height);
+    g.u = static_cast<float>(pen_x);
+    g.v = static_cast<float>(pen_y);
+    g.advance = static_cast<float>(slot->advance.x >> 6);
+
+    const auto rows = static_cast<usize>(pen_y + height);
+    atlas.pixels.resize(std::max(atlas.pixels.size(), rows * atlas_width));
+    for (int y = 0; y < height; ++y) {
+      std::copy_n(bitmap.buffer + static_cast<std::ptrdiff_t>(y) * bitmap.pitch,
+                  width,
+                  atlas.pixels.begin() + (pen_y + y) * atlas_width + pen_x);
+    }
+    pen_x += width + 1;
+    row_height = std::max(row_height, height);
+  }
+
+  atlas.height = static_cast<int>(atlas.pixels.size() / atlas_width);
+  return atlas;
+}
+
+// rasterized the first time any window shows its overlay, shared by every
+// window afterwards
+auto shared_atlas() -> const glyph_atlas&
+{
+  static const auto atlas = rasterize_atlas();
+  return atlas;
+}
+
+auto bar_color(float milliseconds) -> array<float, 4>
+{
+  if (milliseconds <= target_frame_time * 1.25F) {
+    return fast_color;
+  }
+  return milliseconds <= target_frame_time * 2.5F ? slow_color : stall_color;
+}
+}  // namespace
+
+// one instance per quad, the rectangle is in pixels from the top left corner
+// of the viewport and the texture coordinates in texels of the atlas
+const GLchar* const hud_vertex_shader = R"(
+  #version 430 core
+
+  layout(location = 0) uniform vec2 viewport;
+
+  struct quad {
+    vec4 rect;
+    vec4 uv;
+    vec4 color;
+  };
+
+  layout(std430, binding = 0) readonly buffer quads {
+    quad quad_data[];
+  };
+
+  layout(binding = 0) uniform sampler2D atlas;
+
+  const vec2 vertices[4] = vec2[](
+    vec2(0,0), vec2(1,0), vec2(0,1), vec2(1,1)
+  );
+
+  layout(location = 0) out vec2 tex_coords;
+  layout(location = 1) out vec4 quad_color;
+
+  void main() {
+    quad q = quad_data[gl_InstanceID];
+    vec2 corner = vertices[gl_VertexID];
+    vec2 pos = (q.rect.xy + corner * q.rect.zw) / viewport;
+    gl_Position = vec4(pos.x * 2.0 - 1.0, 1.0 - pos.y * 2.0, 0.0, 1.0);
+    tex_coords = (q.uv.xy + corner * q.uv.zw) / vec2(textureSize(atlas, 0));
+    quad_color = q.color;
+  }
+)";
+
+const GLchar* const hud_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 tex_coords;
+  layout(location = 1) in vec4 quad_color;
+  layout(location = 0) out vec4 color;
+
+  layout(binding = 0) uniform sampler2D atlas;
+
+  void main() {
+    color = vec4(quad_color.rgb, quad_color.a * texture(atlas, tex_coords).r);
+  }
+)";
+
+hud::hud(window* owner)
+    : m_owner {owner}
+    , m_vao {gl_vertex_array::create(owner)}
+    , m_program {create_program(owner, hud_vertex_shader, hud_fragment_shader)}
+    , m_atlas {gl_texture::create(owner)}
+    , m_instances {gl_buffer::create(owner)}
+    , m_last_present {chr::steady_clock::now()}
+{
+  const auto& atlas = shared_atlas();
+  m_owner->use_gl(
+      [&](const GladGLContext& gl)
+      {
+        gl.BindTexture(GL_TEXTURE_2D, *m_atlas);
+        gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        gl.TexImage2D(GL_TEXTURE_2D,
+                      0,
+                      GL_R8,
+                      atlas.width,
+                      atlas.height,
+                      0,
+                      GL_RED,
+                      GL_UNSIGNED_BYTE,
+                      atlas.pixels.data());
+        gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+      });
+}
+
+auto hud::reset() -> void
+{
+  m_next_frame = m_num_frames = 0;
+  m_last_present = chr::steady_clock::now();
+}
+
+auto hud::frame_presented() -> void
+{
+  const auto now = chr::steady_clock::now();
+  m_frame_times.at(m_next_frame) =
+      chr::duration<float, std::milli> {now - m_last_present}.count();
+  m_next_frame = (m_next_frame + 1) % graph_size;
+  m_num_frames = std::min(m_num_frames + 1, graph_size);
+  m_last_present = now;
+}
+
+auto hud::draw(const GladGLContext& gl,
+               int width,
+               int height,
+               const window_stats& stats) -> void
+{
+  const trace_span span {"hud"};
+  const auto& atlas = shared_atlas();
+
+  vector<string> lines;
+  if (m_num_frames > 0) {
+    const auto total = std::accumulate(
+        m_frame_times.begin(), m_frame_times.begin() + m_num_frames, 0.0F);
+    const auto worst = *std::max_element(
+        m_frame_times.begin(), m_frame_times.begin() + m_num_frames);
+    const auto last =
+        m_frame_times.at((m_next_frame + graph_size - 1) % graph_size);
+    lines.push_back(
+        fmt::format("{:.1f} fps", 1000.0F * static_cast<float>(m_num_frames)
+                        / std::max(total, 1e-3F)));
+    lines.push_back(fmt::format("frame {:.2f} ms, max {:.2f}", last, worst));
+  } else {
+    lines.emplace_back("no frames yet");
+  }
+  if (stats.decode_time.has_value() || stats.upload_time.has_value()) {
+    lines.push_back(fmt::format("decode {:.2f} ms, upload {:.2f} ms",
+                                stats.decode_time.value_or(0.0),
+                                stats.upload_time.value_or(0.0)));
+  }
+  for (const auto& [name, timing] :
+       {tuple {"cpu", stats.cpu_render}, tuple {"gpu", stats.gpu_render}})
+  {
+    if (timing.has_value()) {
+      lines.push_back(fmt::format("{} {:.2f} ms, p95 {:.2f}, max {:.2f}",
+                                  name,
+                                  timing->mean,
+                                  timing->p95,
+                                  timing->max));
+    }
+  }
+  lines.push_back(fmt::format(
+      "textures {:.1f} MiB",
+      static_cast<double>(stats.texture_bytes) / (1024.0 * 1024.0)));
+  if (stats.frame.has_value()) {
+    const auto [current, count] = *stats.frame;
+    lines.push_back(fmt::format("frame {}/{}", current + 1, count));
+  }
+  if (stats.filter.has_value()) {
+    lines.push_back(fmt::format("scaling {}", *stats.filter));
+  }
+  if (stats.zoom.has_value()) {
+    lines.push_back(fmt::format("zoom {:.0f}%", *stats.zoom * 100.0));
+  }
+  if (stats.dropped_frames.has_value()) {
+    lines.push_back(fmt::format("dropped {}", *stats.dropped_frames));
+  }
+
+  // the panel is sized after the text, which is laid out first
+  m_quads.clear();
+  m_quads.push_back({});
+  const auto graph_width = graph_bar_width * static_cast<float>(graph_size);
+  auto panel_width = graph_width;
+  auto y = panel_padding;
+  for (const auto& line : lines) {
+    const auto end = add_text(panel_padding, y + atlas.ascender, line);
+    panel_width = std::max(panel_width, end - panel_padding);
+    y += atlas.line_height;
+  }
+
+  // bars from oldest to newest, the newest at the right edge
+  const auto graph_top = y + panel_padding;
+  const auto oldest = (m_next_frame + graph_size - m_num_frames) % graph_size;
+  for (usize i = 0; i < m_num_frames; ++i) {
+    const auto ms = m_frame_times.at((oldest + i) % graph_size);
+    const auto bar = graph_height * std::min(ms / graph_scale, 1.0F);
+    add_rect(panel_padding + graph_width
+                 - graph_bar_width * static_cast<float>(m_num_frames - i),
+             graph_top + graph_height - bar,
+             graph_bar_width,
+             bar,
+             bar_color(ms));
+  }
+  add_rect(panel_padding,
+           graph_top + graph_height * (1.0F - target_frame_time / graph_scale),
+           graph_width,
+           1,
+           line_color);
+
+  m_quads.front() = {{0, 0, panel_width + 2 * panel_padding,
+                      graph_top + graph_height + panel_padding},
+                     {0.25F, 0.25F, 0.5F, 0.5F},
+                     panel_color};
+
+  gl.BindBuffer(GL_SHADER_STORAGE_BUFFER, *m_instances);
+  gl.BufferData(GL_SHADER_STORAGE_BUFFER,
+                static_cast<GLsizeiptr>(m_quads.size() * sizeof(instance)),
+                m_quads.data(),
+                GL_STREAM_DRAW);
+
+  gl.Enable(GL_BLEND);
+  gl.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  gl.UseProgram(*m_program);
+  gl.BindVertexArray(*m_vao);
+  gl.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, *m_instances);
+  gl.ActiveTexture(GL_TEXTURE0);
+  gl.BindTexture(GL_TEXTURE_2D, *m_atlas);
+  gl.Uniform2f(0, static_cast<GLfloat>(width), static_cast<GLfloat>(height));
+  gl.DrawArraysInstanced(
+      GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(m_quads.size()));
+  gl.Disable(GL_BLEND);
+}
+
+auto hud::add_text(float x, float y, string_view text) -> float
+{
+  const auto& atlas = shared_atlas();
+  for (const auto ch : text) {
+    if (ch < first_glyph || ch > last_glyph) {
+      continue;
+    }
+
+    const auto& g = atlas.glyphs.at(static_cast<usize>(ch - first_glyph));
+    if (g.width > 0 && g.height > 0) {
+      m_quads.push_back({{x + g.x, y + g.y, g.width, g.height},
+                         {g.u, g.v, g.width, g.height},
+                         text_color});
+    }
+    x += g.advance;
+  }
+
+  return x;
+}
+
+auto hud::add_rect(float x, float y, float w, float h, array<float, 4> color)
+    -> void
+{
+  // the center of the opaque texel
+  m_quads.push_back({{x, y, w, h}, {0.25F, 0.25F, 0.5F, 0.5F}, color});
+}
+}  // namespace imgv
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+
+#include "gl_wrapper.hpp"
+
+// font of the overlay when IMGV_FONT is not set, empty to search the usual
+// system locations
+#ifndef IMGV_HUD_FONT
+// NOLINTNEXTLINE(*-macro-usage)
+#  define IMGV_HUD_FONT ""
+#endif
+
+namespace imgv
+{
+extern const GLchar* const hud_vertex_shader;
+extern const GLchar* const hud_fragment_shader;
+
+// performance overlay drawn on top of a window before its buffers are swapped
+//
+// the glyphs are rasterized by FreeType once per process into an atlas, the
+// panel, text and frame time graph are then a single instanced draw of quads
+// read from a buffer
+class hud
+{
+public:
+  static constexpr usize graph_size = 120;
+
+  explicit hud(window* owner);
+
+  // forget the frame times, when the overlay is shown again
+  auto reset() -> void;
+  // the time since the previous call is the frame time of the graph
+  auto frame_presented() -> void;
+  // draw over the bound framebuffer of the given size
+  auto draw(const GladGLContext& gl,
+            int width,
+            int height,
+            const window_stats& stats) -> void;
+
+private:
+  // one quad, in pixels from the top left corner
+  struct instance
+  {
+    array<float, 4> rect;
+    array<float, 4> uv;
+    array<float, 4> color;
+  };
+
+  window* m_owner;
+  gl_vertex_array m_vao;
+  gl_program m_program;
+  gl_texture m_atlas;
+  gl_buffer m_instances;
+  vector<instance> m_quads;
+
+  // milliseconds between presents, oldest first once full
+  array<float, graph_size> m_frame_times {};
+  usize m_next_frame {0}, m_num_frames {0};
+  std::chrono::steady_clock::time_point m_last_present;
+
+  auto add_text(float x, float y, string_view text) -> float;
+  auto add_rect(float x, float y, float w, float h, array<float, 4> color)
+      -> void;
+};
+}  // namespace imgv
@@ -0,0 +1,478 @@
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "image.hpp"
+
+#include <fmt/core.h>
+
+#include "file_reader.hpp"
+#include "gif.hpp"
+#include "jpeg.hpp"
+#include "stbi.hpp"
+#include "trace.hpp"
+#include "webp.hpp"
+#include "window.hpp"
+
+namespace imgv
+{
+
+struct decoded_image::loader
+{
+  // the whole file, kept only for the loaders that decode it lazily
+  vector<u8> contents;
+  variant<gif_loader, webp_loader, jpeg_loader, stbi_loader> value;
+};
+
+namespace
+{
+using namespace std::literals;
+
+// how often the textures waiting for the workers to compress them are checked,
+// in seconds
+constexpr double compression_poll_interval = 0.05;
+
+auto milliseconds_since(std::chrono::steady_clock::time_point start) -> double
+{
+  return std::chrono::duration<double, std::milli> {
+      std::chrono::steady_clock::now() - start}
+      .count();
+}
+
+// sniffs the file type from the first bytes of a file
+struct header_checker
+{
+  constexpr static usize max_header_size = image_header_size;
+  array<char, max_header_size> header {};
+
+  explicit header_checker(const vector<u8>& contents)
+  {
+    std::copy_n(contents.begin(),
+                std::min(contents.size(), max_header_size),
+                header.begin());
+  }
+
+  auto check_header(string_view check, usize offset = 0) -> bool
+  {
+    return memcmp(check.data(), &header.at(offset), check.size()) == 0;
+  }
+
+  auto is_png() -> bool
+  {
+    return check_header("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A"sv);
+  }
+
+  auto is_gif() -> bool
+  {
+    return check_header("GIF87a"sv) || check_header("GIF89a"sv);
+  }
+
+  auto is_jpeg() -> bool
+  {
+    return check_header("\xFF\xD8\xFF\xDB"sv)
+        || check_header("\xFF\xD8\xFF\xE0\x00\x10\x4A\x46\x49\x46\x00\x01"sv)
+        || check_header("\xFF\xD8\xFF\xEE"sv)
+        || (check_header("\xFF\xD8\xFF\xE1"sv)
+            && check_header("\x45\x78\x69\x66\x00\x00"sv, 6))
+        || check_header("\xFF\xD8\xFF\xE0"sv);
+  }
+
+  auto is_bmp() -> bool { return check_header("BM"); }
+  auto is_psd() -> bool { return check_header("8BPS"); }
+  auto is_hdr() -> bool { return check_header("#?RADIANCE."); }
+
+  auto is_ppm() -> bool
+  {
+    return check_header("\x50\x33\x0A"sv) || check_header("\x50\x36\x0A"sv);
+  }
+
+  auto stbi_supported() -> bool
+  {
+    return is_png() || is_gif() || is_jpeg() || is_bmp() || is_psd() || is_hdr()
+        || is_ppm();
+  }
+
+  auto is_webp() -> bool
+  {
+    return check_header("RIFF"sv) && check_header("WEBP"sv, 8);
+  }
+};
+
+// construct a Loader for the file at path, nullptr (with a warning) if it
+// rejects the file
+//
+// contents is taken only by the loaders that read it after construction,
+// args are passed on to the constructor
+template<typename Loader, typename... Args>
+auto try_loader(const string& path,
+                vector<u8>& contents,
+                const char* name,
+                Args&&... args) -> unique_ptr<decoded_image::loader>
+{
+  try {
+    fmt::print("opening file using {}\n", name);
+    const trace_span span {name};
+    Loader decoder {path.c_str(), contents, forward<Args>(args)...};
+    return std::make_unique<decoded_image::loader>(decoded_image::loader {
+        std::is_same_v<Loader, webp_loader> ? move(contents) : vector<u8> {},
+        move(decoder)});
+  } catch (std::exception& ex) {
+    fmt::print("warn: unable to load file using {}\n", name);
+    dump_exception(ex);
+    return nullptr;
+  }
+}
+}  // namespace
+
+decoded_image::decoded_image(string path, unique_ptr<loader> decoder)
+    : m_path {move(path)}
+    , m_loader {move(decoder)}
+{
+}
+
+decoded_image::decoded_image(decoded_image&&) noexcept = default;
+auto decoded_image::operator=(decoded_image&&) noexcept
+    -> decoded_image& = default;
+decoded_image::~decoded_image() = default;
+
+auto decode_image(string path, thread_pool* workers) -> optional<decoded_image>
+{
+  // the header first, so that a large file no loader takes (a video) is not
+  // read whole
+  if (!sniff_image_file(path)) {
+    return nullopt;
+  }
+
+  auto contents = read_file(path);
+  if (!contents.has_value()) {
+    return nullopt;
+  }
+
+  return decode_image(move(path), move(*contents), workers);
+}
+
+auto decode_image(string path, vector<u8> contents, thread_pool* workers)
+    -> optional<decoded_image>
+{
+  const trace_span span {"decode image"};
+  const auto start = std::chrono::steady_clock::now();
+  header_checker checker {contents};
+  unique_ptr<decoded_image::loader> loader;
+  if (checker.is_gif()) {
+    loader = try_loader<gif_loader>(path, contents, "gif_loader", workers);
+  }
+
+  if (!loader && checker.is_webp()) {
+    loader = try_loader<webp_loader>(path, contents, "webp_loader");
+  }
+
+  if (!loader && checker.is_jpeg()) {
+    loader = try_loader<jpeg_loader>(path, contents, "jpeg_loader");
+  }
+
+  if (!loader && checker.stbi_supported()) {
+    loader = try_loader<stbi_loader>(path, contents, "stbi_loader");
+  }
+
+  if (!loader) {
+    return nullopt;
+  }
+
+  decoded_image image {move(path), move(loader)};
+  image.m_decode_time = milliseconds_since(start);
+  return image;
+}
+
+auto sniff_image(const vector<u8>& header) -> bool
+{
+  header_checker checker {header};
+  return checker.is_webp() || checker.stbi_supported();
+}
+
+auto sniff_image_file(const string& path) -> bool
+{
+  const auto header = read_file_header(path, image_header_size);
+  return header.has_value() && !header->empty() && sniff_image(*header);
+}
+
+auto upload_image(window* w, decoded_image image, thread_pool* recompressor)
+    -> gpu_image
+{
+  const trace_span span {"upload image"};
+  const auto start = std::chrono::steady_clock::now();
+  gpu_image result;
+  result.title = image.path();
+  result.decode_time = image.decode_time();
+  auto textures = std::make_shared<gpu_textures>();
+  texture_uploader uploader {recompressor, {}, {}};
+  visit(
+      [&](auto& loader)
+      {
+        using loader_t = std::decay_t<decltype(loader)>;
+        result.width = loader.metadata.width;
+        result.height = loader.metadata.height;
+        if constexpr (std::is_same_v<loader_t, jpeg_loader>) {
+          result.kind = image_kind::planar;
+          textures->planes = loader(w, uploader);
+        } else if (loader.metadata.animated) {
+          result.kind = loader.metadata.indexed ? image_kind::indexed
+                                                : image_kind::animated;
+          textures->frames = loader.load_animation(w);
+          result.delays =
+              std::make_shared<const frame_delays>(loader.take_delays());
+          result.byte_size = textures->frames.byte_size;
+          return;
+        } else {
+          result.kind = image_kind::still;
+          textures->planes[0] = loader(w, uploader);
+        }
+
+        w->use_gl(
+            [&](const GladGLContext& gl)
+            {
+              for (const auto& plane : textures->planes) {
+                if (*plane != 0) {
+                  gl.BindTexture(GL_TEXTURE_2D, *plane);
+                  result.byte_size += texture_memory_size(gl, GL_TEXTURE_2D);
+                }
+              }
+
+              // the smallest levels, enough to draw the first frame
+              if (!uploader.stream.done()) {
+                uploader.stream.step(gl);
+                textures->stream = std::make_unique<texture_stream>(
+                    move(uploader.stream));
+              }
+              textures->compressions = move(uploader.compressions);
+            });
+      },
+      image.m_loader->value);
+
+  textures->byte_size = result.byte_size;
+  result.textures = move(textures);
+  result.upload_time = milliseconds_since(start);
+  return result;
+}
+
+auto gpu_textures::set_owner(window* owner) -> void
+{
+  for (auto& plane : planes) {
+    plane.set_owner(owner);
+  }
+  for (auto& page : frames.pages) {
+    page.set_owner(owner);
+  }
+  frames.palettes.set_owner(owner);
+}
+
+auto gpu_textures::continue_upload(const GladGLContext& gl) -> bool
+{
+  if (stream != nullptr) {
+    const auto finer = stream->step(gl);
+    if (stream->done()) {
+      stream.reset();
+    }
+    if (finer) {
+      ++revision;
+    }
+
+    return finer;
+  }
+
+  // the stream writes into the uncompressed textures, which are only
+  // replaced once it is done
+  auto changed = false;
+  for (auto it = compressions.begin(); it != compressions.end();) {
+    if (it->result.wait_for(std::chrono::seconds {0})
+        != std::future_status::ready)
+    {
+      ++it;
+      continue;
+    }
+
+    try {
+      swap_compressed(gl, it->plane, it->result.get());
+      changed = true;
+    } catch (std::exception& ex) {
+      // the uncompressed texture stays
+      fmt::print("warn: unable to compress a texture\n");
+      dump_exception(ex);
+    }
+    it = compressions.erase(it);
+  }
+
+  if (changed) {
+    ++revision;
+    byte_size = 0;
+    for (const auto& plane : planes) {
+      if (*plane != 0) {
+        gl.BindTexture(GL_TEXTURE_2D, *plane);
+        byte_size += texture_memory_size(gl, GL_TEXTURE_2D);
+      }
+    }
+  }
+
+  return changed;
+}
+
+auto gpu_textures::upload_wait_time() const -> double
+{
+  if (stream != nullptr) {
+    return 0.0;
+  }
+
+  return compressions.empty() ? std::numeric_limits<double>::infinity()
+                              : compression_poll_interval;
+}
+
+auto gpu_textures::swap_compressed(const GladGLContext& gl,
+                                   usize plane,
+                                   const compressed_texture& compressed)
+    -> void
+{
+  const trace_span span {"swap compressed"};
+  auto& current = planes.at(plane);
+  GLint mag_filter = GL_NEAREST;
+  gl.BindTexture(GL_TEXTURE_2D, *current);
+  gl.GetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &mag_filter);
+
+  auto texture = gl_texture::create(current.owner());
+  gl.BindTexture(GL_TEXTURE_2D, *texture);
+  const auto levels = static_cast<GLint>(compressed.levels.size());
+  for (GLint level = 0; level < levels; ++level) {
+    const auto& blocks = compressed.levels.at(static_cast<usize>(level));
+    gl.CompressedTexImage2D(GL_TEXTURE_2D,
+                            level,
+                            compressed.internal_format,
+                            std::max(compressed.width >> level, 1),
+                            std::max(compressed.height >> level, 1),
+                            0,
+                            static_cast<GLsizei>(blocks.size()),
+                            blocks.data());
+  }
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
+  gl.TexParameteri(
+      GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  current = move(texture);
+}
+
+namespace
+{
+// shrink RGBA or RGB pixels to fit in a max_size square by averaging the
+// source pixels covered by each destination pixel
+auto box_filter(const u8* pixels,
+                int width,
+                int height,
+                usize channels,
+                int max_size) -> thumbnail
+{
+  const trace_span span {"downscale"};
+  const auto longest = std::max(width, height);
+  thumbnail result;
+  result.width = longest > max_size ? std::max(1, width * max_size / longest)
+                                    : width;
+  result.height = longest > max_size ? std::max(1, height * max_size / longest)
+                                     : height;
+  result.pixels.resize(static_cast<usize>(result.width)
+                       * static_cast<usize>(result.height) * 4);
+
+  const auto src_width = static_cast<usize>(width);
+  auto* out = result.pixels.data();
+  for (int y = 0; y < result.height; ++y) {
+    const auto y0 = static_cast<usize>(y * height / result.height);
+    const auto y1 = std::max(
+        y0 + 1, static_cast<usize>((y + 1) * height / result.height));
+    for (int x = 0; x < result.width; ++x) {
+      const auto x0 = static_cast<usize>(x * width / result.width);
+      const auto x1 = std::max(
+          x0 + 1, static_cast<usize>((x + 1) * width / result.width));
+      array<usize, 4> sum {0, 0, 0, 0};
+      for (auto sy = y0; sy < y1; ++sy) {
+        const auto* row = pixels + (sy * src_width + x0) * channels;
+        for (auto sx = x0; sx < x1; ++sx, row += channels) {
+          for (usize c = 0; c < channels; ++c) {
+            sum.at(c) += row[c];
+          }
+        }
+      }
+
+      const auto count = (y1 - y0) * (x1 - x0);
+      for (usize c = 0; c < 4; ++c) {
+        *out++ = c < channels ? static_cast<u8>(sum.at(c) / count) : u8 {255};
+      }
+    }
+  }
+
+  return result;
+}
+}  // namespace
+
+auto decode_thumbnail(const string& path, int max_size) -> optional<thumbnail>
+{
+  const trace_span span {"decode thumbnail"};
+  const auto contents = read_file(path);
+  if (!contents.has_value()) {
+    return nullopt;
+  }
+
+  header_checker checker {*contents};
+  if (checker.is_jpeg()) {
+    int width = 0, height = 0;
+    vector<u8> pixels;
+    if (decode_jpeg_scaled(*contents,
+                           static_cast<unsigned>(max_size),
+                           width,
+                           height,
+                           pixels))
+    {
+      return box_filter(pixels.data(), width, height, 3, max_size);
+    }
+  }
+
+  if (checker.is_webp()) {
+    if (auto result = decode_webp_scaled(*contents, max_size)) {
+      return result;
+    }
+
+    // animations are only decoded at full size, keep the first frame
+    try {
+      webp_loader loader {path.c_str(), *contents};
+      return box_filter(loader.next_frame(),
+                        loader.metadata.width,
+                        loader.metadata.height,
+                        4,
+                        max_size);
+    } catch (std::exception&) {
+      return nullopt;
+    }
+  }
+
+  if (!checker.stbi_supported()) {
+    return nullopt;
+  }
+
+  // everything else, including animations, goes through stb_image, which
+  // only decodes the first frame
+  if (contents->size() > static_cast<usize>(INT_MAX)) {
+    return nullopt;
+  }
+
+  int width = 0, height = 0, num_comps = 0;
+  stbi_loader::pixel_data data {
+      stbi_load_from_memory(contents->data(),
+                            static_cast<int>(contents->size()),
+                            &width,
+                            &height,
+                            &num_comps,
+                            4)};
+  if (!data) {
+    return nullopt;
+  }
+
+  return box_filter(data.get(), width, height, 4, max_size);
+}
+
+}  // namespace imgv
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+
+#include "texture_load_common.hpp"
+#include "texture_stream.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+
+class window;
+
+// how the textures of an image are laid out, each kind is drawn by its own
+// shader program
+enum class image_kind
+{
+  // one RGBA texture
+  still,
+  // Y, Cb and Cr textures, chroma possibly subsampled
+  planar,
+  // frames in a paged_texture
+  animated,
+  // palette indices in a paged_texture, see paged_texture::palettes
+  indexed,
+};
+
+constexpr usize image_kind_count = 4;
+
+inline auto is_animation(image_kind kind) -> bool
+{
+  return kind == image_kind::animated || kind == image_kind::indexed;
+}
+
+// the textures of an image, shared by every window showing the same file (see
+// texture_registry)
+struct gpu_textures
+{
+  // still: planes[0], planar: Y, Cb and Cr
+  std::array<gl_texture, 3> planes;
+  // animated and indexed
+  paged_texture frames;
+  // the levels of large still images left to upload, null once complete
+  unique_ptr<texture_stream> stream;
+  // planes uploaded uncompressed, until the workers have compressed them
+  vector<pending_compression> compressions;
+  // counts the changes of the textures made by continue_upload(), to know
+  // when what was drawn from them is outdated
+  usize revision {0};
+  // video memory used by the textures, which continue_upload() may change
+  usize byte_size {0};
+
+  // make owner delete the textures, any window of the share group can
+  auto set_owner(window* owner) -> void;
+  // upload the next levels of stream, then swap in the planes compressed by
+  // the workers, with the context of any window of the share group current,
+  // returns whether the textures changed
+  auto continue_upload(const GladGLContext& gl) -> bool;
+  // how long to wait before calling continue_upload() again, infinity once
+  // the upload is complete
+  auto upload_wait_time() const -> double;
+
+private:
+  auto swap_compressed(const GladGLContext& gl,
+                       usize plane,
+                       const compressed_texture& compressed) -> void;
+};
+
+// an image uploaded to the share group of a window
+struct gpu_image
+{
+  image_kind kind {image_kind::still};
+  int width {0}, height {0};
+  string title;
+
+  // null once released to meet the memory budget
+  shared_ptr<gpu_textures> textures;
+  // animated and indexed
+  shared_ptr<const frame_delays> delays;
+
+  // video memory used by the textures
+  usize byte_size {0};
+  // in milliseconds, as shown by the performance overlay, 0 when the
+  // textures were shared by another window
+  double decode_time {0}, upload_time {0};
+
+  auto empty() const -> bool { return width == 0 || height == 0; }
+  // false once the textures were released to meet the memory budget
+  auto resident() const -> bool { return textures != nullptr; }
+};
+
+// a file decoded (or at least opened and validated) by one of the loaders,
+// nothing in it touches OpenGL so it can be created on any thread
+class decoded_image
+{
+public:
+  decoded_image(decoded_image&&) noexcept;
+  auto operator=(decoded_image&&) noexcept -> decoded_image&;
+  ~decoded_image();
+
+  decoded_image(const decoded_image&) = delete;
+  auto operator=(const decoded_image&) = delete;
+
+  auto path() const -> const string& { return m_path; }
+  // time decode_image() took, in milliseconds
+  auto decode_time() const -> double { return m_decode_time; }
+
+  // the loader that accepted the file, defined in image.cpp
+  struct loader;
+
+private:
+  string m_path;
+  unique_ptr<loader> m_loader;
+  double m_decode_time {0};
+
+  decoded_image(string path, unique_ptr<loader> decoder);
+
+  friend auto decode_image(string path,
+                           vector<u8> contents,
+                           thread_pool* workers) -> optional<decoded_image>;
+  friend auto upload_image(window* w,
+                           decoded_image image,
+                           thread_pool* recompressor) -> gpu_image;
+};
+
+// sniff the file type and decode it with the first loader that accepts it,
+// nullopt if the file is not an image any loader understands
+//
+// loaders that decode parts of a file in parallel (GIF frames) use workers
+// too when it is not null, it may be the pool running this call
+auto decode_image(string path, thread_pool* workers = nullptr)
+    -> optional<decoded_image>;
+// same as decode_image(path), with the file already read into contents
+auto decode_image(string path,
+                  vector<u8> contents,
+                  thread_pool* workers = nullptr) -> optional<decoded_image>;
+
+// bytes at the start of a file that sniff_image() looks at
+constexpr usize image_header_size = 16;
+
+// some loader may accept a file starting with header, which holds up to
+// image_header_size bytes
+auto sniff_image(const vector<u8>& header) -> bool;
+// sniff_image() on the start of the file at path, which is not read further
+auto sniff_image_file(const string& path) -> bool;
+
+// upload the image into textures owned by w, must be called from the main
+// thread
+//
+// with a recompressor, still images are uploaded uncompressed and its workers
+// compress them, see gpu_textures::continue_upload()
+auto upload_image(window* w,
+                  decoded_image image,
+                  thread_pool* recompressor = nullptr) -> gpu_image;
+
+// decode path into an RGBA image that fits in a max_size square, JPEG and WebP
+// are scaled down by their decoders, other formats are decoded in full and
+// box filtered, nullopt if the file is not a supported image
+auto decode_thumbnail(const string& path, int max_size) -> optional<thumbnail>;
+
+}  // namespace imgv
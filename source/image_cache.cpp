@@ -0,0 +1,57 @@
+#include "image_cache.hpp"
+
+#include "stats.hpp"
+
+namespace imgv
+{
+image_cache::image_cache(usize capacity)
+    : m_capacity {capacity}
+{
+}
+
+auto image_cache::contains(const string& path) const -> bool
+{
+  return m_index.find(path) != m_index.end();
+}
+
+auto image_cache::take(const string& path) -> optional<gpu_image>
+{
+  auto image = remove(path);
+  increment(image.has_value() ? counters().image_cache_hits
+                              : counters().image_cache_misses);
+  return image;
+}
+
+auto image_cache::remove(const string& path) -> optional<gpu_image>
+{
+  const auto it = m_index.find(path);
+  if (it == m_index.end()) {
+    return nullopt;
+  }
+
+  auto image = move(it->second->image);
+  m_size -= image.byte_size;
+  m_entries.erase(it->second);
+  m_index.erase(it);
+  return image;
+}
+
+auto image_cache::put(string path, gpu_image image) -> void
+{
+  remove(path);
+  m_size += image.byte_size;
+  m_entries.push_front({path, move(image)});
+  m_index.emplace(move(path), m_entries.begin());
+  evict();
+}
+
+auto image_cache::evict() -> void
+{
+  while (m_size > m_capacity && !m_entries.empty()) {
+    auto& last = m_entries.back();
+    m_size -= last.image.byte_size;
+    m_index.erase(last.path);
+    m_entries.pop_back();
+  }
+}
+}  // namespace imgv
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+
+#include "image.hpp"
+#include "types.hpp"
+
+// upper bound of the video memory used by the images kept around for
+// navigation, per window, in bytes
+#ifndef IMGV_IMAGE_CACHE_SIZE
+// NOLINTNEXTLINE(*-macro-usage)
+#  define IMGV_IMAGE_CACHE_SIZE 536870912
+#endif
+
+namespace imgv
+{
+constexpr usize image_cache_size = IMGV_IMAGE_CACHE_SIZE;
+
+// uploaded images keyed by path, the least recently used ones are dropped
+// once their total size exceeds the capacity
+class image_cache
+{
+public:
+  explicit image_cache(usize capacity = image_cache_size);
+
+  auto contains(const string& path) const -> bool;
+  // remove the image from the cache and return it
+  auto take(const string& path) -> optional<gpu_image>;
+  // insert the image as the most recently used one, an image larger than the
+  // whole capacity is not kept
+  auto put(string path, gpu_image image) -> void;
+
+  auto size() const -> usize { return m_size; }
+
+  // call f with every cached image, the most recently used first
+  template<typename Function>
+  auto for_each(Function&& f) const -> void
+  {
+    for (const auto& e : m_entries) {
+      f(e.image);
+    }
+  }
+
+private:
+  struct entry
+  {
+    string path;
+    gpu_image image;
+  };
+
+  usize m_capacity, m_size {0};
+  // most recently used first
+  std::list<entry> m_entries;
+  std::unordered_map<string, std::list<entry>::iterator> m_index;
+
+  // take without counting a cache hit or miss
+  auto remove(const string& path) -> optional<gpu_image>;
+  auto evict() -> void;
+};
+}  // namespace imgv
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "image_view.hpp"
+
+namespace imgv
+{
+namespace
+{
+// zoom factor of one wheel tick
+constexpr double tick_factor = 1.1;
+constexpr double min_scale = 1.0 / 32.0;
+constexpr double max_scale = 256.0;
+
+// scales and pixel positions closer than this only differ by rounding
+constexpr double epsilon = 1e-6;
+
+auto nearly_equal(double a, double b) -> bool
+{
+  return std::fabs(a - b) < epsilon;
+}
+}  // namespace
+
+auto pixel_rect::operator==(const pixel_rect& other) const -> bool
+{
+  return nearly_equal(x, other.x) && nearly_equal(y, other.y)
+      && nearly_equal(width, other.width) && nearly_equal(height, other.height);
+}
+
+auto image_view::zoom(double ticks, double x, double y) -> void
+{
+  m_ticks += ticks;
+  m_anchor_x = x;
+  m_anchor_y = y;
+}
+
+auto image_view::pan(double dx, double dy) -> void
+{
+  m_dx += dx;
+  m_dy += dy;
+}
+
+auto image_view::reset() -> void
+{
+  m_reset = true;
+  m_ticks = m_dx = m_dy = 0.0;
+}
+
+auto image_view::update(int width,
+                        int height,
+                        int window_width,
+                        int window_height) -> bool
+{
+  const auto scale_before = m_scale, x_before = m_x, y_before = m_y;
+  const auto changed = [&]
+  {
+    return !nearly_equal(m_scale, scale_before) || !nearly_equal(m_x, x_before)
+        || !nearly_equal(m_y, y_before);
+  };
+  if (std::exchange(m_reset, false)) {
+    m_scale = 1.0;
+    m_x = m_y = 0.0;
+  }
+  if (window_width <= 0 || window_height <= 0) {
+    return changed();
+  }
+
+  // window coordinates start at the top left, in screen units that may not
+  // be pixels
+  const auto sx = static_cast<double>(width) / window_width;
+  const auto sy = static_cast<double>(height) / window_height;
+  m_x += m_dx * sx;
+  m_y -= m_dy * sy;
+  m_dx = m_dy = 0.0;
+
+  if (!nearly_equal(m_ticks, 0.0)) {
+    const auto scale = std::clamp(
+        m_scale * std::pow(tick_factor, m_ticks), min_scale, max_scale);
+    const auto factor = scale / m_scale;
+    // the point under the cursor stays there
+    const auto ax = m_anchor_x * sx - width / 2.0;
+    const auto ay = height / 2.0 - m_anchor_y * sy;
+    m_x = ax - (ax - m_x) * factor;
+    m_y = ay - (ay - m_y) * factor;
+    m_scale = scale;
+    m_ticks = 0.0;
+  }
+
+  return changed();
+}
+
+auto image_view::place(int image_width,
+                       int image_height,
+                       int width,
+                       int height) const -> pixel_rect
+{
+  if (image_width <= 0 || image_height <= 0) {
+    return {0.0, 0.0, static_cast<double>(width), static_cast<double>(height)};
+  }
+
+  const auto fit = std::min(static_cast<double>(width) / image_width,
+                            static_cast<double>(height) / image_height);
+  const auto w = image_width * fit * m_scale;
+  const auto h = image_height * fit * m_scale;
+  return {(width - w) / 2.0 + m_x, (height - h) / 2.0 + m_y, w, h};
+}
+
+auto image_view::transformed() const -> bool
+{
+  return !nearly_equal(m_scale, 1.0) || !nearly_equal(m_x, 0.0)
+      || !nearly_equal(m_y, 0.0);
+}
+}  // namespace imgv
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace imgv
+{
+// a rectangle of a framebuffer, in pixels from its bottom left corner
+struct pixel_rect
+{
+  double x {0}, y {0}, width {0}, height {0};
+
+  // within rounding error
+  auto operator==(const pixel_rect& other) const -> bool;
+};
+
+// zoom and pan of an image inside a window whose size does not change
+//
+// input only accumulates: the wheel ticks and drags received between two
+// refreshes are applied together by update(), so a burst of events costs one
+// change of the transform and one redraw
+class image_view
+{
+public:
+  // wheel ticks with the cursor at x, y, in window coordinates
+  auto zoom(double ticks, double x, double y) -> void;
+  // move the image by dx, dy, in window coordinates
+  auto pan(double dx, double dy) -> void;
+  // back to the image fitted in the window
+  auto reset() -> void;
+
+  // apply the pending input to a framebuffer of width x height pixels, shown
+  // in a window of window_width x window_height, returns whether the
+  // transform changed
+  auto update(int width, int height, int window_width, int window_height)
+      -> bool;
+
+  // where an image is drawn in a framebuffer of width x height pixels:
+  // fitted, then zoomed and moved, it may extend past the framebuffer
+  auto place(int image_width, int image_height, int width, int height) const
+      -> pixel_rect;
+
+  // zoomed or moved since the last reset
+  auto transformed() const -> bool;
+  // relative to the fitted image
+  auto scale() const -> double { return m_scale; }
+
+private:
+  double m_scale {1.0};
+  // offset of the image center from the framebuffer center, in pixels
+  double m_x {0.0}, m_y {0.0};
+
+  // pending input
+  double m_ticks {0.0};
+  double m_anchor_x {0.0}, m_anchor_y {0.0};
+  double m_dx {0.0}, m_dy {0.0};
+  bool m_reset {false};
+};
+}  // namespace imgv
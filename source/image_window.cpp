@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+
+#include "image_window.hpp"
+
+#include <fmt/core.h>
+
+#include "context.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+const GLchar* const image_vertex_shader = R"(
+  #version 430 core
+
+  layout(location = 0) out vec2 tex_coords;
+
+  // scale and offset of the quad in normalized device coordinates, the
+  // whole viewport unless set by set_image_view()
+  layout(location = 6) uniform vec4 view = vec4(1.0, 1.0, 0.0, 0.0);
+
+  const vec2 vertices[4] = vec2[](
+    vec2(-1,1), vec2(1,1), vec2(-1,-1), vec2(1,-1)
+  );
+  void main() {
+    gl_Position = vec4(vertices[gl_VertexID] * view.xy + view.zw, 0.0, 1.0);
+    tex_coords = vertices[gl_VertexID] * vec2(0.5, -0.5) + vec2(0.5, 0.5);
+  }
+)";
+
+const GLchar* const still_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 tex_coords;
+  layout(location = 0) out vec4 color;
+
+  layout(binding = 0) uniform sampler2D tex;
+
+  void main() {
+    color = texture(tex, tex_coords);
+  }
+)";
+
+// full range BT.601, as used by JFIF
+const GLchar* const ycbcr_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 tex_coords;
+  layout(location = 0) out vec4 color;
+
+  layout(binding = 0) uniform sampler2D luma;
+  layout(binding = 1) uniform sampler2D blue;
+  layout(binding = 2) uniform sampler2D red;
+
+  // chroma is centered on 128
+  const float chroma_zero = 128.0 / 255.0;
+  const mat3 ycbcr_to_rgb = mat3(
+    1.0, 1.0, 1.0,
+    0.0, -0.344136, 1.772,
+    1.402, -0.714136, 0.0
+  );
+
+  void main() {
+    vec3 ycbcr = vec3(texture(luma, tex_coords).r,
+                      texture(blue, tex_coords).r - chroma_zero,
+                      texture(red, tex_coords).r - chroma_zero);
+    color = vec4(clamp(ycbcr_to_rgb * ycbcr, 0.0, 1.0), 1.0);
+  }
+)";
+
+const GLchar* const animated_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 tex_coords;
+  layout(location = 0) out vec4 color;
+
+  layout(location = 0) uniform float layer;
+
+  layout(binding = 0) uniform sampler2DArray tex;
+
+  void main() {
+    color = texture(tex, vec3(tex_coords, layer));
+  }
+)";
+
+const GLchar* const indexed_fragment_shader = R"(
+  #version 430 core
+
+  layout(location = 0) in vec2 tex_coords;
+  layout(location = 0) out vec4 color;
+
+  layout(location = 0) uniform float layer;
+  layout(location = 1) uniform int palette;
+
+  layout(binding = 0) uniform usampler2DArray tex;
+  layout(binding = 1) uniform sampler2D palettes;
+
+  void main() {
+    uint index = texture(tex, vec3(tex_coords, layer)).r;
+    color = texelFetch(palettes, ivec2(index, palette), 0);
+  }
+)";
+
+auto image_programs::get(window* w, image_kind kind) -> GLuint
+{
+  auto& prog = m_programs.at(static_cast<usize>(kind));
+  if (*prog == 0) {
+    const GLchar* fragment_shader = nullptr;
+    switch (kind) {
+      case image_kind::still:
+        fragment_shader = still_fragment_shader;
+        break;
+      case image_kind::planar:
+        fragment_shader = ycbcr_fragment_shader;
+        break;
+      case image_kind::animated:
+        fragment_shader = animated_fragment_shader;
+        break;
+      case image_kind::indexed:
+        fragment_shader = indexed_fragment_shader;
+        break;
+    }
+
+    prog = create_program(w, image_vertex_shader, fragment_shader);
+  }
+
+  return *prog;
+}
+
+auto bind_image(const GladGLContext& gl, const gpu_image& image, usize frame)
+    -> void
+{
+  const auto& textures = *image.textures;
+  switch (image.kind) {
+    case image_kind::still:
+    case image_kind::planar:
+      for (usize i = 0; i < textures.planes.size(); ++i) {
+        if (*textures.planes.at(i) != 0) {
+          gl.ActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+          gl.BindTexture(GL_TEXTURE_2D, *textures.planes.at(i));
+        }
+      }
+      break;
+    case image_kind::indexed:
+      gl.ActiveTexture(GL_TEXTURE1);
+      gl.BindTexture(GL_TEXTURE_2D, *textures.frames.palettes);
+      gl.Uniform1i(1, textures.frames.frame_palettes.at(frame));
+      [[fallthrough]];
+    case image_kind::animated: {
+      const auto [page, layer] = textures.frames.locate(frame);
+      gl.ActiveTexture(GL_TEXTURE0);
+      gl.BindTexture(GL_TEXTURE_2D_ARRAY, page);
+      gl.Uniform1f(0, static_cast<GLfloat>(layer));
+      break;
+    }
+  }
+}
+
+auto set_image_view(const GladGLContext& gl,
+                    const pixel_rect& rect,
+                    int width,
+                    int height) -> void
+{
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  const auto w = static_cast<double>(width);
+  const auto h = static_cast<double>(height);
+  gl.Uniform4f(6,
+               static_cast<GLfloat>(rect.width / w),
+               static_cast<GLfloat>(rect.height / h),
+               static_cast<GLfloat>((2.0 * rect.x + rect.width) / w - 1.0),
+               static_cast<GLfloat>((2.0 * rect.y + rect.height) / h - 1.0));
+}
+
+auto draw_image(const GladGLContext& gl,
+                GLuint program,
+                const gpu_image& image,
+                usize frame) -> void
+{
+  gl.UseProgram(program);
+  bind_image(gl, image, frame);
+  gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+auto select_frame(const frame_delays& delays, const state_clock& clock)
+    -> tuple<usize, double>
+{
+  const auto duration = delays.back();
+  // frame i covers [delays[i - 1], delays[i]), if every frame has a zero
+  // delay there is nothing to animate and the last frame is shown
+  const auto time =
+      loop_position(clock.now(), std::max(duration, chr::nanoseconds {1}));
+  auto itr = std::upper_bound(delays.begin(), delays.end(), time);
+  auto frame = std::distance(delays.begin(), itr);
+  assert(frame >= 0);
+  auto u_frame = std::min(static_cast<usize>(frame), delays.size() - 1);
+
+  if (duration <= chr::nanoseconds::zero()) {
+    return {u_frame, std::numeric_limits<double>::infinity()};
+  }
+
+  // time until next frame, which is the start of the current frame when
+  // playing backwards
+  if (clock.speed().reversed()) {
+    const auto frame_start =
+        itr == delays.begin() ? chr::nanoseconds {0} : *std::prev(itr);
+    return {u_frame,
+            clock.rescale(time - frame_start + chr::nanoseconds {1})};
+  }
+
+  return {u_frame, clock.rescale(*itr - time)};
+}
+
+image_window::image_window(context* c, decoded_image image)
+    : window {c}
+    , m_vao {gl_vertex_array::create(this)}
+    , m_navigator {c, id(), image.path()}
+{
+  make_context_current();
+  m_image = c->textures().upload(this, move(image));
+  present_image();
+  report_memory();
+}
+
+image_window::image_window(context* c, gpu_image image)
+    : window {c}
+    , m_vao {gl_vertex_array::create(this)}
+    , m_image {move(image)}
+    , m_navigator {c, id(), m_image.title}
+{
+  present_image();
+  report_memory();
+}
+
+auto image_window::handle_event(event& e) -> void
+{
+  visit(overloaded {
+            [this](const play_pause_event& ev)
+            { m_clock.update_play_pause(ev); },
+            [this](const speed_event& ev) { m_clock.update_speed(ev); },
+            [this](const seek_event& ev) { m_clock.update_seek(ev); },
+            [this](const navigate_event& ev)
+            {
+              if (m_navigator.navigate(this, ev.offset, m_image)) {
+                m_restore = {};
+                present_image();
+              }
+              report_memory();
+            },
+            [this](const prefetch_event&)
+            {
+              finish_restore();
+              m_navigator.prefetch(this);
+              report_memory();
+            },
+            [](const auto&) {},
+        },
+        e);
+}
+
+auto image_window::render() -> double
+{
+  // the budget evicts hidden windows first, reloading the image or stepping
+  // the animation would only get it evicted again, restoring the window
+  // invalidates it
+  if (hidden()) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  auto wait_time = window::render();
+  if (is_animation(m_image.kind)) {
+    wait_time = std::min(wait_time, update_frame());
+  }
+
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(m_window_handle.get(), &width, &height);
+  int window_width = 0, window_height = 0;
+  glfwGetWindowSize(m_window_handle.get(), &window_width, &window_height);
+  if (m_view.update(width, height, window_width, window_height)) {
+    m_redraw = true;
+  }
+  if (m_image.resident()
+      && m_image.textures->upload_wait_time()
+          < std::numeric_limits<double>::infinity())
+  {
+    // drawn from the finest level uploaded so far, and uncompressed, until
+    // the upload ends
+    make_context_current();
+    if (m_image.textures->continue_upload(m_gl)) {
+      m_redraw = true;
+      m_image.byte_size = m_image.textures->byte_size;
+      report_memory();
+    }
+    wait_time = std::min(wait_time, m_image.textures->upload_wait_time());
+  }
+
+  if (!m_redraw) {
+    return wait_time;
+  }
+
+  if (!m_image.resident()) {
+    if (auto shared = m_context->textures().find(m_image.title);
+        shared.has_value())
+    {
+      // another window shows it, nothing to reload
+      m_image = move(*shared);
+      m_restore = {};
+      report_memory();
+      if (is_animation(m_image.kind)) {
+        m_current_frame = std::numeric_limits<usize>::max();
+        wait_time = std::min(wait_time, update_frame());
+      }
+    } else {
+      // drawn once the reload finishes
+      if (!m_restore.valid()) {
+        m_restore = decode_async(m_context, id(), m_image.title);
+      }
+      return wait_time;
+    }
+  }
+
+  m_redraw = false;
+  make_context_current();
+  const auto target = framebuffer();
+
+  begin_render_timing();
+  m_gl.BindVertexArray(*m_vao);
+  m_scaler.draw(this,
+                m_gl,
+                m_programs,
+                m_image,
+                m_current_frame,
+                target,
+                width,
+                height,
+                m_view.place(m_image.width, m_image.height, width, height));
+  end_render_timing();
+  swap_buffers();
+  if (std::exchange(m_first_present, false)) {
+    trace_instant("first present");
+  }
+
+  return wait_time;
+}
+
+auto image_window::release_memory(memory_kind kind) -> void
+{
+  switch (kind) {
+    case memory_kind::cache:
+      m_navigator.clear_cache();
+      break;
+    case memory_kind::image:
+      if (m_image.resident()) {
+        // only what is needed to show the window and reload the image stays
+        gpu_image released;
+        released.kind = m_image.kind;
+        released.width = m_image.width;
+        released.height = m_image.height;
+        released.title = move(m_image.title);
+        released.delays = move(m_image.delays);
+        m_image = move(released);
+        m_scaler.release();
+      }
+      break;
+  }
+
+  report_memory();
+}
+
+auto image_window::stats() -> window_stats
+{
+  window_stats result;
+  result.texture_bytes = m_image.byte_size + m_scaler.byte_size();
+  result.decode_time = m_image.decode_time;
+  result.filter = scale_filter_name(m_scaler.filter());
+  result.zoom = m_view.scale();
+  result.upload_time = m_image.upload_time;
+  if (is_animation(m_image.kind)
+      && m_current_frame < m_image.delays->size())
+  {
+    result.frame = {m_current_frame, m_image.delays->size()};
+  }
+
+  return result;
+}
+
+auto image_window::on_key(int key, int mods) -> bool
+{
+  if (key == GLFW_KEY_0 && mods == 0) {
+    m_view.reset();
+    request_render();
+    return true;
+  }
+  if (key != GLFW_KEY_S || mods != 0) {
+    return false;
+  }
+
+  make_context_current();
+  m_scaler.set_filter(next_scale_filter(m_scaler.filter()));
+  invalidate();
+  report_memory();
+  return true;
+}
+
+auto image_window::on_mouse_button(int button, int action, int /*mods*/)
+    -> bool
+{
+  if (button != GLFW_MOUSE_BUTTON_LEFT) {
+    return false;
+  }
+  if (action == GLFW_RELEASE && m_panning) {
+    m_panning = false;
+    return true;
+  }
+  // the window is moved instead while the image fits it
+  if (action != GLFW_PRESS || !m_view.transformed()) {
+    return false;
+  }
+
+  m_panning = true;
+  glfwGetCursorPos(m_window_handle.get(), &m_pan_x, &m_pan_y);
+  return true;
+}
+
+auto image_window::on_cursor_move(double x, double y) -> bool
+{
+  if (!m_panning) {
+    return false;
+  }
+
+  m_view.pan(x - m_pan_x, y - m_pan_y);
+  m_pan_x = x;
+  m_pan_y = y;
+  request_render();
+  return true;
+}
+
+auto image_window::on_scroll(double /*dx*/, double dy) -> bool
+{
+  double x = 0.0, y = 0.0;
+  glfwGetCursorPos(m_window_handle.get(), &x, &y);
+  m_view.zoom(dy, x, y);
+  request_render();
+  return true;
+}
+
+auto image_window::present_image() -> void
+{
+  m_view.reset();
+  m_panning = false;
+  m_clock = state_clock {};
+  m_current_frame = std::numeric_limits<usize>::max();
+  m_redraw = true;
+  m_first_present = true;
+  show_window(m_image.width, m_image.height, m_image.title.c_str());
+}
+
+auto image_window::finish_restore() -> void
+{
+  if (!m_restore.valid()
+      || m_restore.wait_for(std::chrono::seconds {0})
+          != std::future_status::ready)
+  {
+    return;
+  }
+
+  if (hidden()) {
+    // decoded again once the window is restored
+    m_restore = {};
+    return;
+  }
+
+  auto decoded = wait_decode(m_restore);
+  if (!decoded.has_value()) {
+    fmt::print("warn: unable to reload '{}'\n", m_image.title);
+    return;
+  }
+
+  try {
+    auto image = m_context->textures().upload(this, move(*decoded));
+    m_image = move(image);
+    m_current_frame = std::numeric_limits<usize>::max();
+    m_redraw = true;
+  } catch (std::exception& ex) {
+    fmt::print("warn: unable to reload '{}'\n", m_image.title);
+    dump_exception(ex);
+  }
+}
+
+auto image_window::report_memory() -> void
+{
+  memory_usage usage {m_image.byte_size + m_scaler.byte_size(),
+                      m_navigator.cache().size(),
+                      is_animation(m_image.kind)};
+  usage.share(m_image.textures.get(), m_image.byte_size);
+  m_navigator.cache().for_each(
+      [&usage](const gpu_image& image)
+      { usage.share(image.textures.get(), image.byte_size); });
+  m_context->budget().report(id(), usage);
+}
+
+auto image_window::update_frame() -> double
+{
+  const auto [frame, wait_time] = select_frame(*m_image.delays, m_clock);
+  if (frame != m_current_frame) {
+    m_current_frame = frame;
+    m_redraw = true;
+  }
+
+  return wait_time;
+}
+
+}  // namespace imgv
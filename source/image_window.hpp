@@ -0,0 +1,114 @@
+#pragma once
+
+#include <future>
+#include <limits>
+
+#include "clock.hpp"
+#include "gl_wrapper.hpp"
+#include "image.hpp"
+#include "image_view.hpp"
+#include "navigator.hpp"
+#include "scaler.hpp"
+
+namespace imgv
+{
+
+extern const GLchar* const image_vertex_shader;
+extern const GLchar* const still_fragment_shader;
+extern const GLchar* const ycbcr_fragment_shader;
+extern const GLchar* const animated_fragment_shader;
+extern const GLchar* const indexed_fragment_shader;
+
+// the shader program of each image_kind, compiled the first time an image of
+// that kind is drawn
+class image_programs
+{
+public:
+  auto get(window* w, image_kind kind) -> GLuint;
+
+private:
+  array<gl_program, image_kind_count> m_programs;
+};
+
+// bind the textures of a frame of image and set its layer and palette
+// uniforms, for the program in use
+auto bind_image(const GladGLContext& gl, const gpu_image& image, usize frame)
+    -> void;
+
+// place the quad drawn by the program in use over rect, in a viewport of
+// width x height pixels
+auto set_image_view(const GladGLContext& gl,
+                    const pixel_rect& rect,
+                    int width,
+                    int height) -> void;
+
+// draw a frame of image over the viewport, with the vertex array of the
+// window bound
+auto draw_image(const GladGLContext& gl,
+                GLuint program,
+                const gpu_image& image,
+                usize frame) -> void;
+
+// the frame of an animation shown at the time of clock, and the wall clock
+// time in seconds until the next one, infinity if nothing is animated
+auto select_frame(const frame_delays& delays, const state_clock& clock)
+    -> tuple<usize, double>;
+
+// shows a still image or an animation, and any other image of its directory
+// when navigating, without recreating the window or its GL objects
+class image_window : public window
+{
+public:
+  image_window(context* c, decoded_image image);
+  // with the textures of an image shown by another window
+  image_window(context* c, gpu_image image);
+  ~image_window() override = default;
+
+  image_window(const image_window&) = delete;
+  image_window(image_window&&) = delete;
+
+  auto operator=(const image_window&) = delete;
+  auto operator=(image_window&&) = delete;
+
+  auto handle_event(event& e) -> void override;
+  auto render() -> double override;
+  auto release_memory(memory_kind kind) -> void override;
+  auto stats() -> window_stats override;
+
+protected:
+  auto on_key(int key, int mods) -> bool override;
+  auto on_mouse_button(int button, int action, int mods) -> bool override;
+  auto on_cursor_move(double x, double y) -> bool override;
+  auto on_scroll(double dx, double dy) -> bool override;
+
+private:
+  gl_vertex_array m_vao;
+  image_programs m_programs;
+  // resamples m_image to the window size, S cycles its filter
+  image_scaler m_scaler;
+  // the wheel zooms at the cursor, dragging pans once zoomed and 0 resets
+  image_view m_view;
+  bool m_panning {false};
+  // cursor position of the last pan, in window coordinates
+  double m_pan_x {0.0}, m_pan_y {0.0};
+  gpu_image m_image;
+  // the next swap is the first one showing m_image
+  bool m_first_present {false};
+  // reload of m_image after its textures were released
+  std::future<optional<decoded_image>> m_restore;
+
+  // animations only
+  state_clock m_clock;
+  usize m_current_frame {std::numeric_limits<usize>::max()};
+
+  directory_navigator m_navigator;
+
+  // start showing m_image from its first frame
+  auto present_image() -> void;
+  // select the frame to show, returns the time until the next one
+  auto update_frame() -> double;
+  // upload m_image again if its reload has finished
+  auto finish_restore() -> void;
+  auto report_memory() -> void;
+};
+}  // namespace imgv
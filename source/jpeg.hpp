@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+#include "texture_load_common.hpp"
+#include "texture_stream.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+
+// one component of a JPEG at its native (subsampled) resolution
+struct jpeg_plane
+{
+  vector<u8> data;
+  // size of the plane and row length of data, which is padded to whole blocks
+  int width = 0, height = 0, stride = 0;
+  // levels 1 and up of the planes of large images, which are streamed
+  vector<mip_level> tail;
+};
+
+struct jpeg_error_handler
+{
+  jpeg_error_mgr manager;
+  std::jmp_buf jump;
+  char* message;
+
+  // libjpeg reports fatal errors by calling error_exit, which must not
+  // return, so this jumps back to the setjmp of the decoding function.
+  // everything such a function keeps on its stack must be trivially
+  // destructible
+  [[noreturn]] static auto on_error(j_common_ptr info) -> void
+  {
+    // manager is the first member of jpeg_error_handler
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto* handler = reinterpret_cast<jpeg_error_handler*>(info->err);
+    (*info->err->format_message)(info, handler->message);
+    std::longjmp(handler->jump, 1);  // NOLINT(cert-err52-cpp)
+  }
+};
+
+// decodes baseline/progressive YCbCr JPEGs into their raw Y, Cb and Cr planes,
+// skipping libjpeg's upsampling and color conversion, the planes are uploaded
+// as separate single channel textures and converted by the fragment shader
+//
+// grayscale, CMYK and RGB-encoded files are rejected and left to stbi_loader
+struct jpeg_loader
+{
+  static constexpr usize num_planes = 3;
+
+  image_metadata metadata;
+  std::array<jpeg_plane, num_planes> planes;
+
+  // contents is the whole file at path
+  jpeg_loader(const char* path, const vector<u8>& contents)
+      : metadata {false, 0, 0, path}
+  {
+    std::array<char, JMSG_LENGTH_MAX> message {};
+    const trace_span span {"decode planes"};
+    if (!decode(contents, message.data())) {
+      IMGV_ERROR(fmt::format("unable to decode jpeg file: {}", message.data()));
+    }
+
+    if (should_stream(metadata.width, metadata.height)) {
+      for (auto& plane : planes) {
+        plane.tail = build_mip_tail(plane.data.data(),
+                                    plane.width,
+                                    plane.height,
+                                    static_cast<usize>(plane.stride),
+                                    1);
+      }
+    }
+  }
+
+  // returns the Y, Cb and Cr textures, in that order, the planes of large
+  // images are only allocated, and queued on the stream of uploader
+  auto operator()(window* w, texture_uploader& uploader)
+      -> std::array<gl_texture, num_planes>
+  {
+    return w->use_gl(
+        [&, this](const GladGLContext& gl)
+        {
+          std::array<gl_texture, num_planes> textures;
+          usize orig_size = 0, compressed_size = 0;
+          const auto streamed = !planes.front().tail.empty();
+          for (usize i = 0; i < num_planes; ++i) {
+            auto& plane = planes.at(i);
+            textures.at(i) = gl_texture::create(w);
+            gl.BindTexture(GL_TEXTURE_2D, *textures.at(i));
+            const auto data = std::make_shared<vector<u8>>(move(plane.data));
+            uploader.upload(gl,
+                            i,
+                            *textures.at(i),
+                            GL_COMPRESSED_RED_RGTC1,
+                            GL_RED,
+                            {shared_ptr<const u8> {data, data->data()},
+                             plane.width,
+                             plane.height,
+                             static_cast<usize>(plane.stride),
+                             1,
+                             move(plane.tail)});
+            if (i > 0) {
+              // chroma is upsampled by the sampler
+              gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            }
+
+            orig_size += static_cast<usize>(plane.width)
+                * static_cast<usize>(plane.height);
+            if (!streamed && !uploader.deferred()) {
+              compressed_size += texture_compressed_size(gl, GL_TEXTURE_2D);
+            }
+          }
+
+          if (!streamed && !uploader.deferred()) {
+            fmt::print("texture compress memory usage: {} -> {}\n",
+                       orig_size,
+                       compressed_size);
+          }
+          return textures;
+        });
+  }
+
+private:
+  auto decode(const vector<u8>& contents, char* message) -> bool
+  {
+    jpeg_decompress_struct info {};
+    jpeg_error_handler handler {};
+    handler.message = message;
+    info.err = jpeg_std_error(&handler.manager);
+    handler.manager.error_exit = jpeg_error_handler::on_error;
+    jpeg_create_decompress(&info);
+
+    if (setjmp(handler.jump)) {  // NOLINT(cert-err52-cpp)
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    jpeg_mem_src(&info, contents.data(), contents.size());
+    jpeg_read_header(&info, TRUE);
+    if (info.jpeg_color_space != JCS_YCbCr
+        || info.num_components != static_cast<int>(num_planes))
+    {
+      std::snprintf(message, JMSG_LENGTH_MAX, "not a YCbCr image");
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+
+    info.raw_data_out = TRUE;
+    info.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&info);
+
+    metadata.width = static_cast<int>(info.output_width);
+    metadata.height = static_cast<int>(info.output_height);
+
+    // every call of jpeg_read_raw_data produces one iMCU row, which is
+    // v_samp_factor blocks tall for each component
+    constexpr int max_samp_factor = 4;
+    std::array<std::array<JSAMPROW, max_samp_factor * DCTSIZE>, num_planes>
+        rows {};
+    std::array<JSAMPARRAY, num_planes> image {};
+    for (usize i = 0; i < num_planes; ++i) {
+      const auto& comp = info.comp_info[i];
+      auto& plane = planes.at(i);
+      plane.width = static_cast<int>(comp.downsampled_width);
+      plane.height = static_cast<int>(comp.downsampled_height);
+      plane.stride = static_cast<int>(comp.width_in_blocks) * DCTSIZE;
+      plane.data.resize(static_cast<usize>(plane.stride)
+                        * static_cast<usize>(comp.v_samp_factor * DCTSIZE)
+                        * info.total_iMCU_rows);
+      image.at(i) = rows.at(i).data();
+    }
+
+    const auto lines_per_call = info.max_v_samp_factor * DCTSIZE;
+    for (JDIMENSION row = 0; row < info.total_iMCU_rows; ++row) {
+      for (usize i = 0; i < num_planes; ++i) {
+        const auto& comp = info.comp_info[i];
+        auto& plane = planes.at(i);
+        const auto lines = static_cast<usize>(comp.v_samp_factor * DCTSIZE);
+        for (usize line = 0; line < lines; ++line) {
+          rows.at(i).at(line) = &plane.data.at(
+              (row * lines + line) * static_cast<usize>(plane.stride));
+        }
+      }
+
+      jpeg_read_raw_data(
+          &info, image.data(), static_cast<JDIMENSION>(lines_per_call));
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+  }
+};
+
+// decode a whole JPEG file to RGB at the smallest DCT scale (1/8 to 1/1) that
+// keeps the longest side at least min_size pixels long, for thumbnails
+// libjpeg skips most of the work for the discarded resolution
+inline auto decode_jpeg_scaled(const vector<u8>& contents,
+                               unsigned min_size,
+                               int& width,
+                               int& height,
+                               vector<u8>& pixels) -> bool
+{
+  jpeg_decompress_struct info {};
+  std::array<char, JMSG_LENGTH_MAX> message {};
+  jpeg_error_handler handler {};
+  handler.message = message.data();
+  info.err = jpeg_std_error(&handler.manager);
+  handler.manager.error_exit = jpeg_error_handler::on_error;
+  jpeg_create_decompress(&info);
+
+  if (setjmp(handler.jump)) {  // NOLINT(cert-err52-cpp)
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+
+  jpeg_mem_src(&info, contents.data(), contents.size());
+  jpeg_read_header(&info, TRUE);
+  info.out_color_space = JCS_RGB;
+  info.dct_method = JDCT_IFAST;
+  info.do_fancy_upsampling = FALSE;
+  const auto longest = std::max(info.image_width, info.image_height);
+  info.scale_num = 1;
+  info.scale_denom = 1;
+  for (unsigned denom = 8; denom > 1; denom /= 2) {
+    if (longest / denom >= min_size) {
+      info.scale_denom = denom;
+      break;
+    }
+  }
+
+  jpeg_start_decompress(&info);
+  if (info.output_components != 3) {
+    jpeg_destroy_decompress(&info);
+    return false;
+  }
+
+  width = static_cast<int>(info.output_width);
+  height = static_cast<int>(info.output_height);
+  const auto stride = static_cast<usize>(info.output_width) * 3;
+  pixels.resize(stride * info.output_height);
+  while (info.output_scanline < info.output_height) {
+    JSAMPROW row = &pixels.at(info.output_scanline * stride);
+    jpeg_read_scanlines(&info, &row, 1);
+  }
+
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+  return true;
+}
+
+}  // namespace imgv
@@ -1,6 +1,10 @@
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 
 #include "context.hpp"
+#include "root_window.hpp"
+#include "trace.hpp"
 #include "types.hpp"
 
 auto main(int argc, const char* argv[]) -> int
@@ -10,14 +14,35 @@ auto main(int argc, const char* argv[]) -> int
   args.reserve(argc <= 0 ? 0 : static_cast<std::size_t>(argc - 1));
   for (int i = 1; i < argc; ++i) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-    args.push_back(argv[i]);
+    const auto* arg = argv[i];
+    // the backend must be known before the first window (and GLFW) is
+    // created, so it is not left to context
+    if (std::strcmp(arg, "--headless") == 0
+        || std::strcmp(arg, "--headless=egl") == 0)
+    {
+      set_gl_backend(gl_backend::egl);
+    } else if (std::strcmp(arg, "--headless=osmesa") == 0) {
+      set_gl_backend(gl_backend::osmesa);
+    } else {
+      args.push_back(arg);
+    }
   }
 
+  // NOLINTNEXTLINE(concurrency-mt-unsafe)
+  if (const auto* trace_path = std::getenv("IMGV_TRACE"); trace_path != nullptr)
+  {
+    start_tracing(trace_path);
+  }
+  set_trace_thread_name("main");
+
   bool run = true;
-  context c {args, run};
-  if (run) {
-    c.run();
+  {
+    context c {args, run};
+    if (run) {
+      c.run();
+    }
   }
 
+  write_trace();
   return 0;
 }
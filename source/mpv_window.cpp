@@ -7,6 +7,7 @@
 #include <mpv/render.h>
 #include <mpv/render_gl.h>
 
+#include "stats.hpp"
 #include "types.hpp"
 
 namespace imgv
@@ -14,6 +15,7 @@ namespace imgv
 enum class reply_data : int
 {
   video_out_params,
+  frame_drop_count,
 };
 
 mpv_window::mpv_window(context* c, const char* path)
@@ -62,9 +64,8 @@ mpv_window::mpv_window(context* c, const char* path)
       m_render.get(),
       [](void* ptr)
       {
-        glfwPostEmptyEvent();
         auto& self = *reinterpret_cast<mpv_window*>(ptr);
-        self.push_event(mpv_render_update_event {{self.weak_from_this()}});
+        self.push_event(mpv_render_update_event {{self.id()}});
       },
       this);
 
@@ -85,9 +86,23 @@ mpv_window::mpv_window(context* c, const char* path)
   {
     IMGV_ERROR("unable to observe video-out-params properties");
   }
+  if (mpv_observe_property(m_mpv.get(),
+                           static_cast<int>(reply_data::frame_drop_count),
+                           "frame-drop-count",
+                           MPV_FORMAT_INT64)
+      < 0)
+  {
+    IMGV_ERROR("unable to observe frame-drop-count property");
+  }
 
   mpv_set_wakeup_callback(
-      m_mpv.get(), [](void*) { glfwPostEmptyEvent(); }, nullptr);
+      m_mpv.get(),
+      [](void* ptr)
+      {
+        auto& self = *reinterpret_cast<mpv_window*>(ptr);
+        self.push_event(mpv_wakeup_event {{self.id()}});
+      },
+      this);
   mpv_window::handle_mpv_events();
 }
 
@@ -114,7 +129,14 @@ auto mpv_window::handle_mpv_events() -> void
         continue;
       }
       switch (e->reply_userdata) {
-        case static_cast<int>(reply_data::video_out_params):
+        case static_cast<int>(reply_data::frame_drop_count):
+          m_dropped_frames = *reinterpret_cast<i64*>(property.data);
+          if (m_counters != nullptr) {
+            m_counters->dropped_frames.store(m_dropped_frames,
+                                             std::memory_order_relaxed);
+          }
+          break;
+        case static_cast<int>(reply_data::video_out_params): {
           auto& node = *reinterpret_cast<mpv_node*>(property.data);
           assert(node.format == MPV_FORMAT_NODE_MAP);
           auto& list = *node.u.list;
@@ -129,6 +151,7 @@ auto mpv_window::handle_mpv_events() -> void
           }
           try_show();
           break;
+        }
       }
     }
   }
@@ -163,6 +186,7 @@ auto mpv_window::handle_event(event& e) -> void
                         m_redraw = true;
                       }
                     },
+                    [this](mpv_wakeup_event&) { handle_mpv_events(); },
                     [&](play_pause_event& ev)
                     {
                       switch (ev.mode) {
@@ -202,15 +226,22 @@ auto mpv_window::handle_event(event& e) -> void
         e);
 }
 
+auto mpv_window::stats() -> window_stats
+{
+  window_stats result;
+  // textures are owned by mpv, which does not report them
+  result.dropped_frames = m_dropped_frames;
+  return result;
+}
+
 auto mpv_window::render() -> double
 {
-  window::render();
+  const auto wait_time = window::render();
   handle_mpv_events();
   if (!m_redraw) {
-    // mpv_set_wakeup_callback will wake the loop up,
-    // so one can use the default timeout (or even wait
-    // forever)
-    return window::render();
+    // the wakeup callback queues an mpv_wakeup_event, which schedules this
+    // window, so there is no need to poll
+    return wait_time;
   }
 
   m_redraw = false;
@@ -220,15 +251,18 @@ auto mpv_window::render() -> double
   glfwGetFramebufferSize(m_window_handle.get(), &width, &height);
   m_gl.Viewport(0, 0, width, height);
 
-  mpv_opengl_fbo fbo {0, width, height, 0};
-  int i_true = 1;
+  mpv_opengl_fbo fbo {static_cast<int>(framebuffer()), width, height, 0};
+  // only the default framebuffer is upside down
+  int flip_y = fbo.fbo == 0 ? 1 : 0;
   mpv_render_param params[] = {{MPV_RENDER_PARAM_OPENGL_FBO, &fbo},
-                               {MPV_RENDER_PARAM_FLIP_Y, &i_true},
+                               {MPV_RENDER_PARAM_FLIP_Y, &flip_y},
                                {MPV_RENDER_PARAM_INVALID, nullptr}};
+  begin_render_timing();
   mpv_render_context_render(m_render.get(), params);
+  end_render_timing();
   swap_buffers();
-  // vsync
-  return -1;
+  // the next frame is announced by the render update callback
+  return wait_time;
 }
 
 }  // namespace imgv
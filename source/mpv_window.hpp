@@ -35,11 +35,14 @@ public:
 
   auto handle_event(event& e) -> void override;
   auto render() -> double override;
+  auto stats() -> window_stats override;
 
 private:
   unique_ptr<mpv_handle, mpv_handle_deleter> m_mpv;
   unique_ptr<mpv_render_context, mpv_render_context_deleter> m_render;
   i32 m_width = 0, m_height = 0;
+  // observed, as reading it synchronously would wait for mpv
+  i64 m_dropped_frames = 0;
 
   auto try_show() -> void;
   auto handle_mpv_events() -> void;
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#include "navigator.hpp"
+
+#include <fmt/core.h>
+
+#include "context.hpp"
+
+namespace imgv
+{
+namespace fs = std::filesystem;
+
+auto decode_async(context* c, optional<window_id> owner, vector<string> paths)
+    -> vector<pending_decode>
+{
+  using promise = std::promise<optional<decoded_image>>;
+  std::unordered_map<string, shared_ptr<promise>> promises;
+  vector<pending_decode> futures;
+  futures.reserve(paths.size());
+  for (const auto& path : paths) {
+    auto result = std::make_shared<promise>();
+    futures.push_back(result->get_future());
+    promises.emplace(path, move(result));
+  }
+
+  c->reader().read(
+      move(paths),
+      [c, owner, promises = move(promises)](const string& path,
+                                            optional<vector<u8>> contents)
+      {
+        c->workers().post(
+            [c,
+             owner,
+             path,
+             result = promises.at(path),
+             contents = move(contents)]() mutable
+            {
+              try {
+                result->set_value(
+                    contents.has_value()
+                        ? decode_image(path, move(*contents), &c->workers())
+                        : nullopt);
+              } catch (...) {
+                result->set_exception(std::current_exception());
+              }
+
+              if (owner.has_value()) {
+                // wakes up the owner to upload the image
+                c->push_event(prefetch_event {{*owner}});
+              }
+            });
+      });
+  return futures;
+}
+
+auto decode_async(context* c, window_id owner, string path) -> pending_decode
+{
+  return move(decode_async(c, owner, vector<string> {move(path)}).front());
+}
+
+auto wait_decode(pending_decode& decode) -> optional<decoded_image>
+{
+  try {
+    return decode.get();
+  } catch (std::exception& ex) {
+    dump_exception(ex);
+    return nullopt;
+  }
+}
+
+directory_navigator::directory_navigator(context* c,
+                                         window_id owner,
+                                         string path)
+    : m_context {c}
+    , m_owner {owner}
+    , m_path {move(path)}
+{
+}
+
+auto directory_navigator::navigate(window* w, int offset, gpu_image& current)
+    -> bool
+{
+  if (!update_index() || m_index->size() < 2 || offset == 0) {
+    return false;
+  }
+
+  // after the first candidate, undecodable files are skipped one at a time
+  const auto direction = offset < 0 ? -1 : 1;
+  auto index = neighbor(m_current, offset);
+  for (usize tries = 1; tries < m_index->size(); ++tries) {
+    if (index != m_current && m_index->kind(index) != file_kind::other) {
+      if (auto image = load(w, index); image.has_value()) {
+        if (current.resident()) {
+          m_cache.put(m_path, move(current));
+        }
+        current = move(*image);
+        m_current = index;
+        m_path = m_index->path(index);
+        prefetch(w);
+        return true;
+      }
+    }
+
+    index = neighbor(index, direction);
+  }
+
+  return false;
+}
+
+auto directory_navigator::prefetch(window* w) -> void
+{
+  if (!m_index || !update_index() || m_index->empty()) {
+    return;
+  }
+
+  for (auto it = m_pending.begin(); it != m_pending.end();) {
+    if (it->second.wait_for(std::chrono::seconds {0})
+        != std::future_status::ready)
+    {
+      ++it;
+      continue;
+    }
+
+    const auto path = it->first;
+    auto decode = move(it->second);
+    it = m_pending.erase(it);
+
+    // the user may have moved on while the image was decoding
+    if (const auto index = position(path);
+        !index.has_value() || !is_neighbor(*index))
+    {
+      continue;
+    }
+
+    if (auto image = upload(w, path, wait_decode(decode)); image.has_value())
+    {
+      m_cache.put(path, move(*image));
+    }
+  }
+
+  // the missing neighbors are read together, nearest first
+  vector<string> missing;
+  for (usize distance = 1; distance <= prefetch_distance; ++distance) {
+    for (const auto direction : {1, -1}) {
+      const auto index =
+          neighbor(m_current, direction * static_cast<int>(distance));
+      if (index == m_current || m_index->kind(index) == file_kind::other) {
+        continue;
+      }
+
+      auto path = m_index->path(index);
+      if (m_cache.contains(path) || m_pending.count(path) != 0
+          || m_failed.count(path) != 0
+          || std::find(missing.begin(), missing.end(), path) != missing.end())
+      {
+        continue;
+      }
+
+      if (auto shared = m_context->textures().find(path); shared.has_value())
+      {
+        m_cache.put(move(path), move(*shared));
+        continue;
+      }
+
+      missing.push_back(move(path));
+    }
+  }
+
+  if (missing.empty()) {
+    return;
+  }
+
+  auto decodes = decode_async(m_context, m_owner, missing);
+  for (usize i = 0; i < missing.size(); ++i) {
+    m_pending.emplace(move(missing[i]), move(decodes[i]));
+  }
+}
+
+auto directory_navigator::clear_cache() -> void
+{
+  m_cache = image_cache {};
+}
+
+auto directory_navigator::update_index() -> bool
+{
+  if (!m_index) {
+    try {
+      m_index = m_context->directories().get(
+          fs::path {m_path}.parent_path().string(), m_context->workers());
+    } catch (std::exception& ex) {
+      // navigation is a no-op
+      fmt::print("warn: unable to list the directory of '{}'\n", m_path);
+      dump_exception(ex);
+      return false;
+    }
+  }
+
+  // scanned indexes start at version 1
+  if (m_index->version() == m_index_version) {
+    return true;
+  }
+
+  m_index_version = m_index->version();
+  const auto name = fs::path {m_path}.filename().string();
+  if (const auto listed = m_index->find(name); listed.has_value()) {
+    m_current = *listed;
+    // the same spelling as the paths of the neighbors, for the cache
+    m_path = m_index->path(m_current);
+  } else {
+    // a removed image keeps its place, between its former neighbors
+    m_current = m_index->empty()
+        ? 0
+        : std::min(m_index->lower_bound(name), m_index->size() - 1);
+  }
+
+  return true;
+}
+
+auto directory_navigator::position(const string& path) const -> optional<usize>
+{
+  return m_index->find(fs::path {path}.filename().string());
+}
+
+auto directory_navigator::neighbor(usize index, int offset) const -> usize
+{
+  const auto size = static_cast<std::ptrdiff_t>(m_index->size());
+  auto result = (static_cast<std::ptrdiff_t>(index) + offset) % size;
+  if (result < 0) {
+    result += size;
+  }
+
+  return static_cast<usize>(result);
+}
+
+auto directory_navigator::is_neighbor(usize index) const -> bool
+{
+  const auto size = m_index->size();
+  if (index >= size) {
+    return false;
+  }
+
+  const auto forwards = (index + size - m_current) % size;
+  const auto backwards = (m_current + size - index) % size;
+  return std::min(forwards, backwards) <= prefetch_distance;
+}
+
+auto directory_navigator::load(window* w, usize index) -> optional<gpu_image>
+{
+  const auto path = m_index->path(index);
+  if (m_failed.count(path) != 0) {
+    return nullopt;
+  }
+
+  if (auto image = m_cache.take(path); image.has_value()) {
+    return image;
+  }
+
+  if (auto image = m_context->textures().find(path); image.has_value()) {
+    return image;
+  }
+
+  if (auto it = m_pending.find(path); it != m_pending.end()) {
+    // already being decoded, wait for it instead of decoding it twice
+    auto decode = move(it->second);
+    m_pending.erase(it);
+    return upload(w, path, wait_decode(decode));
+  }
+
+  return upload(w, path, decode_image(path, &m_context->workers()));
+}
+
+auto directory_navigator::upload(window* w,
+                                 const string& path,
+                                 optional<decoded_image> image)
+    -> optional<gpu_image>
+{
+  if (image.has_value()) {
+    try {
+      return m_context->textures().upload(w, move(*image));
+    } catch (std::exception& ex) {
+      fmt::print("warn: unable to upload '{}'\n", path);
+      dump_exception(ex);
+    }
+  }
+
+  m_failed.insert(path);
+  return nullopt;
+}
+}  // namespace imgv
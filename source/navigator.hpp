@@ -0,0 +1,82 @@
+#pragma once
+
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "directory_index.hpp"
+#include "events.hpp"
+#include "image.hpp"
+#include "image_cache.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+
+class context;
+
+using pending_decode = std::future<optional<decoded_image>>;
+
+// read paths (which must be distinct) in one batch with the file reader of c,
+// then decode each file on the workers of c as soon as it is read, owner (if
+// any) receives a prefetch_event whenever a result is ready
+auto decode_async(context* c, optional<window_id> owner, vector<string> paths)
+    -> vector<pending_decode>;
+auto decode_async(context* c, window_id owner, string path) -> pending_decode;
+// result of decode_async, waiting for it if it is still running
+auto wait_decode(pending_decode& decode) -> optional<decoded_image>;
+
+// next/previous image navigation over the directory of a file
+//
+// once the user starts navigating, the neighbors of the current image are
+// decoded in the background and uploaded when the main thread is idle, so
+// that switching to them only swaps textures
+class directory_navigator
+{
+public:
+  // neighbors on each side of the current image kept ready
+  static constexpr usize prefetch_distance = 2;
+
+  directory_navigator(context* c, window_id owner, string path);
+
+  // swap current (the image at the current position) with the image offset
+  // files away, files that cannot be decoded are skipped
+  // returns false (leaving current untouched) if no other image was found
+  auto navigate(window* w, int offset, gpu_image& current) -> bool;
+
+  // upload the finished background decodes and start decoding the missing
+  // neighbors of the current image
+  auto prefetch(window* w) -> void;
+
+  auto cache() const -> const image_cache& { return m_cache; }
+  auto clear_cache() -> void;
+
+private:
+  context* m_context;
+  window_id m_owner;
+  // of the current image
+  string m_path;
+  // shared listing of the directory, taken on the first navigation
+  shared_ptr<const directory_index> m_index;
+  // position of the current image in m_index, as of m_index_version
+  usize m_current {0};
+  u64 m_index_version {0};
+  image_cache m_cache;
+  std::unordered_map<string, pending_decode> m_pending;
+  std::unordered_set<string> m_failed;
+
+  // take the index, or find the current image again after it changed,
+  // returns false if the directory cannot be listed
+  auto update_index() -> bool;
+  // position of path in the index, nullopt if it is not listed
+  auto position(const string& path) const -> optional<usize>;
+  auto neighbor(usize index, int offset) const -> usize;
+  auto is_neighbor(usize index) const -> bool;
+  // cached, pending or decoded on the spot, nullopt if undecodable
+  auto load(window* w, usize index) -> optional<gpu_image>;
+  // nullopt (and path is marked as undecodable) if there is no image or it
+  // cannot be uploaded
+  auto upload(window* w, const string& path, optional<decoded_image> image)
+      -> optional<gpu_image>;
+};
+}  // namespace imgv
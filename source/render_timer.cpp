@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <numeric>
+
+#include "render_timer.hpp"
+
+namespace imgv
+{
+namespace chr = std::chrono;
+
+auto timing_history::push(double milliseconds) -> void
+{
+  m_samples.at(m_next) = milliseconds;
+  m_next = (m_next + 1) % capacity;
+  m_count = std::min(m_count + 1, capacity);
+}
+
+auto timing_history::summary() const -> timing_summary
+{
+  if (m_count == 0) {
+    return {};
+  }
+
+  // the samples are in ring order, which does not matter here
+  array<double, capacity> sorted {};
+  const auto end = std::copy_n(m_samples.begin(), m_count, sorted.begin());
+  std::sort(sorted.begin(), end);
+  const auto p95 = std::min(m_count - 1, m_count * 95 / 100);
+  return {std::accumulate(sorted.begin(), end, 0.0)
+              / static_cast<double>(m_count),
+          sorted.at(p95),
+          sorted.at(m_count - 1)};
+}
+
+render_timer::render_timer(window* owner)
+{
+  for (auto& pair : m_queries) {
+    pair.start = gl_query::create(owner);
+    pair.end = gl_query::create(owner);
+  }
+}
+
+auto render_timer::begin(const GladGLContext& gl) -> void
+{
+  poll(gl);
+  m_start = chr::steady_clock::now();
+  const auto free = std::find(m_pending.begin(), m_pending.end(), false);
+  m_active = static_cast<usize>(std::distance(m_pending.begin(), free));
+  if (m_active < query_count) {
+    gl.QueryCounter(*m_queries.at(m_active).start, GL_TIMESTAMP);
+  }
+}
+
+auto render_timer::end(const GladGLContext& gl) -> void
+{
+  if (m_active < query_count) {
+    gl.QueryCounter(*m_queries.at(m_active).end, GL_TIMESTAMP);
+    m_pending.at(m_active) = true;
+  }
+
+  m_cpu.push(
+      chr::duration<double, std::milli> {chr::steady_clock::now() - m_start}
+          .count());
+}
+
+auto render_timer::poll(const GladGLContext& gl) -> void
+{
+  for (usize i = 0; i < query_count; ++i) {
+    if (!m_pending.at(i)) {
+      continue;
+    }
+
+    // the queries complete in order, the end one is the last to be available
+    const auto& pair = m_queries.at(i);
+    GLint available = GL_FALSE;
+    gl.GetQueryObjectiv(*pair.end, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available == GL_FALSE) {
+      continue;
+    }
+
+    GLuint64 start = 0, end = 0;
+    gl.GetQueryObjectui64v(*pair.start, GL_QUERY_RESULT, &start);
+    gl.GetQueryObjectui64v(*pair.end, GL_QUERY_RESULT, &end);
+    m_gpu.push(static_cast<double>(end - start) / 1e6);
+    m_pending.at(i) = false;
+  }
+}
+}  // namespace imgv
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+
+#include "gl_wrapper.hpp"
+
+namespace imgv
+{
+
+// recent samples of a duration, in milliseconds
+class timing_history
+{
+public:
+  static constexpr usize capacity = 120;
+
+  auto push(double milliseconds) -> void;
+  auto empty() const -> bool { return m_count == 0; }
+  auto summary() const -> timing_summary;
+
+private:
+  array<double, capacity> m_samples {};
+  usize m_next {0}, m_count {0};
+};
+
+// CPU and GPU time of the GL commands of a render
+//
+// the GPU time is measured between two GL_TIMESTAMP queries, rather than with
+// a GL_TIME_ELAPSED query which cannot be nested in those libmpv issues for
+// its own statistics, a pair is read back frames later when its results are
+// available so the CPU never waits for the GPU, if every pair is still pending
+// the GPU time of the render is not measured
+class render_timer
+{
+public:
+  // queries in flight, results usually arrive one or two frames late
+  static constexpr usize query_count = 3;
+
+  explicit render_timer(window* owner);
+
+  auto begin(const GladGLContext& gl) -> void;
+  auto end(const GladGLContext& gl) -> void;
+
+  auto cpu() const -> const timing_history& { return m_cpu; }
+  auto gpu() const -> const timing_history& { return m_gpu; }
+
+private:
+  // the timestamps before and after a render
+  struct query_pair
+  {
+    gl_query start, end;
+  };
+
+  array<query_pair, query_count> m_queries;
+  // the pair is waiting for its results
+  array<bool, query_count> m_pending {};
+  // the pair of the current render, query_count if it is not measured
+  usize m_active {query_count};
+  std::chrono::steady_clock::time_point m_start;
+  timing_history m_cpu, m_gpu;
+
+  // collect the results available so far
+  auto poll(const GladGLContext& gl) -> void;
+};
+}  // namespace imgv
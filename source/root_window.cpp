@@ -7,10 +7,42 @@
 namespace imgv
 {
 
+namespace
+{
+gl_backend current_backend = gl_backend::native;
+}  // namespace
+
+auto set_gl_backend(gl_backend backend) -> void
+{
+  current_backend = backend;
+}
+
+auto get_gl_backend() -> gl_backend
+{
+  return current_backend;
+}
+
+auto set_backend_window_hints() -> void
+{
+  // every context shares objects with the root window, so they must all be
+  // created by the same API
+  switch (current_backend) {
+    case gl_backend::native:
+      break;
+    case gl_backend::egl:
+      glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+      break;
+    case gl_backend::osmesa:
+      glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+      break;
+  }
+}
+
 root_window::root_window()
     : m_window {[]
                 {
                   glfwDefaultWindowHints();
+                  set_backend_window_hints();
                   glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
                   return glfwCreateWindow(window::default_size,
                                           window::default_size,
@@ -46,6 +78,16 @@ auto root_window::get() -> shared_ptr<root_window>
 
 glfw_context::glfw_context()
 {
+  if (headless()) {
+    // windows are only framebuffers, nothing is shown and no display server
+    // is needed
+#ifdef GLFW_PLATFORM_NULL
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+    IMGV_ERROR("headless rendering needs GLFW 3.4 or newer");
+#endif
+  }
+
   if (!glfwInit()) {
     IMGV_ERROR("unable to initialize GLFW");
   }
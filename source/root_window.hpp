@@ -9,6 +9,27 @@
 namespace imgv
 {
 
+// where the OpenGL contexts come from
+enum class gl_backend
+{
+  // the native window system through GLFW (GLX, EGL on Wayland, WGL...)
+  native,
+  // no display server: EGL contexts with GLFW's null platform
+  egl,
+  // no display server and no GPU: Mesa's software renderer
+  osmesa,
+};
+
+// must be called before the first window is created
+auto set_gl_backend(gl_backend backend) -> void;
+auto get_gl_backend() -> gl_backend;
+inline auto headless() -> bool
+{
+  return get_gl_backend() != gl_backend::native;
+}
+// set the context creation hints of the backend, after glfwDefaultWindowHints
+auto set_backend_window_hints() -> void;
+
 // NOLINTNEXTLINE(*-special-member-functions)
 class glfw_context
 {
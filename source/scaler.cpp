@@ -0,0 +1,565 @@
+#include <algorithm>
+#include <cmath>
+
+#include "scaler.hpp"
+
+#include "image_window.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+// samples per row of the weight texture, interpolated linearly
+constexpr usize weight_samples = 1024;
+
+constexpr double pi = 3.14159265358979323846;
+// first and third zeros of jinc
+constexpr double jinc_zero = 1.2196698912665045;
+constexpr double ewa_radius = 3.2383154841662362;
+// below this, sinc and jinc round to 1, and at 0 they would divide by zero
+constexpr double near_zero = 1e-8;
+
+auto mitchell(double x) -> double
+{
+  constexpr double b = 1.0 / 3.0, c = 1.0 / 3.0;
+  if (x < 1.0) {
+    return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x
+            + (6 - 2 * b))
+        / 6;
+  }
+  if (x < 2.0) {
+    return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x
+            + (-12 * b - 48 * c) * x + (8 * b + 24 * c))
+        / 6;
+  }
+  return 0.0;
+}
+
+auto sinc(double x) -> double
+{
+  return std::abs(x) < near_zero ? 1.0 : std::sin(pi * x) / (pi * x);
+}
+
+auto lanczos(double x) -> double
+{
+  return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+// Bessel function of the first kind of order 1, from its power series, which
+// stays within 1e-12 of it for the arguments of jinc() (below 11) and builds
+// everywhere, unlike ::j1 (POSIX) or std::cyl_bessel_j (missing from libc++)
+auto bessel_j1(double x) -> double
+{
+  const auto quarter_square = x * x / 4;
+  auto term = x / 2;
+  auto sum = term;
+  for (double k = 1; k < 40; ++k) {
+    term *= -quarter_square / (k * (k + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+// the 2D counterpart of sinc, 1 at 0
+auto jinc(double x) -> double
+{
+  return std::abs(x) < near_zero ? 1.0 : 2.0 * bessel_j1(pi * x) / (pi * x);
+}
+
+auto ewa_lanczos(double x) -> double
+{
+  return x < ewa_radius ? jinc(x) * jinc(x * jinc_zero / ewa_radius) : 0.0;
+}
+
+struct kernel
+{
+  double radius;
+  double (*weight)(double);
+};
+
+// the rows of the weight texture, in the order of scale_filter after nearest
+const array<kernel, scale_filter_count - 1> kernels {
+    kernel {2.0, mitchell},
+    kernel {3.0, lanczos},
+    kernel {ewa_radius, ewa_lanczos},
+};
+
+// fetch(uv, lod) returns the RGBA color of the image at uv, for each image
+// kind, with the layer and palette uniforms and texture bindings of
+// draw_image(), and levels() the number of mipmap levels it has
+const array<const char*, image_kind_count> fetch_functions {
+    R"(
+  layout(binding = 0) uniform sampler2D tex;
+
+  int levels() { return textureQueryLevels(tex); }
+  vec4 fetch(vec2 uv, float lod) { return textureLod(tex, uv, lod); }
+)",
+    // same conversion as ycbcr_fragment_shader
+    R"(
+  layout(binding = 0) uniform sampler2D luma;
+  layout(binding = 1) uniform sampler2D blue;
+  layout(binding = 2) uniform sampler2D red;
+
+  const float chroma_zero = 128.0 / 255.0;
+  const mat3 ycbcr_to_rgb = mat3(
+    1.0, 1.0, 1.0,
+    0.0, -0.344136, 1.772,
+    1.402, -0.714136, 0.0
+  );
+
+  int levels() { return textureQueryLevels(luma); }
+  vec4 fetch(vec2 uv, float lod) {
+    vec3 ycbcr = vec3(textureLod(luma, uv, lod).r,
+                      textureLod(blue, uv, lod).r - chroma_zero,
+                      textureLod(red, uv, lod).r - chroma_zero);
+    return vec4(clamp(ycbcr_to_rgb * ycbcr, 0.0, 1.0), 1.0);
+  }
+)",
+    R"(
+  layout(location = 0) uniform float layer;
+  layout(binding = 0) uniform sampler2DArray tex;
+
+  int levels() { return textureQueryLevels(tex); }
+  vec4 fetch(vec2 uv, float lod) {
+    return textureLod(tex, vec3(uv, layer), lod);
+  }
+)",
+    // indices cannot be filtered, so there are no mipmaps
+    R"(
+  layout(location = 0) uniform float layer;
+  layout(location = 1) uniform int palette;
+  layout(binding = 0) uniform usampler2DArray tex;
+  layout(binding = 1) uniform sampler2D palettes;
+
+  int levels() { return 1; }
+  vec4 fetch(vec2 uv, float lod) {
+    uint index = textureLod(tex, vec3(uv, layer), 0.0).r;
+    return texelFetch(palettes, ivec2(index, palette), 0);
+  }
+)",
+};
+
+// sizes are in texels, the target pixel centers are at gl_FragCoord, at
+// origin from the top left of the image placed at display_size. location 6
+// is the view of image_vertex_shader
+const GLchar* const pass_header = R"(
+  #version 430 core
+
+  layout(location = 0) out vec4 color;
+
+  layout(location = 2) uniform vec2 source_size;
+  layout(location = 3) uniform vec2 display_size;
+  layout(location = 4) uniform float radius;
+  layout(location = 5) uniform float weight_row;
+  layout(location = 7) uniform vec2 origin;
+  // the source row of the first row of the intermediate texture
+  layout(location = 8) uniform float first_row;
+  layout(binding = 3) uniform sampler2D weights;
+
+  // weight of a source texel at distance d, in kernel units
+  float weight(float d) {
+    float samples = float(textureSize(weights, 0).x);
+    float t = min(abs(d) / radius, 1.0);
+    return texture(weights, vec2((t * (samples - 1.0) + 0.5) / samples,
+                                 weight_row)).r;
+  }
+)";
+
+// the rows of the image, into a texture of the target width and the height
+// of the source rows read by the vertical pass, when downscaling the kernel
+// is widened by the scale factor
+const GLchar* const horizontal_main = R"(
+  void main() {
+    float ratio = source_size.x / display_size.x;
+    float scale = max(ratio, 1.0);
+    float center = (gl_FragCoord.x + origin.x) * ratio - 0.5;
+    float v = (gl_FragCoord.y + first_row) / source_size.y;
+    int first = int(floor(center - radius * scale)) + 1;
+    int last = int(floor(center + radius * scale));
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int i = first; i <= last; ++i) {
+      float w = weight((float(i) - center) / scale);
+      float x = clamp(float(i), 0.0, source_size.x - 1.0);
+      sum += w * fetch(vec2((x + 0.5) / source_size.x, v), 0.0);
+      total += w;
+    }
+    color = sum / total;
+  }
+)";
+
+// the columns of the horizontal pass
+const GLchar* const vertical_shader = R"(
+  layout(binding = 0) uniform sampler2D tex;
+
+  void main() {
+    float ratio = source_size.y / display_size.y;
+    float scale = max(ratio, 1.0);
+    float center = (gl_FragCoord.y + origin.y) * ratio - 0.5;
+    int column = int(gl_FragCoord.x);
+    int rows = textureSize(tex, 0).y;
+    int first = int(floor(center - radius * scale)) + 1;
+    int last = int(floor(center + radius * scale));
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int i = first; i <= last; ++i) {
+      float w = weight((float(i) - center) / scale);
+      int y = clamp(i, 0, int(source_size.y) - 1) - int(first_row);
+      sum += w * texelFetch(tex, ivec2(column, clamp(y, 0, rows - 1)), 0);
+      total += w;
+    }
+    color = sum / total;
+  }
+)";
+
+// every texel within the ellipse of the kernel, from the mipmap level that
+// leaves a factor of at most 2 to filter
+const GLchar* const ewa_main = R"(
+  void main() {
+    vec2 ratio = source_size / display_size;
+    float lod = clamp(ceil(log2(max(ratio.x, ratio.y))) - 1.0,
+                      0.0,
+                      float(levels() - 1));
+    vec2 size = max(floor(source_size / exp2(lod)), vec2(1.0));
+    vec2 level_ratio = size / display_size;
+    vec2 scale = max(level_ratio, vec2(1.0));
+    vec2 center = (gl_FragCoord.xy + origin) * level_ratio - 0.5;
+    ivec2 first = ivec2(floor(center - radius * scale)) + 1;
+    ivec2 last = ivec2(floor(center + radius * scale));
+    vec4 sum = vec4(0.0);
+    float total = 0.0;
+    for (int y = first.y; y <= last.y; ++y) {
+      for (int x = first.x; x <= last.x; ++x) {
+        float r = length((vec2(x, y) - center) / scale);
+        if (r >= radius) {
+          continue;
+        }
+        float w = weight(r);
+        vec2 texel = clamp(vec2(x, y), vec2(0.0), size - 1.0);
+        sum += w * fetch((texel + 0.5) / size, lod);
+        total += w;
+      }
+    }
+    color = sum / total;
+  }
+)";
+
+auto pass_program(window* w, const char* fetch, const GLchar* main)
+    -> gl_program
+{
+  const auto source = string {pass_header} + fetch + main;
+  return create_program(w, image_vertex_shader, source.c_str());
+}
+
+// a texture sampled with texelFetch, without mipmaps
+auto allocate(window* w,
+              const GladGLContext& gl,
+              GLenum internal_format,
+              int width,
+              int height) -> gl_texture
+{
+  auto texture = gl_texture::create(w);
+  gl.BindTexture(GL_TEXTURE_2D, *texture);
+  gl.TexImage2D(GL_TEXTURE_2D,
+                0,
+                static_cast<GLint>(internal_format),
+                width,
+                height,
+                0,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                nullptr);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  return texture;
+}
+}  // namespace
+
+auto scale_filter_name(scale_filter filter) -> const char*
+{
+  switch (filter) {
+    case scale_filter::nearest:
+      return "nearest";
+    case scale_filter::bicubic:
+      return "bicubic";
+    case scale_filter::lanczos:
+      return "lanczos";
+    case scale_filter::ewa:
+      return "ewa";
+  }
+
+  return "unknown";
+}
+
+auto next_scale_filter(scale_filter filter) -> scale_filter
+{
+  return static_cast<scale_filter>((static_cast<usize>(filter) + 1)
+                                   % scale_filter_count);
+}
+
+image_scaler::image_scaler(scale_filter filter)
+    : m_filter {filter}
+{
+}
+
+auto image_scaler::set_filter(scale_filter filter) -> void
+{
+  m_filter = filter;
+  if (filter == scale_filter::nearest) {
+    release();
+  }
+}
+
+auto image_scaler::draw(window* w,
+                        const GladGLContext& gl,
+                        image_programs& programs,
+                        const gpu_image& image,
+                        usize frame,
+                        GLuint framebuffer,
+                        int width,
+                        int height,
+                        const pixel_rect& placement) -> void
+{
+  // the window is transparent around the image
+  gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  gl.Viewport(0, 0, width, height);
+  gl.ClearColor(0.0F, 0.0F, 0.0F, 0.0F);
+  gl.Clear(GL_COLOR_BUFFER_BIT);
+  if (m_filter == scale_filter::nearest) {
+    // the hardware picks the mipmap level from the placed size
+    gl.UseProgram(programs.get(w, image.kind));
+    set_image_view(gl, placement, width, height);
+    bind_image(gl, image, frame);
+    gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    return;
+  }
+
+  const auto left = std::clamp(
+      static_cast<int>(std::floor(placement.x)), 0, std::max(width, 0));
+  const auto right =
+      std::clamp(static_cast<int>(std::ceil(placement.x + placement.width)),
+                 0,
+                 std::max(width, 0));
+  const auto bottom = std::clamp(
+      static_cast<int>(std::floor(placement.y)), 0, std::max(height, 0));
+  const auto top =
+      std::clamp(static_cast<int>(std::ceil(placement.y + placement.height)),
+                 0,
+                 std::max(height, 0));
+  if (right <= left || top <= bottom) {
+    return;
+  }
+
+  const visible_part part {left,
+                           bottom,
+                           right - left,
+                           top - bottom,
+                           left - placement.x,
+                           placement.y + placement.height - top};
+  if (!cached(image, frame, placement, part)) {
+    const trace_span span {"resample"};
+    resample(w, gl, image, frame, placement, part);
+  }
+
+  gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  gl.Viewport(0, 0, width, height);
+  gl.UseProgram(programs.get(w, image_kind::still));
+  set_image_view(gl,
+                 {static_cast<double>(part.x),
+                  static_cast<double>(part.y),
+                  static_cast<double>(part.width),
+                  static_cast<double>(part.height)},
+                 width,
+                 height);
+  gl.ActiveTexture(GL_TEXTURE0);
+  gl.BindTexture(GL_TEXTURE_2D, *m_result);
+  gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+auto image_scaler::release() -> void
+{
+  m_intermediate.reset();
+  m_result.reset();
+  m_intermediate_width = m_intermediate_height = 0;
+  m_result_width = m_result_height = 0;
+  m_key.reset();
+}
+
+auto image_scaler::byte_size() const -> usize
+{
+  // RGBA16F and RGBA8
+  return static_cast<usize>(m_intermediate_width)
+      * static_cast<usize>(m_intermediate_height) * 8
+      + static_cast<usize>(m_result_width) * static_cast<usize>(m_result_height)
+      * 4;
+}
+
+auto image_scaler::cached(const gpu_image& image,
+                          usize frame,
+                          const pixel_rect& placement,
+                          const visible_part& part) const -> bool
+{
+  if (!m_key.has_value() || m_key->filter != m_filter || m_key->frame != frame
+      || !(m_key->placement == placement) || !(m_key->part == part))
+  {
+    return false;
+  }
+
+  const auto textures = m_key->textures.lock();
+  return textures != nullptr && textures == image.textures
+      && m_key->revision == textures->revision;
+}
+
+auto image_scaler::resample(window* w,
+                            const GladGLContext& gl,
+                            const gpu_image& image,
+                            usize frame,
+                            const pixel_rect& placement,
+                            const visible_part& part) -> void
+{
+  const auto row = static_cast<usize>(m_filter) - 1;
+  const auto kind = static_cast<usize>(image.kind);
+  const auto radius = kernels.at(row).radius;
+  const auto width = part.width;
+  const auto height = part.height;
+  // the source rows the vertical pass reads, with a margin of one row for
+  // the rounding of the shader
+  const auto ratio = image.height / placement.height;
+  const auto support = radius * std::max(ratio, 1.0);
+  const auto first_row =
+      std::clamp(static_cast<int>(std::floor(
+                     (0.5 + part.origin_y) * ratio - 0.5 - support)),
+                 0,
+                 image.height - 1);
+  const auto last_row = std::clamp(
+      static_cast<int>(std::floor(
+          (height - 0.5 + part.origin_y) * ratio - 0.5 + support))
+          + 1,
+      0,
+      image.height - 1);
+  const auto rows = last_row - first_row + 1;
+
+  if (*m_weights == 0) {
+    create_weights(w, gl);
+  }
+  if (*m_framebuffer == 0) {
+    m_framebuffer = gl_framebuffer::create(w);
+  }
+  if (m_result_width != width || m_result_height != height) {
+    m_result = allocate(w, gl, GL_RGBA8, width, height);
+    m_result_width = width;
+    m_result_height = height;
+  }
+  const auto separable = m_filter != scale_filter::ewa;
+  if (separable
+      && (m_intermediate_width != width || m_intermediate_height != rows))
+  {
+    m_intermediate = allocate(w, gl, GL_RGBA16F, width, rows);
+    m_intermediate_width = width;
+    m_intermediate_height = rows;
+  }
+
+  const auto attach = [&](const gl_texture& target, int target_height)
+  {
+    gl.FramebufferTexture2D(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *target, 0);
+    gl.Viewport(0, 0, width, target_height);
+  };
+  const auto set_uniforms = [&]
+  {
+    gl.Uniform2f(2,
+                 static_cast<GLfloat>(image.width),
+                 static_cast<GLfloat>(image.height));
+    gl.Uniform2f(3,
+                 static_cast<GLfloat>(placement.width),
+                 static_cast<GLfloat>(placement.height));
+    gl.Uniform1f(4, static_cast<GLfloat>(radius));
+    gl.Uniform1f(5,
+                 (static_cast<GLfloat>(row) + 0.5F)
+                     / static_cast<GLfloat>(kernels.size()));
+    gl.Uniform2f(7,
+                 static_cast<GLfloat>(part.origin_x),
+                 static_cast<GLfloat>(part.origin_y));
+    gl.Uniform1f(8, static_cast<GLfloat>(first_row));
+  };
+
+  // allocating binds textures, so the weights are bound last
+  gl.BindFramebuffer(GL_FRAMEBUFFER, *m_framebuffer);
+  gl.ActiveTexture(GL_TEXTURE3);
+  gl.BindTexture(GL_TEXTURE_2D, *m_weights);
+  if (!separable) {
+    auto& program = m_ewa.at(kind);
+    if (*program == 0) {
+      program = pass_program(w, fetch_functions.at(kind), ewa_main);
+    }
+
+    attach(m_result, height);
+    gl.UseProgram(*program);
+    bind_image(gl, image, frame);
+    set_uniforms();
+    gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  } else {
+    auto& horizontal = m_horizontal.at(kind);
+    if (*horizontal == 0) {
+      horizontal =
+          pass_program(w, fetch_functions.at(kind), horizontal_main);
+    }
+    if (*m_vertical == 0) {
+      m_vertical = pass_program(w, "", vertical_shader);
+    }
+
+    attach(m_intermediate, rows);
+    gl.UseProgram(*horizontal);
+    bind_image(gl, image, frame);
+    set_uniforms();
+    gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    attach(m_result, height);
+    gl.UseProgram(*m_vertical);
+    gl.ActiveTexture(GL_TEXTURE0);
+    gl.BindTexture(GL_TEXTURE_2D, *m_intermediate);
+    set_uniforms();
+    gl.DrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+
+  m_key = result_key {image.textures,
+                      image.textures->revision,
+                      frame,
+                      m_filter,
+                      placement,
+                      part};
+}
+
+auto image_scaler::create_weights(window* w, const GladGLContext& gl) -> void
+{
+  vector<float> weights;
+  weights.reserve(weight_samples * kernels.size());
+  for (const auto& k : kernels) {
+    for (usize i = 0; i < weight_samples; ++i) {
+      const auto x = k.radius * static_cast<double>(i)
+          / static_cast<double>(weight_samples - 1);
+      weights.push_back(static_cast<float>(k.weight(x)));
+    }
+  }
+
+  m_weights = gl_texture::create(w);
+  gl.BindTexture(GL_TEXTURE_2D, *m_weights);
+  gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  gl.TexImage2D(GL_TEXTURE_2D,
+                0,
+                GL_R32F,
+                static_cast<GLsizei>(weight_samples),
+                static_cast<GLsizei>(kernels.size()),
+                0,
+                GL_RED,
+                GL_FLOAT,
+                weights.data());
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+}  // namespace imgv
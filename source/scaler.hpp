@@ -0,0 +1,126 @@
+#pragma once
+
+#include "gl_wrapper.hpp"
+#include "image.hpp"
+#include "image_view.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+class image_programs;
+
+// how an image is resampled to the size it is drawn at
+enum class scale_filter
+{
+  // the textures as sampled by the hardware, from their mipmaps
+  nearest,
+  // Mitchell-Netravali cubic (B = C = 1/3), in two separable passes
+  bicubic,
+  // 3-lobed Lanczos, in two separable passes
+  lanczos,
+  // jinc windowed by jinc over an ellipse, in one pass as it is not
+  // separable
+  ewa,
+};
+
+constexpr usize scale_filter_count = 4;
+
+auto scale_filter_name(scale_filter filter) -> const char*;
+// the filter after filter, wrapping around
+auto next_scale_filter(scale_filter filter) -> scale_filter;
+
+// draws images resampled with a scale_filter, into framebuffers of the
+// window it was created for
+//
+// only the part of the image inside the framebuffer is resampled, at the
+// scale it is drawn at, so zooming into a large image costs no more than
+// fitting it
+//
+// bicubic and Lanczos first filter the rows into an intermediate texture of
+// the visible width and the source rows the visible part covers, then its
+// columns into the result, with the kernel weights looked up in a texture
+// computed once, so that the cost grows with the size of the image and not
+// with the square of the scale factor. EWA samples the mipmap level that
+// leaves a factor of at most 2 to filter, which keeps its 2D kernel small
+//
+// the result is kept in a texture of the visible size, and only computed
+// again when the image, its frame, its placement or the filter change, so
+// redrawing an unchanged window costs a copy
+class image_scaler
+{
+public:
+  explicit image_scaler(scale_filter filter = scale_filter::bicubic);
+
+  auto filter() const -> scale_filter { return m_filter; }
+  auto set_filter(scale_filter filter) -> void;
+
+  // clear the width x height framebuffer and draw frame of image over
+  // placement, with a vertex array of the window bound
+  auto draw(window* w,
+            const GladGLContext& gl,
+            image_programs& programs,
+            const gpu_image& image,
+            usize frame,
+            GLuint framebuffer,
+            int width,
+            int height,
+            const pixel_rect& placement) -> void;
+
+  // drop the result and the intermediate texture
+  auto release() -> void;
+  // video memory used by the result and the intermediate texture
+  auto byte_size() const -> usize;
+
+private:
+  // the framebuffer pixels the result covers, and the offset of its first
+  // pixel from the top left of the placed image
+  struct visible_part
+  {
+    int x {0}, y {0}, width {0}, height {0};
+    double origin_x {0.0}, origin_y {0.0};
+
+    // the origin follows from the placement, which result_key compares
+    auto operator==(const visible_part& other) const -> bool
+    {
+      return x == other.x && y == other.y && width == other.width
+          && height == other.height;
+    }
+  };
+
+  // what m_result holds
+  struct result_key
+  {
+    weak_ptr<gpu_textures> textures;
+    // of textures, which change while they are streamed
+    usize revision {0};
+    usize frame {0};
+    scale_filter filter {scale_filter::nearest};
+    pixel_rect placement;
+    visible_part part;
+  };
+
+  scale_filter m_filter;
+  // for each image kind
+  array<gl_program, image_kind_count> m_horizontal, m_ewa;
+  gl_program m_vertical;
+  // one row of weights per filter, from the center to the radius
+  gl_texture m_weights;
+  gl_framebuffer m_framebuffer;
+  gl_texture m_intermediate, m_result;
+  int m_intermediate_width {0}, m_intermediate_height {0};
+  int m_result_width {0}, m_result_height {0};
+  optional<result_key> m_key;
+
+  auto cached(const gpu_image& image,
+              usize frame,
+              const pixel_rect& placement,
+              const visible_part& part) const -> bool;
+  auto resample(window* w,
+                const GladGLContext& gl,
+                const gpu_image& image,
+                usize frame,
+                const pixel_rect& placement,
+                const visible_part& part) -> void;
+  auto create_weights(window* w, const GladGLContext& gl) -> void;
+};
+}  // namespace imgv
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <limits>
+
+#include "scheduler.hpp"
+
+namespace imgv
+{
+// x must be non-zero
+static auto count_trailing_zeros(std::uint64_t x) -> usize
+{
+  usize n = 0;
+  for (; (x & 1U) == 0; x >>= 1U) {
+    ++n;
+  }
+  return n;
+}
+
+deadline_scheduler::deadline_scheduler(time_point origin)
+    : m_origin {origin}
+{
+}
+
+auto deadline_scheduler::schedule(window_id id, time_point deadline) -> void
+{
+  const auto generation = ++m_generation;
+  m_pending[id] = generation;
+  insert(entry {id, to_tick(deadline), generation});
+}
+
+auto deadline_scheduler::schedule_now(window_id id) -> void
+{
+  const auto generation = ++m_generation;
+  m_pending[id] = generation;
+  m_ready.push_back(entry {id, 0, generation});
+}
+
+auto deadline_scheduler::cancel(window_id id) -> void
+{
+  m_pending.erase(id);
+}
+
+auto deadline_scheduler::expire(time_point now, vector<window_id>& due) -> void
+{
+  collect(m_ready, due);
+
+  if (now < m_origin) {
+    return;
+  }
+
+  const auto target = static_cast<tick_t>(
+      chr::duration_cast<tick_duration>(now - m_origin).count());
+  while (m_now <= target) {
+    const auto next = next_event_tick();
+    if (next > target) {
+      m_now = target + 1;
+      break;
+    }
+
+    m_now = next;
+    process_tick(m_now, due);
+    ++m_now;
+  }
+}
+
+auto deadline_scheduler::next_deadline() const -> optional<time_point>
+{
+  constexpr auto none = std::numeric_limits<tick_t>::max();
+  auto earliest_of = [this](const vector<entry>& entries)
+  {
+    auto earliest = none;
+    for (const auto& e : entries) {
+      if (live(e)) {
+        earliest = std::min(earliest, e.tick);
+      }
+    }
+    return earliest;
+  };
+
+  auto earliest = std::min(earliest_of(m_ready), earliest_of(m_overflow));
+  for (const auto& lvl : m_levels) {
+    // slots of a level are ordered by time, so only the first one holding a
+    // live entry matters
+    for (auto bits = lvl.occupied; bits != 0; bits &= bits - 1) {
+      const auto slot_earliest =
+          earliest_of(lvl.slots.at(count_trailing_zeros(bits)));
+      if (slot_earliest != none) {
+        earliest = std::min(earliest, slot_earliest);
+        break;
+      }
+    }
+  }
+
+  if (earliest == none) {
+    return nullopt;
+  }
+
+  return m_origin + tick_duration {static_cast<tick_duration::rep>(earliest)};
+}
+
+auto deadline_scheduler::next_event_tick() const -> tick_t
+{
+  auto next = std::numeric_limits<tick_t>::max();
+  for (usize i = 0; i < num_levels; ++i) {
+    const auto shift = level_bits * i;
+    const auto parent_shift = shift + level_bits;
+    const auto digit = static_cast<usize>((m_now >> shift) & (num_slots - 1));
+    // upper level slots are cascaded on their first tick, so the current one
+    // is still pending only if m_now is exactly at its start
+    const auto at_slot_start = (m_now & ((tick_t {1} << shift) - 1)) == 0;
+    const auto first = at_slot_start ? digit : digit + 1;
+    if (first >= num_slots) {
+      continue;
+    }
+
+    if (const auto pending = m_levels.at(i).occupied >> first; pending != 0) {
+      const auto slot = first + count_trailing_zeros(pending);
+      next = std::min(next,
+                      ((m_now >> parent_shift) << parent_shift)
+                          + (tick_t {slot} << shift));
+    }
+  }
+
+  if (!m_overflow.empty()) {
+    constexpr auto wheel_shift = level_bits * num_levels;
+    next = std::min(next, ((m_now >> wheel_shift) + 1) << wheel_shift);
+  }
+
+  return next;
+}
+
+auto deadline_scheduler::to_tick(time_point time) const -> tick_t
+{
+  if (time <= m_origin) {
+    return 0;
+  }
+
+  // round up so that windows are never woken up early
+  return static_cast<tick_t>(
+      chr::ceil<tick_duration>(time - m_origin).count());
+}
+
+auto deadline_scheduler::live(const entry& e) const -> bool
+{
+  const auto it = m_pending.find(e.id);
+  return it != m_pending.end() && it->second == e.generation;
+}
+
+auto deadline_scheduler::insert(entry e) -> void
+{
+  if (e.tick < m_now) {
+    m_ready.push_back(e);
+    return;
+  }
+
+  // the entry goes into the lowest level whose parent slot it shares with
+  // m_now, so it is cascaded down exactly when m_now enters its slot
+  for (usize i = 0; i < num_levels; ++i) {
+    const auto parent_shift = level_bits * (i + 1);
+    if ((e.tick >> parent_shift) == (m_now >> parent_shift)) {
+      auto& lvl = m_levels.at(i);
+      const auto slot =
+          static_cast<usize>((e.tick >> (level_bits * i)) & (num_slots - 1));
+      lvl.slots.at(slot).push_back(e);
+      lvl.occupied |= std::uint64_t {1} << slot;
+      return;
+    }
+  }
+
+  m_overflow.push_back(e);
+}
+
+auto deadline_scheduler::cascade(usize level_index, usize slot) -> void
+{
+  auto& lvl = m_levels.at(level_index);
+  auto entries = std::exchange(lvl.slots.at(slot), {});
+  lvl.occupied &= ~(std::uint64_t {1} << slot);
+  for (const auto& e : entries) {
+    if (live(e)) {
+      insert(e);
+    }
+  }
+}
+
+auto deadline_scheduler::collect(vector<entry>& entries,
+                                 vector<window_id>& due) -> void
+{
+  for (const auto& e : entries) {
+    if (live(e)) {
+      m_pending.erase(e.id);
+      due.push_back(e.id);
+    }
+  }
+
+  entries.clear();
+}
+
+auto deadline_scheduler::process_tick(tick_t tick, vector<window_id>& due)
+    -> void
+{
+  if ((tick & (num_slots - 1)) == 0) {
+    // entering a new level 0 block, pull entries down from the upper levels,
+    // the outermost level first
+    usize highest = 1;
+    while (highest < num_levels
+           && ((tick >> (level_bits * highest)) & (num_slots - 1)) == 0)
+    {
+      ++highest;
+    }
+
+    if (highest == num_levels) {
+      auto overflow = std::exchange(m_overflow, {});
+      for (const auto& e : overflow) {
+        if (live(e)) {
+          insert(e);
+        }
+      }
+    }
+
+    for (auto i = std::min(highest, num_levels - 1); i >= 1; --i) {
+      cascade(i,
+              static_cast<usize>((tick >> (level_bits * i)) & (num_slots - 1)));
+    }
+  }
+
+  auto& first = m_levels.front();
+  const auto slot = static_cast<usize>(tick & (num_slots - 1));
+  collect(first.slots.at(slot), due);
+  first.occupied &= ~(std::uint64_t {1} << slot);
+}
+}  // namespace imgv
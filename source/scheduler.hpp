@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+#include "events.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+namespace chr = std::chrono;
+
+// hierarchical timer wheel keeping the next time each window needs to render
+// every window has at most one pending deadline, rescheduling replaces it
+//
+// deadlines are rounded up to whole ticks (1ms), so a window is never woken
+// up before its deadline
+class deadline_scheduler
+{
+public:
+  using clock_type = chr::steady_clock;
+  using time_point = clock_type::time_point;
+  using tick_duration = chr::milliseconds;
+
+  explicit deadline_scheduler(time_point origin = clock_type::now());
+
+  auto schedule(window_id id, time_point deadline) -> void;
+  auto schedule_now(window_id id) -> void;
+  auto cancel(window_id id) -> void;
+
+  // append the windows whose deadline is not after now to due,
+  // their deadlines are consumed
+  auto expire(time_point now, vector<window_id>& due) -> void;
+
+  // earliest pending deadline, nullopt if nothing is scheduled
+  auto next_deadline() const -> optional<time_point>;
+
+private:
+  using tick_t = std::uint64_t;
+
+  static constexpr usize level_bits = 6;
+  static constexpr usize num_slots = usize {1} << level_bits;
+  static constexpr usize num_levels = 4;
+
+  struct entry
+  {
+    window_id id;
+    tick_t tick;
+    // entries are removed lazily, an entry whose generation does not match
+    // m_pending is stale
+    std::uint64_t generation;
+  };
+
+  struct level
+  {
+    array<vector<entry>, num_slots> slots {};
+    // bit i is set iff slots[i] is non-empty
+    std::uint64_t occupied {0};
+  };
+
+  time_point m_origin;
+  // every tick before m_now has been expired
+  tick_t m_now {0};
+  std::uint64_t m_generation {0};
+  array<level, num_levels> m_levels {};
+  // deadlines too far away for the wheel
+  vector<entry> m_overflow;
+  // deadlines that were already due when they were scheduled
+  vector<entry> m_ready;
+  // id -> generation of its live entry
+  std::unordered_map<window_id, std::uint64_t> m_pending;
+
+  // first tick not before m_now at which an entry is due or cascaded
+  auto next_event_tick() const -> tick_t;
+  auto to_tick(time_point time) const -> tick_t;
+  auto live(const entry& e) const -> bool;
+  auto insert(entry e) -> void;
+  auto cascade(usize level_index, usize slot) -> void;
+  auto collect(vector<entry>& entries, vector<window_id>& due) -> void;
+  auto process_tick(tick_t tick, vector<window_id>& due) -> void;
+};
+}  // namespace imgv
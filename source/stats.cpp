@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+
+#include "stats.hpp"
+
+#include <fmt/core.h>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+#include "thread_pool.hpp"
+
+namespace imgv
+{
+namespace
+{
+constexpr auto relaxed = std::memory_order_relaxed;
+// a window without a present for this long shows 0 fps
+constexpr i64 idle_after = 1'000'000'000;
+
+#ifdef __linux__
+// how long a client has to send its request line, in milliseconds
+constexpr int request_timeout = 100;
+constexpr char wake_signal = 's', wake_stop = 'q';
+
+// write end of the wake pipe of the server, for the signal handler
+std::atomic<int> g_signal_fd {-1};
+
+extern "C" auto on_sigusr1(int /*signal*/) -> void
+{
+  const auto saved = errno;
+  if (const auto fd = g_signal_fd.load(relaxed); fd >= 0) {
+    // a full pipe already has a dump pending
+    [[maybe_unused]] const auto written = ::write(fd, &wake_signal, 1);
+  }
+  errno = saved;
+}
+#endif
+
+auto resident_bytes() -> usize
+{
+#ifdef __linux__
+  // sizes in pages: total program size, then resident set size
+  std::ifstream statm {"/proc/self/statm"};
+  usize size = 0, resident = 0;
+  if (!(statm >> size >> resident)) {
+    return 0;
+  }
+
+  return resident * static_cast<usize>(::sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+auto hit_ratio(u64 hits, u64 misses) -> double
+{
+  return hits + misses == 0
+      ? 0.0
+      : static_cast<double>(hits) / static_cast<double>(hits + misses);
+}
+
+#ifdef __linux__
+auto write_all(int fd, string_view data) -> void
+{
+  while (!data.empty()) {
+    const auto written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return;
+    }
+    data.remove_prefix(static_cast<usize>(written));
+  }
+}
+
+auto open_socket(const string& path) -> int
+{
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    IMGV_ERROR(fmt::format("stats socket path '{}' is too long", path));
+  }
+  std::copy(path.begin(), path.end(), address.sun_path);
+
+  // a socket left behind by a previous run is replaced, anything else at the
+  // path is a mistake in IMGV_STATS_SOCKET and must not be deleted
+  struct stat existing {};
+  if (::lstat(path.c_str(), &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      IMGV_ERROR(fmt::format("'{}' exists and is not a socket", path));
+    }
+    ::unlink(path.c_str());
+  }
+
+  const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    IMGV_ERROR(
+        fmt::format("unable to create socket: {}", std::strerror(errno)));
+  }
+
+  if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+          != 0
+      || ::listen(fd, 4) != 0)
+  {
+    const auto error = errno;
+    ::close(fd);
+    IMGV_ERROR(fmt::format(
+        "unable to listen on '{}': {}", path, std::strerror(error)));
+  }
+
+  return fd;
+}
+#endif
+}  // namespace
+
+auto counters() -> runtime_counters&
+{
+  static runtime_counters instance;
+  return instance;
+}
+
+auto stats_now() -> i64
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+auto claim_window_counters(window_id id) -> window_counters*
+{
+  for (auto& slot : counters().windows) {
+    if (!slot.used.load(relaxed)) {
+      slot.id.store(id, relaxed);
+      slot.presents.store(0, relaxed);
+      slot.last_present.store(0, relaxed);
+      slot.fps.store(0, relaxed);
+      slot.texture_bytes.store(0, relaxed);
+      slot.dropped_frames.store(-1, relaxed);
+      slot.used.store(true, relaxed);
+      return &slot;
+    }
+  }
+
+  return nullptr;
+}
+
+auto find_window_counters(window_id id) -> window_counters*
+{
+  for (auto& slot : counters().windows) {
+    if (slot.used.load(relaxed) && slot.id.load(relaxed) == id) {
+      return &slot;
+    }
+  }
+
+  return nullptr;
+}
+
+auto release_window_counters(window_counters* slot) -> void
+{
+  if (slot != nullptr) {
+    slot->used.store(false, relaxed);
+  }
+}
+
+#ifdef __linux__
+stats_server::stats_server(string socket_path,
+                           const event_queue& queue,
+                           const thread_pool& workers)
+    : m_socket_path {move(socket_path)}
+    , m_queue {queue}
+    , m_workers {workers}
+{
+  if (::pipe2(m_wake_pipe.data(), O_CLOEXEC | O_NONBLOCK) != 0) {
+    IMGV_ERROR(
+        fmt::format("unable to create pipe: {}", std::strerror(errno)));
+  }
+
+  if (!m_socket_path.empty()) {
+    try {
+      m_listen_fd = open_socket(m_socket_path);
+      fmt::print("serving statistics on '{}'\n", m_socket_path);
+    } catch (std::exception& ex) {
+      fmt::print("warn: statistics are not served on a socket\n");
+      dump_exception(ex);
+    }
+  }
+
+  g_signal_fd.store(m_wake_pipe[1], relaxed);
+  struct sigaction action {};
+  action.sa_handler = on_sigusr1;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  ::sigaction(SIGUSR1, &action, nullptr);
+
+  m_thread = std::thread {[this] { serve(); }};
+}
+
+stats_server::~stats_server()
+{
+  std::signal(SIGUSR1, SIG_DFL);
+  g_signal_fd.store(-1, relaxed);
+  [[maybe_unused]] const auto written = ::write(m_wake_pipe[1], &wake_stop, 1);
+  m_thread.join();
+
+  if (m_listen_fd >= 0) {
+    ::close(m_listen_fd);
+    ::unlink(m_socket_path.c_str());
+  }
+  ::close(m_wake_pipe[0]);
+  ::close(m_wake_pipe[1]);
+}
+
+auto stats_server::serve() -> void
+{
+  array<pollfd, 2> fds {pollfd {m_wake_pipe[0], POLLIN, 0},
+                        pollfd {m_listen_fd, POLLIN, 0}};
+  // a negative descriptor is ignored by poll
+  while (true) {
+    if (::poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      char command = 0;
+      while (::read(m_wake_pipe[0], &command, 1) == 1) {
+        if (command == wake_stop) {
+          return;
+        }
+        fmt::print(stderr, "{}\n", dump(true));
+      }
+    }
+
+    if ((fds[1].revents & POLLIN) != 0) {
+      const auto client =
+          ::accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client >= 0) {
+        answer(client);
+        ::close(client);
+      }
+    }
+  }
+}
+
+auto stats_server::answer(int client) const -> void
+{
+  pollfd request {client, POLLIN, 0};
+  array<char, 64> buffer {};
+  ssize_t length = 0;
+  if (::poll(&request, 1, request_timeout) > 0) {
+    length = ::recv(client, buffer.data(), buffer.size(), 0);
+  }
+
+  const auto line = string_view {
+      buffer.data(), static_cast<usize>(std::max<ssize_t>(length, 0))};
+  write_all(client, dump(line.rfind("json", 0) == 0));
+}
+#else
+// neither UNIX domain sockets nor SIGUSR1, the counters are still kept and
+// dump() still works
+stats_server::stats_server(string socket_path,
+                           const event_queue& queue,
+                           const thread_pool& workers)
+    : m_socket_path {move(socket_path)}
+    , m_queue {queue}
+    , m_workers {workers}
+{
+  if (!m_socket_path.empty()) {
+    fmt::print("warn: statistics are only served on Linux\n");
+  }
+}
+
+stats_server::~stats_server() = default;
+#endif
+
+auto stats_server::dump(bool json) const -> string
+{
+  auto& all = counters();
+  const auto now = stats_now();
+  const auto hits = all.image_cache_hits.load(relaxed);
+  const auto misses = all.image_cache_misses.load(relaxed);
+  const auto thumb_hits = all.thumbnail_cache_hits.load(relaxed);
+  const auto thumb_misses = all.thumbnail_cache_misses.load(relaxed);
+  const auto texture_bytes = all.texture_bytes.load(relaxed);
+  const auto reads = all.file_reads.load(relaxed);
+  const auto read_bytes = all.file_read_bytes.load(relaxed);
+  const auto read_seconds =
+      static_cast<double>(all.file_read_nanoseconds.load(relaxed)) / 1e9;
+  const auto decode_depth = m_workers.queued();
+  const auto event_depth = m_queue.size();
+  const auto rss = resident_bytes();
+  const auto wakeups = all.wakeups.load(relaxed);
+  const auto renders = all.renders.load(relaxed);
+
+  struct window_sample
+  {
+    window_id id;
+    u64 presents;
+    double fps;
+    usize texture_bytes;
+    i64 dropped_frames;
+  };
+
+  vector<window_sample> windows;
+  for (const auto& slot : all.windows) {
+    if (!slot.used.load(relaxed)) {
+      continue;
+    }
+
+    const auto idle = now - slot.last_present.load(relaxed) > idle_after;
+    windows.push_back({slot.id.load(relaxed),
+                       slot.presents.load(relaxed),
+                       idle ? 0.0 : slot.fps.load(relaxed),
+                       slot.texture_bytes.load(relaxed),
+                       slot.dropped_frames.load(relaxed)});
+  }
+
+  string out;
+  if (json) {
+    out += fmt::format(R"({{"windows":[)");
+    for (usize i = 0; i < windows.size(); ++i) {
+      const auto& w = windows[i];
+      out += fmt::format(
+          R"({}{{"id":{},"presents":{},"fps":{:.2f},"texture_bytes":{})",
+          i == 0 ? "" : ",",
+          w.id,
+          w.presents,
+          w.fps,
+          w.texture_bytes);
+      if (w.dropped_frames >= 0) {
+        out += fmt::format(R"(,"dropped_frames":{})", w.dropped_frames);
+      }
+      out += "}";
+    }
+    out += fmt::format(
+        R"(],"texture_bytes":{},"decode_queue_depth":{},)"
+        R"("event_queue_depth":{},"resident_bytes":{},)"
+        R"("wakeups":{},"renders":{},)"
+        R"("image_cache":{{"hits":{},"misses":{},"hit_ratio":{:.4f}}},)"
+        R"("thumbnail_cache":{{"hits":{},"misses":{},"hit_ratio":{:.4f}}},)"
+        R"("file_reads":{{"count":{},"bytes":{},"seconds":{:.6f}}}}})",
+        texture_bytes,
+        decode_depth,
+        event_depth,
+        rss,
+        wakeups,
+        renders,
+        hits,
+        misses,
+        hit_ratio(hits, misses),
+        thumb_hits,
+        thumb_misses,
+        hit_ratio(thumb_hits, thumb_misses),
+        reads,
+        read_bytes,
+        read_seconds);
+    return out;
+  }
+
+  const auto metric = [&](const char* name, const char* type, auto value)
+  {
+    out += fmt::format(
+        "# TYPE imgv_{} {}\nimgv_{} {}\n", name, type, name, value);
+  };
+  const auto window_metric = [&](const char* name, const char* type, auto get)
+  {
+    out += fmt::format("# TYPE imgv_{} {}\n", name, type);
+    for (const auto& w : windows) {
+      out += fmt::format("imgv_{}{{window=\"{}\"}} {}\n", name, w.id, get(w));
+    }
+  };
+
+  metric("windows", "gauge", windows.size());
+  window_metric("window_presents_total",
+                "counter",
+                [](const window_sample& w) { return w.presents; });
+  window_metric("window_fps",
+                "gauge",
+                [](const window_sample& w) { return w.fps; });
+  window_metric("window_texture_bytes",
+                "gauge",
+                [](const window_sample& w) { return w.texture_bytes; });
+  out += "# TYPE imgv_window_dropped_frames_total counter\n";
+  for (const auto& w : windows) {
+    if (w.dropped_frames >= 0) {
+      out += fmt::format(
+          "imgv_window_dropped_frames_total{{window=\"{}\"}} {}\n",
+          w.id,
+          w.dropped_frames);
+    }
+  }
+  metric("texture_bytes", "gauge", texture_bytes);
+  metric("decode_queue_depth", "gauge", decode_depth);
+  metric("event_queue_depth", "gauge", event_depth);
+  metric("resident_bytes", "gauge", rss);
+  metric("wakeups_total", "counter", wakeups);
+  metric("renders_total", "counter", renders);
+  metric("image_cache_hits_total", "counter", hits);
+  metric("image_cache_misses_total", "counter", misses);
+  metric("image_cache_hit_ratio", "gauge", hit_ratio(hits, misses));
+  metric("thumbnail_cache_hits_total", "counter", thumb_hits);
+  metric("thumbnail_cache_misses_total", "counter", thumb_misses);
+  metric("thumbnail_cache_hit_ratio",
+         "gauge",
+         hit_ratio(thumb_hits, thumb_misses));
+  metric("file_reads_total", "counter", reads);
+  metric("file_read_bytes_total", "counter", read_bytes);
+  metric("file_read_seconds_total", "counter", read_seconds);
+  return out;
+}
+}  // namespace imgv
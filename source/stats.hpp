@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#include "events.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+class thread_pool;
+
+// counters of one window, written by the main thread and read by the stats
+// server
+//
+// every access is relaxed, a dump may mix values of consecutive frames, or of
+// a window closed while it was being written
+struct window_counters
+{
+  std::atomic_bool used {false};
+  std::atomic<window_id> id {0};
+  std::atomic<u64> presents {0};
+  // stats_now() of the last present
+  std::atomic<i64> last_present {0};
+  // over the last second with presents
+  std::atomic<double> fps {0};
+  std::atomic<usize> texture_bytes {0};
+  // -1 if the window does not drop frames
+  std::atomic<i64> dropped_frames {-1};
+};
+
+// counters shared by the whole program, updated where the events happen
+// with relaxed atomics so that collecting them never takes a lock
+struct runtime_counters
+{
+  static constexpr usize max_windows = 64;
+
+  array<window_counters, max_windows> windows;
+  std::atomic<u64> image_cache_hits {0}, image_cache_misses {0};
+  std::atomic<u64> thumbnail_cache_hits {0}, thumbnail_cache_misses {0};
+  // whole files read ahead of decoding, the time of each read is added up
+  // even when reads overlap
+  std::atomic<u64> file_reads {0}, file_read_bytes {0};
+  std::atomic<u64> file_read_nanoseconds {0};
+  // reported to the memory budget by every window together
+  std::atomic<usize> texture_bytes {0};
+  // times the main loop woke up from waiting, and the render() calls it made
+  std::atomic<u64> wakeups {0}, renders {0};
+};
+
+auto counters() -> runtime_counters&;
+
+inline auto increment(std::atomic<u64>& counter) -> void
+{
+  counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+// steady clock time in nanoseconds
+auto stats_now() -> i64;
+
+// the counters of a new window, nullptr once every slot is taken, in which
+// case the window is left out of the statistics
+auto claim_window_counters(window_id id) -> window_counters*;
+auto find_window_counters(window_id id) -> window_counters*;
+auto release_window_counters(window_counters* slot) -> void;
+
+// answers statistics requests on a UNIX domain socket, and dumps them to
+// stderr when the process receives SIGUSR1, from its own thread, on Linux
+// only: elsewhere it serves nothing and only dump() is useful
+//
+// a client may send "json" or "prometheus" (the default) on one line, it then
+// receives the dump and the connection is closed
+//
+// only one server may exist at a time, as it owns the SIGUSR1 handler
+class stats_server
+{
+public:
+  // without a socket if socket_path is empty or the socket cannot be opened
+  stats_server(string socket_path,
+               const event_queue& queue,
+               const thread_pool& workers);
+  ~stats_server();
+
+  stats_server(const stats_server&) = delete;
+  stats_server(stats_server&&) = delete;
+
+  auto operator=(const stats_server&) = delete;
+  auto operator=(stats_server&&) = delete;
+
+  auto dump(bool json) const -> string;
+
+private:
+  string m_socket_path;
+  const event_queue& m_queue;
+  const thread_pool& m_workers;
+  int m_listen_fd {-1};
+  // written by the signal handler, and by the destructor to stop the thread
+  array<int, 2> m_wake_pipe {-1, -1};
+  std::thread m_thread;
+
+  auto serve() -> void;
+  auto answer(int client) const -> void;
+};
+}  // namespace imgv
@@ -1,8 +1,10 @@
 #include <cassert>
+#include <climits>
 
 #include <stb_image.hpp>
 
 #include "texture_load_common.hpp"
+#include "texture_stream.hpp"
 
 namespace imgv
 {
@@ -19,14 +21,25 @@ struct stbi_loader
   image_metadata metadata;
   int num_comps = 0;
   pixel_data data;
-  GLint internal_format, align;
+  GLint internal_format;
   GLenum format;
+  // levels 1 and up of large images, which are streamed
+  vector<mip_level> tail;
 
-  explicit stbi_loader(const char* path)
+  // contents is the whole file at path
+  stbi_loader(const char* path, const vector<u8>& contents)
       : metadata {false, 0, 0, path}
-      , data {stbi_load(
-            path, &metadata.width, &metadata.height, &num_comps, STBI_default)}
   {
+    if (contents.size() > static_cast<usize>(INT_MAX)) {
+      IMGV_ERROR("file is too large for stb_image");
+    }
+
+    data = pixel_data {stbi_load_from_memory(contents.data(),
+                                             static_cast<int>(contents.size()),
+                                             &metadata.width,
+                                             &metadata.height,
+                                             &num_comps,
+                                             STBI_default)};
     if (!data) {
       IMGV_ERROR("unable to load image via stb_image");
     }
@@ -35,46 +48,41 @@ struct stbi_loader
       case 1:
         internal_format = GL_R8;
         format = GL_RED;
-        align = 1;
         break;
       case 2:
         internal_format = GL_RG16;
         format = GL_RG;
-        align = 2;
         break;
       case 3:
         internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
         format = GL_RGB;
-        align = 1;
         break;
       case 4:
         internal_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
         format = GL_RGBA;
-        align = 4;
         break;
       default:
         IMGV_ERROR("invalid num_comps");
     }
+
+    if (should_stream(metadata.width, metadata.height)) {
+      const auto channels = static_cast<usize>(num_comps);
+      tail = build_mip_tail(data.get(),
+                            metadata.width,
+                            metadata.height,
+                            static_cast<usize>(metadata.width) * channels,
+                            channels);
+    }
   }
 
-  auto operator()(window* w) -> gl_texture
+  // large images are only allocated, and queued on the stream of uploader
+  auto operator()(window* w, texture_uploader& uploader) -> gl_texture
   {
     return w->use_gl(
         [&, this](const GladGLContext& gl)
         {
           auto texture = gl_texture::create(w);
           gl.BindTexture(GL_TEXTURE_2D, *texture);
-          gl.PixelStorei(GL_UNPACK_ALIGNMENT, align);
-          gl.TexImage2D(GL_TEXTURE_2D,
-                        0,
-                        internal_format,
-                        metadata.width,
-                        metadata.height,
-                        0,
-                        format,
-                        GL_UNSIGNED_BYTE,
-                        data.get());
-
           auto swizzle = [&](std::initializer_list<GLint> mask)
           {
             assert(mask.size() == 4);
@@ -92,21 +100,40 @@ struct stbi_loader
             default:;
           }
 
-          gen_mipmap_and_set_filters(gl, GL_TEXTURE_2D);
+          const auto channels = static_cast<usize>(num_comps);
+          const auto streamed = !tail.empty();
+          uploader.upload(
+              gl,
+              0,
+              *texture,
+              static_cast<GLenum>(internal_format),
+              format,
+              {shared_ptr<const u8> {data.release(), stbi_deleter {}},
+               metadata.width,
+               metadata.height,
+               static_cast<usize>(metadata.width) * channels,
+               channels,
+               move(tail)});
 
-          if (num_comps >= 2) {
+          if (num_comps >= 2 && !streamed && !uploader.deferred()) {
             dump_texture_compress_size(gl,
                                        static_cast<usize>(metadata.width)
                                            * static_cast<usize>(metadata.height)
-                                           * static_cast<usize>(num_comps),
+                                           * channels,
                                        GL_TEXTURE_2D);
           }
-          data.reset();
           return texture;
         });
   }
 
+  // stb_image only loads the first frame of animations
+  // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
+  auto load_animation(window* /*w*/) -> paged_texture
+  {
+    IMGV_ERROR("stbi_loader does not support animations");
+  }
+
   // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
-  auto take_delays() -> vector<double> { return {}; }
+  auto take_delays() -> frame_delays { return {}; }
 };
 }  // namespace imgv
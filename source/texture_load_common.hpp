@@ -1,34 +1,329 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <utility>
+
 #include "gl_wrapper.hpp"
+#include "trace.hpp"
+
+// upper bound of a single texture allocation of an animation, in bytes
+#ifndef IMGV_MAX_TEXTURE_PAGE_SIZE
+// NOLINTNEXTLINE(*-macro-usage)
+#  define IMGV_MAX_TEXTURE_PAGE_SIZE 268435456
+#endif
 
 namespace imgv
 {
+constexpr usize max_texture_page_size = IMGV_MAX_TEXTURE_PAGE_SIZE;
 
 inline auto gen_mipmap_and_set_filters(const GladGLContext& gl,
                                        GLenum tex_target) -> void
 {
+  const trace_span span {"mipmap"};
   gl.GenerateMipmap(tex_target);
   gl.TexParameteri(tex_target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   gl.TexParameteri(
       tex_target, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 }
 
+// size of one level of the bound (compressed) texture
+inline auto texture_compressed_size(const GladGLContext& gl,
+                                    GLenum tex_target,
+                                    GLint level = 0) -> usize
+{
+  GLint size = 0;
+  gl.GetTexLevelParameteriv(
+      tex_target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+  return static_cast<usize>(std::max(size, 0));
+}
+
+// size of the bound (compressed) texture, all of its levels included
+inline auto texture_compressed_levels_size(const GladGLContext& gl,
+                                           GLenum tex_target) -> usize
+{
+  usize total = 0;
+  for (GLint level = 0;; ++level) {
+    GLint width = 0, height = 0;
+    gl.GetTexLevelParameteriv(tex_target, level, GL_TEXTURE_WIDTH, &width);
+    gl.GetTexLevelParameteriv(tex_target, level, GL_TEXTURE_HEIGHT, &height);
+    if (width <= 0 || height <= 0) {
+      break;
+    }
+    total += texture_compressed_size(gl, tex_target, level);
+    // 1 x 1 is the last level, querying past it can be out of range
+    if (width == 1 && height == 1) {
+      break;
+    }
+  }
+  return total;
+}
+
+// memory used by the bound texture, its mipmaps included
+inline auto texture_memory_size(const GladGLContext& gl, GLenum tex_target)
+    -> usize
+{
+  GLint compressed = GL_FALSE;
+  gl.GetTexLevelParameteriv(tex_target, 0, GL_TEXTURE_COMPRESSED, &compressed);
+  usize level0 = 0;
+  if (compressed == GL_TRUE) {
+    level0 = texture_compressed_size(gl, tex_target);
+  } else {
+    GLint width = 0, height = 0, bits = 0;
+    gl.GetTexLevelParameteriv(tex_target, 0, GL_TEXTURE_WIDTH, &width);
+    gl.GetTexLevelParameteriv(tex_target, 0, GL_TEXTURE_HEIGHT, &height);
+    for (const GLenum channel : std::initializer_list<GLenum> {
+             GL_TEXTURE_RED_SIZE,
+             GL_TEXTURE_GREEN_SIZE,
+             GL_TEXTURE_BLUE_SIZE,
+             GL_TEXTURE_ALPHA_SIZE})
+    {
+      GLint size = 0;
+      gl.GetTexLevelParameteriv(tex_target, 0, channel, &size);
+      bits += size;
+    }
+    level0 = static_cast<usize>(std::max(width, 0))
+        * static_cast<usize>(std::max(height, 0))
+        * static_cast<usize>(std::max(bits, 0)) / 8;
+  }
+
+  GLint min_filter = GL_NEAREST;
+  gl.GetTexParameteriv(tex_target, GL_TEXTURE_MIN_FILTER, &min_filter);
+  const auto mipmapped = min_filter != GL_NEAREST && min_filter != GL_LINEAR;
+  // a full mipmap chain adds a third
+  return mipmapped ? level0 + level0 / 3 : level0;
+}
+
 inline auto dump_texture_compress_size(const GladGLContext& gl,
                                        usize orig_size,
                                        GLenum tex_target) -> void
 {
-  GLint size = 0;
-  gl.GetTexLevelParameteriv(
-      tex_target, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
-  fmt::print("texture compress memory usage: {} -> {}\n", orig_size, size);
+  fmt::print("texture compress memory usage: {} -> {}\n",
+             orig_size,
+             texture_compressed_size(gl, tex_target));
+}
+
+// how frames are stored and uploaded
+struct texture_format
+{
+  GLenum internal_format;
+  // pixel transfer format and type
+  GLenum format, type;
+  bool mipmapped;
+};
+
+// the default format, RGBA pixels compressed by the driver
+constexpr texture_format compressed_rgba_format {
+    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, GL_RGBA, GL_UNSIGNED_BYTE, true};
+// 8-bit palette indices, which can be neither filtered nor mipmapped
+constexpr texture_format palette_index_format {
+    GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE, false};
+
+inline auto is_compressed(GLenum internal_format) -> bool
+{
+  switch (internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      return true;
+    default:
+      return false;
+  }
 }
 
+// estimated memory usage of one width x height layer, mipmaps included
+inline auto estimate_layer_size(const texture_format& format,
+                                usize width,
+                                usize height) -> usize
+{
+  const auto blocks = ((width + 3) / 4) * ((height + 3) / 4);
+  usize level0 = 0;
+  switch (format.internal_format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+      level0 = blocks * 8;
+      break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      level0 = blocks * 16;
+      break;
+    case GL_R8UI:
+      level0 = width * height;
+      break;
+    default:
+      level0 = width * height * 4;
+  }
+
+  // a full mipmap chain adds a third
+  return format.mipmapped ? level0 + level0 / 3 : level0;
+}
+
+// animation frames split over several array textures (pages), so that
+// animations are not limited by GL_MAX_ARRAY_TEXTURE_LAYERS and no single
+// allocation exceeds max_texture_page_size
+struct paged_texture
+{
+  vector<gl_texture> pages;
+  usize layers_per_page {1};
+
+  // palette-indexed frames only: a 256 x n RGBA texture holding one palette
+  // per row, and the palette row of every frame
+  gl_texture palettes;
+  vector<GLint> frame_palettes;
+
+  // video memory used by all pages
+  usize byte_size {0};
+
+  // page texture and layer of a frame
+  auto locate(usize frame) const -> std::pair<GLuint, GLint>
+  {
+    return {*pages.at(frame / layers_per_page),
+            static_cast<GLint>(frame % layers_per_page)};
+  }
+};
+
+// uploads frames one at a time into a paged_texture
+class paged_texture_builder
+{
+public:
+  paged_texture_builder(window* owner,
+                        const GladGLContext& gl,
+                        const texture_format& format,
+                        GLsizei width,
+                        GLsizei height,
+                        usize frame_count)
+      : m_owner {owner}
+      , m_gl {gl}
+      , m_format {format}
+      , m_width {width}
+      , m_height {height}
+      , m_frame_count {frame_count}
+  {
+    GLint max_layers = 0;
+    gl.GetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    const auto layer_size = estimate_layer_size(
+        format, static_cast<usize>(width), static_cast<usize>(height));
+    // a single frame larger than the page limit still gets its own page
+    m_texture.layers_per_page = std::clamp<usize>(
+        max_texture_page_size / std::max<usize>(layer_size, 1),
+        1,
+        static_cast<usize>(std::max(max_layers, 1)));
+  }
+
+  auto push_frame(const void* pixels) -> void
+  {
+    const trace_span span {"upload frame"};
+    auto layer = m_num_frames % m_texture.layers_per_page;
+    if (layer == 0) {
+      new_page();
+    }
+
+    // rows of 8-bit indices are not 4-byte aligned
+    m_gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    m_gl.TexSubImage3D(GL_TEXTURE_2D_ARRAY,
+                       0,
+                       0,
+                       0,
+                       static_cast<GLint>(layer),
+                       m_width,
+                       m_height,
+                       1,
+                       m_format.format,
+                       m_format.type,
+                       pixels);
+    m_gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    ++m_num_frames;
+  }
+
+  auto finish() -> paged_texture
+  {
+    finish_page();
+    m_texture.byte_size = m_texture_size;
+    fmt::print("texture memory usage: {} -> {} ({} pages)\n",
+               static_cast<usize>(m_width) * static_cast<usize>(m_height) * 4
+                   * m_num_frames,
+               m_texture_size,
+               m_texture.pages.size());
+    return move(m_texture);
+  }
+
+private:
+  window* m_owner;
+  const GladGLContext& m_gl;
+  texture_format m_format;
+  GLsizei m_width, m_height;
+  usize m_frame_count, m_num_frames {0}, m_texture_size {0};
+  usize m_layers_in_page {0};
+  paged_texture m_texture;
+
+  auto new_page() -> void
+  {
+    finish_page();
+    const trace_span span {"allocate page"};
+
+    const auto remaining =
+        m_frame_count > m_num_frames ? m_frame_count - m_num_frames : 1;
+    const auto layers = std::min(m_texture.layers_per_page, remaining);
+    auto& page = m_texture.pages.emplace_back(gl_texture::create(m_owner));
+    m_gl.BindTexture(GL_TEXTURE_2D_ARRAY, *page);
+    m_gl.TexImage3D(GL_TEXTURE_2D_ARRAY,
+                    0,
+                    static_cast<GLint>(m_format.internal_format),
+                    m_width,
+                    m_height,
+                    static_cast<GLsizei>(layers),
+                    0,
+                    m_format.format,
+                    m_format.type,
+                    nullptr);
+    m_layers_in_page = layers;
+  }
+
+  auto finish_page() -> void
+  {
+    if (m_texture.pages.empty()) {
+      return;
+    }
+
+    m_gl.BindTexture(GL_TEXTURE_2D_ARRAY, *m_texture.pages.back());
+    if (m_format.mipmapped) {
+      gen_mipmap_and_set_filters(m_gl, GL_TEXTURE_2D_ARRAY);
+    } else {
+      m_gl.TexParameteri(
+          GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      m_gl.TexParameteri(
+          GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      m_gl.TexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+
+    m_texture_size += is_compressed(m_format.internal_format)
+        ? texture_compressed_levels_size(m_gl, GL_TEXTURE_2D_ARRAY)
+        : estimate_layer_size(m_format,
+                              static_cast<usize>(m_width),
+                              static_cast<usize>(m_height))
+            * m_layers_in_page;
+  }
+};
+
+// cumulative end time of every frame of an animation
+using frame_delays = vector<std::chrono::nanoseconds>;
+
 struct image_metadata
 {
   bool animated;
   int width, height;
   const char* title;
+  // frames are palette indices (see paged_texture::palettes)
+  bool indexed {false};
+};
+
+// tightly packed RGBA pixels of a downscaled image
+struct thumbnail
+{
+  int width {0}, height {0};
+  vector<u8> pixels;
 };
 
 }  // namespace imgv
@@ -0,0 +1,160 @@
+#include <chrono>
+#include <functional>
+
+#include "texture_registry.hpp"
+
+#ifdef __linux__
+#  include <sys/stat.h>
+#endif
+
+#include "trace.hpp"
+
+namespace imgv
+{
+auto file_identity_hash::operator()(const file_identity& id) const -> usize
+{
+  const std::hash<u64> hash;
+  auto seed = hash(id.inode);
+  for (const auto value : {id.device, static_cast<u64>(id.mtime)}) {
+    seed ^= hash(value) + 0x9e3779b97f4a7c15 + (seed << 6U) + (seed >> 2U);
+  }
+
+  return seed;
+}
+
+auto identify_file(const string& path) -> optional<file_identity>
+{
+#ifdef __linux__
+  struct stat info {};
+  if (::stat(path.c_str(), &info) != 0) {
+    return nullopt;
+  }
+
+  return file_identity {
+      static_cast<u64>(info.st_dev),
+      static_cast<u64>(info.st_ino),
+      static_cast<i64>(info.st_mtim.tv_sec) * 1'000'000'000
+          + static_cast<i64>(info.st_mtim.tv_nsec)};
+#else
+  // no portable inode numbers, the canonical path stands in for them
+  std::error_code error;
+  const auto file = fs::canonical(path, error);
+  if (error) {
+    return nullopt;
+  }
+
+  const auto modified = fs::last_write_time(file, error);
+  if (error) {
+    return nullopt;
+  }
+
+  const auto since_epoch = modified.time_since_epoch();
+  return file_identity {
+      0,
+      static_cast<u64>(std::hash<string> {}(file.string())),
+      static_cast<i64>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch)
+              .count())};
+#endif
+}
+
+auto texture_registry::find(const string& path) -> optional<gpu_image>
+{
+  const auto id = identify_file(path);
+  if (!id.has_value()) {
+    return nullopt;
+  }
+
+  const auto it = m_entries.find(*id);
+  if (it == m_entries.end()) {
+    return nullopt;
+  }
+
+  auto image = share(it->second, path);
+  if (!image.has_value()) {
+    m_entries.erase(it);
+  }
+
+  return image;
+}
+
+auto texture_registry::upload(window* w, decoded_image image) -> gpu_image
+{
+  const auto id = identify_file(image.path());
+  if (!id.has_value()) {
+    // not registered, it cannot be recognized anyway
+    return upload_image(w, move(image), m_recompressor);
+  }
+
+  auto& shared = m_entries[*id];
+  if (auto result = share(shared, image.path()); result.has_value()) {
+    trace_instant("shared textures");
+    return move(*result);
+  }
+
+  auto result = upload_image(w, move(image), m_recompressor);
+  shared = {result.textures,
+            w,
+            result.kind,
+            result.width,
+            result.height,
+            result.delays};
+  prune();
+  return result;
+}
+
+auto texture_registry::transfer(window* from, window* heir) -> void
+{
+  prune();
+  if (heir == nullptr) {
+    return;
+  }
+
+  for (auto& [id, shared] : m_entries) {
+    if (shared.owner != from) {
+      continue;
+    }
+
+    if (auto textures = shared.textures.lock(); textures != nullptr) {
+      textures->set_owner(heir);
+      shared.owner = heir;
+    }
+  }
+}
+
+auto texture_registry::size() -> usize
+{
+  prune();
+  return m_entries.size();
+}
+
+auto texture_registry::share(const entry& shared, string title) const
+    -> optional<gpu_image>
+{
+  auto textures = shared.textures.lock();
+  if (textures == nullptr) {
+    return nullopt;
+  }
+
+  gpu_image image;
+  image.kind = shared.kind;
+  image.width = shared.width;
+  image.height = shared.height;
+  image.title = move(title);
+  image.byte_size = textures->byte_size;
+  image.textures = move(textures);
+  image.delays = shared.delays;
+  return image;
+}
+
+auto texture_registry::prune() -> void
+{
+  for (auto it = m_entries.begin(); it != m_entries.end();) {
+    if (it->second.textures.expired()) {
+      it = m_entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+}  // namespace imgv
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "image.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+// what a file holds as long as it is not modified: the same file opened
+// through two paths has one identity, a rewritten file gets a new one
+struct file_identity
+{
+  u64 device {0}, inode {0};
+  // modification time, in nanoseconds
+  i64 mtime {0};
+
+  auto operator==(const file_identity& other) const -> bool
+  {
+    return device == other.device && inode == other.inode
+        && mtime == other.mtime;
+  }
+};
+
+struct file_identity_hash
+{
+  auto operator()(const file_identity& id) const -> usize;
+};
+
+// nullopt if path cannot be stat'ed
+auto identify_file(const string& path) -> optional<file_identity>;
+
+// the textures of every image shown by a window, by file identity
+//
+// all windows share one share group through the root window, so a file
+// opened in a second window (or navigated to, or reloaded) takes the textures
+// already uploaded instead of being decoded and uploaded again, and its video
+// memory is only used once
+//
+// the textures are reference counted by the gpu_images holding them, the
+// registry only keeps weak references and must be used from the main thread
+class texture_registry
+{
+public:
+  // the textures of path if some window still holds them, with zero decode
+  // and upload times since neither is paid again
+  auto find(const string& path) -> optional<gpu_image>;
+
+  // upload image into textures owned by w, unless the same file was uploaded
+  // while image was decoded, then its textures are shared instead
+  auto upload(window* w, decoded_image image) -> gpu_image;
+
+  // the textures created by from, which is about to be destroyed, are
+  // deleted by heir instead (or by from itself if heir is null, which is
+  // only correct once no other window holds them)
+  auto transfer(window* from, window* heir) -> void;
+
+  // images whose textures are alive
+  auto size() -> usize;
+
+  // upload still images uncompressed and compress them on workers, so that
+  // they show sooner at the cost of more video memory for a while
+  auto defer_compression(thread_pool& workers) -> void
+  {
+    m_recompressor = &workers;
+  }
+
+private:
+  struct entry
+  {
+    weak_ptr<gpu_textures> textures;
+    // the window deleting the textures
+    window* owner {nullptr};
+    image_kind kind {image_kind::still};
+    int width {0}, height {0};
+    shared_ptr<const frame_delays> delays;
+  };
+
+  std::unordered_map<file_identity, entry, file_identity_hash> m_entries;
+  thread_pool* m_recompressor {nullptr};
+
+  auto share(const entry& shared, string title) const -> optional<gpu_image>;
+  // drop the entries whose textures were all released
+  auto prune() -> void;
+};
+}  // namespace imgv
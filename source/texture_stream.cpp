@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <limits>
+
+#include "texture_stream.hpp"
+
+#include "texture_load_common.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+// images up to this many pixels are uploaded at once, they take a frame or
+// less anyway
+constexpr usize min_stream_pixels = 4 * 1024 * 1024;
+// source bytes uploaded by a step, compressing them takes a few milliseconds
+constexpr usize stream_step_bytes = 8 * 1024 * 1024;
+// bands start and end on block rows of compressed formats
+constexpr int band_alignment = 4;
+
+auto next_level(const u8* pixels,
+                int width,
+                int height,
+                usize stride,
+                usize channels) -> mip_level
+{
+  mip_level result;
+  result.width = std::max(width / 2, 1);
+  result.height = std::max(height / 2, 1);
+  result.pixels.resize(static_cast<usize>(result.width)
+                       * static_cast<usize>(result.height) * channels);
+
+  auto* out = result.pixels.data();
+  for (int y = 0; y < result.height; ++y) {
+    const auto* top = pixels + static_cast<usize>(2 * y) * stride;
+    const auto* bottom = pixels
+        + static_cast<usize>(std::min(2 * y + 1, height - 1)) * stride;
+    for (int x = 0; x < result.width; ++x) {
+      const auto left = static_cast<usize>(2 * x) * channels;
+      const auto right =
+          static_cast<usize>(std::min(2 * x + 1, width - 1)) * channels;
+      for (usize c = 0; c < channels; ++c) {
+        const auto sum = top[left + c] + top[right + c] + bottom[left + c]
+            + bottom[right + c];
+        *out++ = static_cast<u8>((sum + 2) / 4);
+      }
+    }
+  }
+
+  return result;
+}
+}  // namespace
+
+auto should_stream(int width, int height) -> bool
+{
+  return static_cast<usize>(std::max(width, 0))
+      * static_cast<usize>(std::max(height, 0))
+      > min_stream_pixels;
+}
+
+auto build_mip_tail(const u8* pixels,
+                    int width,
+                    int height,
+                    usize stride,
+                    usize channels) -> vector<mip_level>
+{
+  const trace_span span {"mip tail"};
+  vector<mip_level> tail;
+  while (width > 1 || height > 1) {
+    auto level = next_level(pixels, width, height, stride, channels);
+    width = level.width;
+    height = level.height;
+    stride = static_cast<usize>(width) * channels;
+    tail.push_back(move(level));
+    pixels = tail.back().pixels.data();
+  }
+
+  return tail;
+}
+
+auto texture_stream::add(const GladGLContext& gl,
+                         GLuint texture,
+                         GLenum internal_format,
+                         GLenum format,
+                         stream_source source) -> void
+{
+  const auto levels = static_cast<int>(source.tail.size()) + 1;
+  gl.TexStorage2D(GL_TEXTURE_2D,
+                  levels,
+                  internal_format,
+                  source.width,
+                  source.height);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  gl.TexParameteri(
+      GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+
+  const auto index = m_targets.size();
+  m_targets.push_back({texture, format, move(source)});
+  for (int level = 0; level < levels; ++level) {
+    m_jobs.push_back({index, level});
+  }
+
+  // the levels of every texture interleaved by size, so that the planes of
+  // an image get finer together
+  const auto pixels = [this](const job& j)
+  {
+    const auto& s = m_targets.at(j.target).source;
+    return static_cast<usize>(std::max(s.width >> j.level, 1))
+        * static_cast<usize>(std::max(s.height >> j.level, 1));
+  };
+  std::stable_sort(m_jobs.begin() + static_cast<std::ptrdiff_t>(m_next),
+                   m_jobs.end(),
+                   [&](const job& a, const job& b)
+                   { return pixels(a) < pixels(b); });
+}
+
+auto texture_stream::step(const GladGLContext& gl) -> bool
+{
+  const trace_span span {"stream levels"};
+  auto budget = stream_step_bytes;
+  auto changed = false;
+  gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  while (m_next < m_jobs.size() && budget > 0) {
+    auto& j = m_jobs.at(m_next);
+    auto& t = m_targets.at(j.target);
+    auto& source = t.source;
+    auto* level = j.level == 0
+        ? nullptr
+        : &source.tail.at(static_cast<usize>(j.level - 1));
+    const auto* pixels =
+        level == nullptr ? source.base.get() : level->pixels.data();
+    const auto width = level == nullptr ? source.width : level->width;
+    const auto height = level == nullptr ? source.height : level->height;
+    const auto row_bytes = static_cast<usize>(width) * source.channels;
+    const auto stride = level == nullptr ? source.stride : row_bytes;
+
+    const auto fitting = static_cast<int>(
+        std::min<usize>(budget / std::max<usize>(row_bytes, 1),
+                        static_cast<usize>(std::numeric_limits<int>::max())));
+    const auto rows = std::min(
+        std::max(fitting / band_alignment * band_alignment, band_alignment),
+        height - j.row);
+    gl.BindTexture(GL_TEXTURE_2D, t.name);
+    gl.PixelStorei(GL_UNPACK_ROW_LENGTH,
+                   static_cast<GLint>(stride / source.channels));
+    gl.TexSubImage2D(GL_TEXTURE_2D,
+                     j.level,
+                     0,
+                     j.row,
+                     width,
+                     rows,
+                     t.format,
+                     GL_UNSIGNED_BYTE,
+                     pixels + static_cast<usize>(j.row) * stride);
+    budget -= std::min(budget, static_cast<usize>(rows) * row_bytes);
+    j.row += rows;
+    if (j.row < height) {
+      continue;
+    }
+
+    // the levels of a texture complete from the smallest, so this one is the
+    // finest
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, j.level);
+    changed = true;
+    if (level == nullptr) {
+      source.base.reset();
+    } else {
+      level->pixels = {};
+    }
+    ++m_next;
+  }
+
+  gl.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return changed;
+}
+
+auto texture_uploader::upload(const GladGLContext& gl,
+                              usize plane,
+                              GLuint texture,
+                              GLenum internal_format,
+                              GLenum format,
+                              stream_source source) -> void
+{
+  // the formats compress_texture() produces are stored uncompressed until
+  // the workers are done
+  auto storage = internal_format;
+  if (recompressor != nullptr) {
+    switch (internal_format) {
+      case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        storage = GL_RGB8;
+        break;
+      case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        storage = GL_RGBA8;
+        break;
+      case GL_COMPRESSED_RED_RGTC1:
+        storage = GL_R8;
+        break;
+      default:;
+    }
+  }
+
+  if (storage != internal_format) {
+    compressions.push_back(
+        {plane,
+         recompressor->submit(
+             [base = source.base,
+              width = source.width,
+              height = source.height,
+              stride = source.stride,
+              channels = source.channels,
+              internal_format]
+             {
+               return compress_texture(base.get(),
+                                       width,
+                                       height,
+                                       stride,
+                                       channels,
+                                       internal_format);
+             })});
+  }
+
+  if (!source.tail.empty()) {
+    stream.add(gl, texture, storage, format, move(source));
+    return;
+  }
+
+  const trace_span span {"compress"};
+  gl.PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  gl.PixelStorei(GL_UNPACK_ROW_LENGTH,
+                 static_cast<GLint>(source.stride / source.channels));
+  gl.TexImage2D(GL_TEXTURE_2D,
+                0,
+                static_cast<GLint>(storage),
+                source.width,
+                source.height,
+                0,
+                format,
+                GL_UNSIGNED_BYTE,
+                source.base.get());
+  gl.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  gl.PixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  gen_mipmap_and_set_filters(gl, GL_TEXTURE_2D);
+}
+}  // namespace imgv
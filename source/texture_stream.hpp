@@ -0,0 +1,121 @@
+#pragma once
+
+#include <future>
+
+#include "block_compress.hpp"
+#include "gl_wrapper.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+class thread_pool;
+
+// 8-bit pixels of one mipmap level, with tightly packed rows
+struct mip_level
+{
+  int width {0}, height {0};
+  vector<u8> pixels;
+};
+
+// whether a texture of width x height is uploaded by a texture_stream
+auto should_stream(int width, int height) -> bool;
+
+// levels 1 and up of width x height pixels of channels bytes each, in rows of
+// stride bytes, down to 1x1, every level the 2x2 average of the previous one
+//
+// computed by the decoding thread, so that the main thread only copies them
+auto build_mip_tail(const u8* pixels,
+                    int width,
+                    int height,
+                    usize stride,
+                    usize channels) -> vector<mip_level>;
+
+// the pixels of a texture to stream
+struct stream_source
+{
+  // level 0, in rows of stride bytes, kept alive by base until it is uploaded
+  shared_ptr<const u8> base;
+  int width {0}, height {0};
+  usize stride {0}, channels {1};
+  // from build_mip_tail()
+  vector<mip_level> tail;
+};
+
+// uploads the mipmap levels of large textures from the smallest to the
+// largest, a few rows per step, so that an image can be drawn from its
+// smallest levels right after it is decoded instead of once all its pixels
+// are uploaded and mipmapped
+//
+// GL_TEXTURE_BASE_LEVEL of every texture is the finest level fully uploaded,
+// the sampler never reads the levels still being written
+class texture_stream
+{
+public:
+  // allocate every level of texture, which must be bound to GL_TEXTURE_2D,
+  // and queue source for upload, format is its pixel transfer format
+  auto add(const GladGLContext& gl,
+           GLuint texture,
+           GLenum internal_format,
+           GLenum format,
+           stream_source source) -> void;
+
+  // upload up to stream_step_bytes of the smallest pending levels, returns
+  // whether the base level of a texture changed
+  auto step(const GladGLContext& gl) -> bool;
+  // everything was uploaded
+  auto done() const -> bool { return m_next == m_jobs.size(); }
+
+private:
+  struct target
+  {
+    GLuint name;
+    GLenum format;
+    stream_source source;
+  };
+
+  // one level of one texture, uploaded from row
+  struct job
+  {
+    usize target;
+    int level;
+    int row {0};
+  };
+
+  vector<target> m_targets;
+  // from the smallest level to the largest
+  vector<job> m_jobs;
+  usize m_next {0};
+};
+
+// a plane of gpu_textures encoded by a worker, to replace the uncompressed
+// texture it was first uploaded to
+struct pending_compression
+{
+  usize plane {0};
+  std::future<compressed_texture> result;
+};
+
+// uploads the planes of a still image: at once, or through stream when they
+// are large
+//
+// with a recompressor, formats the driver would compress are uploaded
+// uncompressed instead, which costs a copy, while the workers of the
+// recompressor encode the compressed version that replaces them later
+struct texture_uploader
+{
+  thread_pool* recompressor {nullptr};
+  texture_stream stream;
+  vector<pending_compression> compressions;
+
+  // upload source into texture, bound to GL_TEXTURE_2D, as plane of the
+  // image, stored as internal_format, format is the pixel transfer format
+  auto upload(const GladGLContext& gl,
+              usize plane,
+              GLuint texture,
+              GLenum internal_format,
+              GLenum format,
+              stream_source source) -> void;
+  // compression is left to the workers
+  auto deferred() const -> bool { return recompressor != nullptr; }
+};
+}  // namespace imgv
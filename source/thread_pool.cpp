@@ -0,0 +1,86 @@
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+#include "trace.hpp"
+
+namespace imgv
+{
+thread_pool::thread_pool(usize num_threads)
+{
+  if (num_threads == 0) {
+    const auto cores = static_cast<usize>(std::thread::hardware_concurrency());
+    num_threads = std::max<usize>(cores, 2) - 1;
+  }
+
+  m_threads.reserve(num_threads);
+  for (usize i = 0; i < num_threads; ++i) {
+    m_threads.emplace_back([this] { worker(); });
+  }
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    const scoped_lock lock {m_mutex};
+    m_stopping = true;
+    m_jobs.clear();
+    m_queued.store(0, std::memory_order_relaxed);
+  }
+
+  m_cond.notify_all();
+  for (auto& thread : m_threads) {
+    thread.join();
+  }
+}
+
+auto thread_pool::post(job j) -> void
+{
+  {
+    const scoped_lock lock {m_mutex};
+    m_jobs.push_back(move(j));
+    m_queued.store(m_jobs.size(), std::memory_order_relaxed);
+  }
+
+  m_cond.notify_one();
+}
+
+auto thread_pool::idle() -> bool
+{
+  const scoped_lock lock {m_mutex};
+  return m_jobs.empty() && m_running == 0;
+}
+
+auto thread_pool::worker() -> void
+{
+  set_trace_thread_name("worker");
+  while (true) {
+    job j;
+    {
+      std::unique_lock lock {m_mutex};
+      m_cond.wait(lock, [this] { return m_stopping || !m_jobs.empty(); });
+      if (m_stopping) {
+        return;
+      }
+
+      j = move(m_jobs.front());
+      m_jobs.pop_front();
+      m_queued.store(m_jobs.size(), std::memory_order_relaxed);
+      ++m_running;
+    }
+
+    try {
+      const trace_span span {"job"};
+      j();
+    } catch (std::exception& ex) {
+      fmt::print("warn: a background job failed\n");
+      dump_exception(ex);
+    } catch (...) {
+      fmt::print("warn: a background job failed\n");
+    }
+
+    const scoped_lock lock {m_mutex};
+    --m_running;
+  }
+}
+}  // namespace imgv
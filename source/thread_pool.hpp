@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <type_traits>
+
+#include "types.hpp"
+
+namespace imgv
+{
+
+// fixed set of worker threads running background jobs (decoding, prefetching)
+// in submission order
+//
+// jobs still queued when the pool is destroyed are dropped (their futures
+// report a broken promise), running jobs are waited for
+class thread_pool
+{
+public:
+  // 0 means one thread per core, minus the main thread
+  explicit thread_pool(usize num_threads = 0);
+  ~thread_pool();
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool(thread_pool&&) = delete;
+
+  auto operator=(const thread_pool&) = delete;
+  auto operator=(thread_pool&&) = delete;
+
+  using job = std::function<void()>;
+
+  // run j on one of the workers, an exception it throws is logged and dropped
+  auto post(job j) -> void;
+
+  // same as post, with the result (or exception) delivered through a future
+
+  template<typename Func>
+  auto submit(Func&& func) -> std::future<std::invoke_result_t<Func>>
+  {
+    using result_t = std::invoke_result_t<Func>;
+    // std::function needs a copyable target
+    auto task = std::make_shared<std::packaged_task<result_t()>>(
+        forward<Func>(func));
+    auto future = task->get_future();
+    post([task] { (*task)(); });
+    return future;
+  }
+
+  auto size() const -> usize { return m_threads.size(); }
+
+  // no job is queued or running
+  auto idle() -> bool;
+  // jobs waiting for a worker, without locking, so possibly outdated
+  auto queued() const -> usize
+  {
+    return m_queued.load(std::memory_order_relaxed);
+  }
+
+private:
+  mutex m_mutex;
+  std::condition_variable m_cond;
+  std::deque<job> m_jobs;
+  usize m_running {0};
+  // size of m_jobs, for readers that do not take the lock
+  std::atomic<usize> m_queued {0};
+  bool m_stopping {false};
+  vector<std::thread> m_threads;
+
+  auto worker() -> void;
+};
+}  // namespace imgv
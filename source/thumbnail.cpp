@@ -0,0 +1,393 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "thumbnail.hpp"
+
+#include <fmt/core.h>
+#include <stb_image.hpp>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "image.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+using namespace std::literals;
+using std::uint32_t;
+
+namespace
+{
+// RFC 1321
+auto md5(string_view message) -> array<u8, 16>
+{
+  constexpr array<uint32_t, 64> sines {
+      0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+      0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+      0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+      0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+      0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+      0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+      0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+      0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+      0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+      0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+      0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+  };
+  constexpr array<int, 16> shifts {
+      7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+  // message, a one bit, zeros and the bit length, in 64 byte blocks
+  vector<u8> data {message.begin(), message.end()};
+  data.push_back(0x80);
+  while (data.size() % 64 != 56) {
+    data.push_back(0);
+  }
+  const auto bits = static_cast<std::uint64_t>(message.size()) * 8;
+  for (int i = 0; i < 8; ++i) {
+    data.push_back(static_cast<u8>(bits >> (8 * i)));
+  }
+
+  array<uint32_t, 4> state {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  for (usize block = 0; block < data.size(); block += 64) {
+    array<uint32_t, 16> words {};
+    for (usize i = 0; i < words.size(); ++i) {
+      for (usize b = 0; b < 4; ++b) {
+        words.at(i) |= static_cast<uint32_t>(data.at(block + i * 4 + b))
+            << (8 * b);
+      }
+    }
+
+    auto [a, b, c, d] = state;
+    for (usize i = 0; i < 64; ++i) {
+      uint32_t f = 0;
+      usize g = 0;
+      switch (i / 16) {
+        case 0:
+          f = (b & c) | (~b & d);
+          g = i;
+          break;
+        case 1:
+          f = (d & b) | (~d & c);
+          g = (5 * i + 1) % 16;
+          break;
+        case 2:
+          f = b ^ c ^ d;
+          g = (3 * i + 5) % 16;
+          break;
+        default:
+          f = c ^ (b | ~d);
+          g = (7 * i) % 16;
+          break;
+      }
+
+      f += a + sines.at(i) + words.at(g);
+      const auto shift = shifts.at(i / 16 * 4 + i % 4);
+      a = d;
+      d = c;
+      c = b;
+      b += (f << shift) | (f >> (32 - shift));
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+  }
+
+  array<u8, 16> digest {};
+  for (usize i = 0; i < digest.size(); ++i) {
+    digest.at(i) = static_cast<u8>(state.at(i / 4) >> (8 * (i % 4)));
+  }
+  return digest;
+}
+
+auto crc32(const u8* data, usize size, uint32_t crc = 0) -> uint32_t
+{
+  crc = ~crc;
+  for (usize i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1U)));
+    }
+  }
+  return ~crc;
+}
+
+auto put_u32(vector<u8>& out, uint32_t value) -> void
+{
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<u8>(value >> shift));
+  }
+}
+
+auto get_u32(const u8* data) -> uint32_t
+{
+  return static_cast<uint32_t>(data[0]) << 24
+      | static_cast<uint32_t>(data[1]) << 16
+      | static_cast<uint32_t>(data[2]) << 8 | static_cast<uint32_t>(data[3]);
+}
+
+constexpr auto png_signature = "\x89PNG\r\n\x1a\n"sv;
+
+auto put_chunk(vector<u8>& out, string_view type, const vector<u8>& data)
+    -> void
+{
+  put_u32(out, static_cast<uint32_t>(data.size()));
+  const auto start = out.size();
+  out.insert(out.end(), type.begin(), type.end());
+  out.insert(out.end(), data.begin(), data.end());
+  put_u32(out, crc32(&out.at(start), out.size() - start));
+}
+
+auto text_chunk(string_view key, string_view value) -> vector<u8>
+{
+  vector<u8> data {key.begin(), key.end()};
+  data.push_back(0);
+  data.insert(data.end(), value.begin(), value.end());
+  return data;
+}
+
+// RGBA PNG with the metadata of the thumbnail specification, the pixels are
+// stored without compression (thumbnails are small and written once, while
+// deflate would need another dependency), which every PNG reader accepts
+auto encode_png(const thumbnail& thumb, const string& uri, i64 mtime)
+    -> vector<u8>
+{
+  vector<u8> out {png_signature.begin(), png_signature.end()};
+
+  vector<u8> header;
+  put_u32(header, static_cast<uint32_t>(thumb.width));
+  put_u32(header, static_cast<uint32_t>(thumb.height));
+  // 8 bit RGBA, deflate, adaptive filtering, no interlacing
+  header.insert(header.end(), {8, 6, 0, 0, 0});
+  put_chunk(out, "IHDR", header);
+  put_chunk(out, "tEXt", text_chunk("Thumb::URI", uri));
+  put_chunk(out, "tEXt", text_chunk("Thumb::MTime", std::to_string(mtime)));
+  put_chunk(out, "tEXt", text_chunk("Software", "imgv-cpp"));
+
+  // every row is prefixed by its filter type (none)
+  const auto row_size = static_cast<usize>(thumb.width) * 4;
+  vector<u8> raw;
+  raw.reserve((row_size + 1) * static_cast<usize>(thumb.height));
+  for (usize y = 0; y < static_cast<usize>(thumb.height); ++y) {
+    raw.push_back(0);
+    const auto row = thumb.pixels.begin()
+        + static_cast<std::ptrdiff_t>(y * row_size);
+    raw.insert(raw.end(), row, row + static_cast<std::ptrdiff_t>(row_size));
+  }
+
+  // zlib stream made of stored deflate blocks
+  constexpr usize max_block_size = 65535;
+  vector<u8> zlib {0x78, 0x01};
+  for (usize offset = 0; offset < raw.size() || offset == 0;
+       offset += max_block_size)
+  {
+    const auto size = std::min(max_block_size, raw.size() - offset);
+    const auto last = offset + size == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.insert(zlib.end(),
+                {static_cast<u8>(size),
+                 static_cast<u8>(size >> 8),
+                 static_cast<u8>(~size),
+                 static_cast<u8>(~size >> 8)});
+    zlib.insert(zlib.end(),
+                raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                raw.begin() + static_cast<std::ptrdiff_t>(offset + size));
+    if (last) {
+      break;
+    }
+  }
+
+  uint32_t sum1 = 1, sum2 = 0;
+  for (auto byte : raw) {
+    sum1 = (sum1 + byte) % 65521;
+    sum2 = (sum2 + sum1) % 65521;
+  }
+  put_u32(zlib, sum2 << 16 | sum1);
+
+  put_chunk(out, "IDAT", zlib);
+  put_chunk(out, "IEND", {});
+  return out;
+}
+
+// the pixels of a cached thumbnail, nullopt if it is unreadable or was made
+// for another version of the file
+auto decode_png(const vector<u8>& data, const string& uri, i64 mtime)
+    -> optional<thumbnail>
+{
+  if (data.size() < png_signature.size()
+      || std::memcmp(data.data(), png_signature.data(), png_signature.size())
+          != 0)
+  {
+    return nullopt;
+  }
+
+  bool uri_matches = false, mtime_matches = false;
+  const auto expected_mtime = std::to_string(mtime);
+  for (usize offset = png_signature.size(); offset + 12 <= data.size();) {
+    const auto size = static_cast<usize>(get_u32(&data.at(offset)));
+    if (size > data.size() - offset - 12) {
+      return nullopt;
+    }
+
+    const auto type =
+        string_view {reinterpret_cast<const char*>(&data.at(offset + 4)), 4};
+    if (type == "tEXt") {
+      const auto text = string_view {
+          reinterpret_cast<const char*>(data.data() + offset + 8), size};
+      const auto separator = text.find('\0');
+      if (separator != string_view::npos) {
+        const auto key = text.substr(0, separator);
+        const auto value = text.substr(separator + 1);
+        uri_matches |= key == "Thumb::URI" && value == uri;
+        mtime_matches |= key == "Thumb::MTime" && value == expected_mtime;
+      }
+    } else if (type == "IEND") {
+      break;
+    }
+
+    offset += size + 12;
+  }
+
+  if (!uri_matches || !mtime_matches) {
+    return nullopt;
+  }
+
+  int width = 0, height = 0, num_comps = 0;
+  unique_ptr<stbi_uc[], void (*)(void*)> pixels {
+      stbi_load_from_memory(data.data(),
+                            static_cast<int>(data.size()),
+                            &width,
+                            &height,
+                            &num_comps,
+                            4),
+      stbi_image_free};
+  // larger thumbnails (of other sizes) do not fit in the cells of the grid
+  if (!pixels || width > thumbnail_size || height > thumbnail_size) {
+    return nullopt;
+  }
+
+  thumbnail result;
+  result.width = width;
+  result.height = height;
+  const auto size = static_cast<usize>(width) * static_cast<usize>(height) * 4;
+  result.pixels.assign(pixels.get(), pixels.get() + size);
+  return result;
+}
+
+auto read_file(const path& file) -> vector<u8>
+{
+  std::ifstream stream {file, std::ios::binary};
+  return {std::istreambuf_iterator<char> {stream},
+          std::istreambuf_iterator<char> {}};
+}
+
+// write to a temporary file first so that concurrent readers (including other
+// programs) never see a partial thumbnail
+auto write_file(const path& file, const vector<u8>& data) -> void
+{
+  static std::atomic<unsigned> counter {0};
+  auto temp = file;
+  temp += fmt::format(".imgv-{}.tmp", counter++);
+  {
+    std::ofstream stream {temp, std::ios::binary};
+    stream.write(reinterpret_cast<const char*>(data.data()),
+                 static_cast<std::streamsize>(data.size()));
+    if (!stream) {
+      IMGV_ERROR("unable to write thumbnail");
+    }
+  }
+
+  fs::permissions(temp, fs::perms::owner_read | fs::perms::owner_write);
+  fs::rename(temp, file);
+}
+}  // namespace
+
+auto file_uri(const path& file) -> string
+{
+  constexpr auto reserved = "-._~!$&'()*+,=:@/"sv;
+  string uri = "file://";
+  for (auto ch : fs::absolute(file).lexically_normal().string()) {
+    const auto byte = static_cast<u8>(ch);
+    if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+        || (ch >= '0' && ch <= '9') || reserved.find(ch) != string_view::npos)
+    {
+      uri += ch;
+    } else {
+      uri += fmt::format("%{:02X}", byte);
+    }
+  }
+  return uri;
+}
+
+auto thumbnail_cache_path(const path& file) -> path
+{
+  path cache_dir;
+  if (const auto* xdg_cache = std::getenv("XDG_CACHE_HOME");
+      xdg_cache != nullptr && *xdg_cache != '\0')
+  {
+    cache_dir = xdg_cache;
+  } else if (const auto* home = std::getenv("HOME"); home != nullptr) {
+    cache_dir = path {home} / ".cache";
+  } else {
+    return {};
+  }
+
+  string name;
+  for (auto byte : md5(file_uri(file))) {
+    name += fmt::format("{:02x}", byte);
+  }
+  return cache_dir / "thumbnails" / "normal" / (name + ".png");
+}
+
+auto load_thumbnail(const path& file) -> optional<thumbnail>
+{
+  const trace_span span {"thumbnail"};
+  // stat rather than fs::last_write_time, Thumb::MTime is in unix seconds
+  // and the file clock has no portable epoch before c++20
+  struct stat info {};
+  if (::stat(file.string().c_str(), &info) != 0) {
+    return nullopt;
+  }
+
+  const auto uri = file_uri(file);
+  const auto mtime = static_cast<i64>(info.st_mtime);
+  const auto cached = thumbnail_cache_path(file);
+  if (!cached.empty()) {
+    const trace_span cache_read {"read thumbnail"};
+    if (auto result = decode_png(read_file(cached), uri, mtime)) {
+      increment(counters().thumbnail_cache_hits);
+      return result;
+    }
+  }
+
+  increment(counters().thumbnail_cache_misses);
+
+  auto result = decode_thumbnail(file.string(), thumbnail_size);
+  if (!result || cached.empty()) {
+    return result;
+  }
+
+  try {
+    const auto dir = cached.parent_path();
+    if (fs::create_directories(dir)) {
+      fs::permissions(dir.parent_path(), fs::perms::owner_all);
+      fs::permissions(dir, fs::perms::owner_all);
+    }
+    const trace_span cache_write {"write thumbnail"};
+    write_file(cached, encode_png(*result, uri, mtime));
+  } catch (std::exception& ex) {
+    // a read-only cache only costs the next browse its speed
+    fmt::print("warn: unable to store thumbnail of {}\n", file.string());
+    dump_exception(ex);
+  }
+
+  return result;
+}
+
+}  // namespace imgv
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "texture_load_common.hpp"
+#include "types.hpp"
+
+namespace imgv
+{
+// longest side of the thumbnails, the "normal" size of the freedesktop
+// thumbnail specification
+constexpr int thumbnail_size = 128;
+
+// percent-encoded file:// URI of an absolute path, as used to key the
+// thumbnail cache
+auto file_uri(const path& file) -> string;
+
+// location of the cached thumbnail of file in the shared thumbnail directory
+// ($XDG_CACHE_HOME/thumbnails/normal/<md5 of the URI>.png), empty if there is
+// no cache directory
+auto thumbnail_cache_path(const path& file) -> path;
+
+// the thumbnail of file, read from the shared thumbnail cache if it is up to
+// date and otherwise decoded and stored there so that other viewers (and the
+// next run) can reuse it, nullopt if file is not a supported image
+//
+// blocking, meant to run on the worker threads
+auto load_thumbnail(const path& file) -> optional<thumbnail>;
+
+}  // namespace imgv
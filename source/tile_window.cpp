@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "tile_window.hpp"
+
+#include <fmt/core.h>
+
+#include "context.hpp"
+#include "navigator.hpp"
+#include "trace.hpp"
+
+namespace imgv
+{
+namespace
+{
+// size of a cell when the window is first shown
+constexpr int initial_cell_size = 384;
+}  // namespace
+
+tile_window::tile_window(context* c, vector<decoded_image> images)
+    : window {c}
+    , m_vao {gl_vertex_array::create(this)}
+    , m_composite {gl_framebuffer::create(this)}
+{
+  make_context_current();
+  for (auto& image : images) {
+    try {
+      auto uploaded = c->textures().upload(this, move(image));
+      m_tiles.emplace_back().image = move(uploaded);
+    } catch (std::exception& ex) {
+      fmt::print("warn: unable to upload image for tile_window\n");
+      dump_exception(ex);
+    }
+  }
+
+  if (m_tiles.empty()) {
+    IMGV_ERROR("no image to show");
+  }
+
+  const auto cols = static_cast<int>(columns());
+  const auto rows = static_cast<int>((m_tiles.size() + columns() - 1)
+                                     / columns());
+  const auto title = fmt::format("{} images", m_tiles.size());
+  show_window(
+      cols * initial_cell_size, rows * initial_cell_size, title.c_str());
+  glfwSetWindowAspectRatio(
+      m_window_handle.get(), GLFW_DONT_CARE, GLFW_DONT_CARE);
+  report_memory();
+}
+
+auto tile_window::handle_event(event& e) -> void
+{
+  visit(overloaded {
+            [this](const play_pause_event& ev)
+            { m_clock.update_play_pause(ev); },
+            [this](const speed_event& ev) { m_clock.update_speed(ev); },
+            [this](const seek_event& ev) { m_clock.update_seek(ev); },
+            [this](const prefetch_event&) { finish_restores(); },
+            [](const auto&) {},
+        },
+        e);
+}
+
+auto tile_window::render() -> double
+{
+  // see image_window::render()
+  if (hidden()) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  auto wait_time = window::render();
+  for (auto& t : m_tiles) {
+    if (is_animation(t.image.kind)) {
+      const auto [frame, frame_wait] =
+          select_frame(*t.image.delays, m_clock);
+      wait_time = std::min(wait_time, frame_wait);
+      if (frame != t.current_frame) {
+        t.current_frame = frame;
+        t.dirty = true;
+      }
+    }
+  }
+
+  make_context_current();
+  auto uploaded = false;
+  for (auto& t : m_tiles) {
+    if (t.image.resident()
+        && t.image.textures->upload_wait_time()
+            < std::numeric_limits<double>::infinity())
+    {
+      if (t.image.textures->continue_upload(m_gl)) {
+        t.dirty = true;
+        uploaded = true;
+        t.image.byte_size = t.image.textures->byte_size;
+      }
+      wait_time = std::min(wait_time, t.image.textures->upload_wait_time());
+    }
+  }
+  if (uploaded) {
+    report_memory();
+  }
+
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(m_window_handle.get(), &width, &height);
+  const auto redraw = m_redraw.exchange(false);
+  if (update_composite(width, height) || redraw) {
+    for (auto& t : m_tiles) {
+      t.dirty = true;
+    }
+  }
+
+  if (std::none_of(m_tiles.begin(),
+                   m_tiles.end(),
+                   [](const tile& t) { return t.dirty; }))
+  {
+    return wait_time;
+  }
+
+  begin_render_timing();
+  m_gl.BindFramebuffer(GL_FRAMEBUFFER, *m_composite);
+  m_gl.BindVertexArray(*m_vao);
+  m_gl.ClearColor(0.1F, 0.1F, 0.1F, 1.0F);
+  for (usize i = 0; i < m_tiles.size(); ++i) {
+    auto& t = m_tiles[i];
+    if (!t.dirty) {
+      continue;
+    }
+
+    const trace_span span {"draw tile"};
+    t.dirty = false;
+    const auto [x, y, w, h] = cell(i, width, height);
+    m_gl.Enable(GL_SCISSOR_TEST);
+    m_gl.Scissor(x, y, w, h);
+    m_gl.Clear(GL_COLOR_BUFFER_BIT);
+    m_gl.Disable(GL_SCISSOR_TEST);
+    if (!t.image.resident()) {
+      if (auto shared = m_context->textures().find(t.image.title);
+          shared.has_value())
+      {
+        // shown by another window, drawn on the next refresh
+        t.image = move(*shared);
+        t.restore = {};
+        t.current_frame = std::numeric_limits<usize>::max();
+        t.dirty = true;
+        report_memory();
+        request_render();
+        continue;
+      }
+
+      // drawn once the reload finishes
+      if (!t.restore.valid()) {
+        t.restore = decode_async(m_context, id(), t.image.title);
+      }
+      continue;
+    }
+
+    // letterboxed in the cell
+    const auto scale = std::min(static_cast<double>(w) / t.image.width,
+                                static_cast<double>(h) / t.image.height);
+    const auto fit_width = static_cast<int>(std::lround(t.image.width * scale));
+    const auto fit_height =
+        static_cast<int>(std::lround(t.image.height * scale));
+    m_gl.Viewport(x + (w - fit_width) / 2,
+                  y + (h - fit_height) / 2,
+                  fit_width,
+                  fit_height);
+    draw_image(
+        m_gl, m_programs.get(this, t.image.kind), t.image, t.current_frame);
+  }
+
+  m_gl.BindFramebuffer(GL_READ_FRAMEBUFFER, *m_composite);
+  m_gl.BindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer());
+  m_gl.BlitFramebuffer(0,
+                       0,
+                       width,
+                       height,
+                       0,
+                       0,
+                       width,
+                       height,
+                       GL_COLOR_BUFFER_BIT,
+                       GL_NEAREST);
+  end_render_timing();
+  swap_buffers();
+  return wait_time;
+}
+
+auto tile_window::release_memory(memory_kind kind) -> void
+{
+  if (kind != memory_kind::image) {
+    return;
+  }
+
+  for (auto& t : m_tiles) {
+    if (t.image.resident()) {
+      // only what is needed to lay out the tile and reload the image stays
+      gpu_image released;
+      released.kind = t.image.kind;
+      released.width = t.image.width;
+      released.height = t.image.height;
+      released.title = move(t.image.title);
+      released.delays = move(t.image.delays);
+      t.image = move(released);
+    }
+  }
+
+  report_memory();
+}
+
+auto tile_window::stats() -> window_stats
+{
+  window_stats result;
+  result.decode_time = 0.0;
+  result.upload_time = 0.0;
+  for (const auto& t : m_tiles) {
+    result.texture_bytes += t.image.byte_size;
+    *result.decode_time += t.image.decode_time;
+    *result.upload_time += t.image.upload_time;
+  }
+
+  return result;
+}
+
+auto tile_window::columns() const -> usize
+{
+  return static_cast<usize>(
+      std::ceil(std::sqrt(static_cast<double>(m_tiles.size()))));
+}
+
+auto tile_window::cell(usize index, int width, int height) const
+    -> array<int, 4>
+{
+  const auto cols = columns();
+  const auto rows = (m_tiles.size() + cols - 1) / cols;
+  const auto cell_width = width / static_cast<int>(cols);
+  const auto cell_height = height / static_cast<int>(rows);
+  const auto column = static_cast<int>(index % cols);
+  const auto row = static_cast<int>(index / cols);
+  // the first row is at the top
+  return {column * cell_width,
+          height - (row + 1) * cell_height,
+          cell_width,
+          cell_height};
+}
+
+auto tile_window::update_composite(int width, int height) -> bool
+{
+  if (width == m_composite_width && height == m_composite_height) {
+    return false;
+  }
+
+  // a new renderbuffer, as the storage of a renderbuffer cannot change while
+  // it is attached
+  m_composite_color = gl_renderbuffer::create(this);
+  m_gl.BindRenderbuffer(GL_RENDERBUFFER, *m_composite_color);
+  m_gl.RenderbufferStorage(
+      GL_RENDERBUFFER, GL_RGBA8, std::max(width, 1), std::max(height, 1));
+  m_gl.BindFramebuffer(GL_FRAMEBUFFER, *m_composite);
+  m_gl.FramebufferRenderbuffer(GL_FRAMEBUFFER,
+                               GL_COLOR_ATTACHMENT0,
+                               GL_RENDERBUFFER,
+                               *m_composite_color);
+  // the cells do not always cover the edges of the window
+  m_gl.ClearColor(0.1F, 0.1F, 0.1F, 1.0F);
+  m_gl.Clear(GL_COLOR_BUFFER_BIT);
+  m_composite_width = width;
+  m_composite_height = height;
+  return true;
+}
+
+auto tile_window::finish_restores() -> void
+{
+  for (auto& t : m_tiles) {
+    if (!t.restore.valid()
+        || t.restore.wait_for(std::chrono::seconds {0})
+            != std::future_status::ready)
+    {
+      continue;
+    }
+
+    if (hidden()) {
+      // decoded again once the window is restored
+      t.restore = {};
+      continue;
+    }
+
+    auto decoded = wait_decode(t.restore);
+    if (!decoded.has_value()) {
+      fmt::print("warn: unable to reload '{}'\n", t.image.title);
+      continue;
+    }
+
+    try {
+      make_context_current();
+      t.image = m_context->textures().upload(this, move(*decoded));
+      t.current_frame = std::numeric_limits<usize>::max();
+      t.dirty = true;
+    } catch (std::exception& ex) {
+      fmt::print("warn: unable to reload '{}'\n", t.image.title);
+      dump_exception(ex);
+    }
+  }
+
+  report_memory();
+}
+
+auto tile_window::report_memory() -> void
+{
+  memory_usage usage;
+  for (const auto& t : m_tiles) {
+    usage.image_bytes += t.image.byte_size;
+    usage.animating = usage.animating || is_animation(t.image.kind);
+    usage.share(t.image.textures.get(), t.image.byte_size);
+  }
+
+  m_context->budget().report(id(), usage);
+}
+
+}  // namespace imgv
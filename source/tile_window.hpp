@@ -0,0 +1,67 @@
+#pragma once
+
+#include <future>
+#include <limits>
+
+#include "clock.hpp"
+#include "gl_wrapper.hpp"
+#include "image_window.hpp"
+
+namespace imgv
+{
+
+// several images or animations shown side by side in one window, with one GL
+// context, one set of image programs and one swap per refresh
+//
+// the tiles are drawn into a framebuffer kept between refreshes, so when an
+// animation advances only its tile is drawn again before the framebuffer is
+// copied to the window
+class tile_window : public window
+{
+public:
+  tile_window(context* c, vector<decoded_image> images);
+  ~tile_window() override = default;
+
+  tile_window(const tile_window&) = delete;
+  tile_window(tile_window&&) = delete;
+
+  auto operator=(const tile_window&) = delete;
+  auto operator=(tile_window&&) = delete;
+
+  auto handle_event(event& e) -> void override;
+  auto render() -> double override;
+  auto release_memory(memory_kind kind) -> void override;
+  auto stats() -> window_stats override;
+
+private:
+  struct tile
+  {
+    gpu_image image;
+    // animations only
+    usize current_frame {std::numeric_limits<usize>::max()};
+    // the tile must be drawn again into the composite
+    bool dirty {true};
+    // reload of image after its textures were released
+    std::future<optional<decoded_image>> restore;
+  };
+
+  gl_vertex_array m_vao;
+  image_programs m_programs;
+  vector<tile> m_tiles;
+  // shared by every animation, so they are paused and seeked together
+  state_clock m_clock;
+
+  // the tiles drawn so far, of the size of the window
+  gl_framebuffer m_composite;
+  gl_renderbuffer m_composite_color;
+  int m_composite_width {0}, m_composite_height {0};
+
+  auto columns() const -> usize;
+  // x, y, width and height of the cell of a tile, from the bottom left
+  auto cell(usize index, int width, int height) const -> array<int, 4>;
+  // resize the composite, returns true if it was recreated
+  auto update_composite(int width, int height) -> bool;
+  auto finish_restores() -> void;
+  auto report_memory() -> void;
+};
+}  // namespace imgv
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include "trace.hpp"
+
+#include <fmt/core.h>
+
+namespace imgv
+{
+namespace chr = std::chrono;
+
+namespace
+{
+struct trace_record
+{
+  std::atomic<const char*> name {nullptr};
+  std::atomic<i64> start {0};
+  // -1 for instants
+  std::atomic<i64> duration {0};
+};
+
+// spans of one thread, written only by that thread
+//
+// readers copy the records without stopping the writer, records the writer
+// may have overwritten during the copy are detected with claimed and
+// dropped, as in a seqlock
+struct trace_ring
+{
+  unique_ptr<trace_record[]> records {
+      std::make_unique<trace_record[]>(trace_buffer_size)};
+  // number of records completely written
+  std::atomic<usize> head {0};
+  // number of records the writer has started writing
+  std::atomic<usize> claimed {0};
+  usize thread_index {0};
+  std::atomic<const char*> thread_name {nullptr};
+
+  auto push(const char* name, i64 start, i64 duration) -> void
+  {
+    const auto index = head.load(std::memory_order_relaxed);
+    claimed.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& record = records[index % trace_buffer_size];
+    record.name.store(name, std::memory_order_relaxed);
+    record.start.store(start, std::memory_order_relaxed);
+    record.duration.store(duration, std::memory_order_relaxed);
+    head.store(index + 1, std::memory_order_release);
+  }
+};
+
+struct trace_registry
+{
+  mutex guard;
+  vector<shared_ptr<trace_ring>> rings;
+  string path;
+  chr::steady_clock::time_point epoch {chr::steady_clock::now()};
+};
+
+auto registry() -> trace_registry&
+{
+  static trace_registry instance;
+  return instance;
+}
+
+thread_local const char* t_thread_name = nullptr;
+// kept alive by the registry after the thread exits, so its spans are still
+// written
+thread_local shared_ptr<trace_ring> t_ring;
+
+auto local_ring() -> trace_ring&
+{
+  if (!t_ring) {
+    auto& reg = registry();
+    const scoped_lock lock {reg.guard};
+    t_ring = std::make_shared<trace_ring>();
+    t_ring->thread_index = reg.rings.size() + 1;
+    t_ring->thread_name = t_thread_name;
+    reg.rings.push_back(t_ring);
+  }
+
+  return *t_ring;
+}
+
+// names are literals from this program, but are escaped anyway
+auto write_json_string(std::ostream& out, const char* str) -> void
+{
+  out << '"';
+  for (; *str != '\0'; ++str) {
+    const auto ch = *str;
+    if (ch == '"' || ch == '\\') {
+      out << '\\' << ch;
+    } else if (static_cast<unsigned char>(ch) < 0x20) {
+      out << fmt::format("\\u{:04x}", static_cast<int>(ch));
+    } else {
+      out << ch;
+    }
+  }
+  out << '"';
+}
+}  // namespace
+
+namespace detail
+{
+std::atomic_bool trace_enabled {false};
+
+auto trace_now() -> i64
+{
+  return chr::duration_cast<chr::nanoseconds>(chr::steady_clock::now()
+                                              - registry().epoch)
+      .count();
+}
+
+auto trace_record(const char* name, i64 start, i64 duration) -> void
+{
+  local_ring().push(name, start, duration);
+}
+}  // namespace detail
+
+auto start_tracing(string path) -> void
+{
+  auto& reg = registry();
+  {
+    const scoped_lock lock {reg.guard};
+    reg.path = move(path);
+  }
+  detail::trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+auto set_trace_thread_name(const char* name) -> void
+{
+  t_thread_name = name;
+  if (t_ring) {
+    t_ring->thread_name = name;
+  }
+}
+
+auto write_trace() -> bool
+{
+  if (!tracing()) {
+    return false;
+  }
+
+  auto& reg = registry();
+  vector<shared_ptr<trace_ring>> rings;
+  string path;
+  {
+    const scoped_lock lock {reg.guard};
+    rings = reg.rings;
+    path = reg.path;
+  }
+
+  std::ofstream out {path};
+  if (!out) {
+    fmt::print("warn: unable to write trace to '{}'\n", path);
+    return false;
+  }
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  auto first = true;
+  const auto separator = [&]
+  { out << (std::exchange(first, false) ? "" : ",\n"); };
+  vector<tuple<const char*, i64, i64>> records;
+  for (const auto& ring : rings) {
+    if (const auto* name = ring->thread_name.load(); name != nullptr) {
+      separator();
+      out << fmt::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},)",
+                         ring->thread_index)
+          << R"("args":{"name":)";
+      write_json_string(out, name);
+      out << "}}";
+    }
+
+    const auto head = ring->head.load(std::memory_order_acquire);
+    const auto begin = head > trace_buffer_size ? head - trace_buffer_size : 0;
+    records.clear();
+    for (auto i = begin; i < head; ++i) {
+      const auto& record = ring->records[i % trace_buffer_size];
+      records.emplace_back(record.name.load(std::memory_order_relaxed),
+                           record.start.load(std::memory_order_relaxed),
+                           record.duration.load(std::memory_order_relaxed));
+    }
+
+    // drop what the thread overwrote while it was being copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto claimed = ring->claimed.load(std::memory_order_relaxed);
+    const auto valid =
+        claimed > trace_buffer_size ? claimed - trace_buffer_size : 0;
+    for (auto i = std::max(begin, valid); i < head; ++i) {
+      const auto [name, start, duration] = records[i - begin];
+      separator();
+      out << R"({"name":)";
+      write_json_string(out, name);
+      if (duration < 0) {
+        out << fmt::format(
+            R"(,"ph":"i","s":"t","ts":{:.3f},"pid":1,"tid":{}}})",
+            static_cast<double>(start) / 1000.0,
+            ring->thread_index);
+      } else {
+        out << fmt::format(
+            R"(,"ph":"X","ts":{:.3f},"dur":{:.3f},"pid":1,"tid":{}}})",
+            static_cast<double>(start) / 1000.0,
+            static_cast<double>(duration) / 1000.0,
+            ring->thread_index);
+      }
+    }
+  }
+
+  out << "]}\n";
+  fmt::print("trace written to '{}'\n", path);
+  return static_cast<bool>(out);
+}
+
+}  // namespace imgv
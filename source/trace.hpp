@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+
+#include "types.hpp"
+
+// number of spans kept per thread, older spans are overwritten
+#ifndef IMGV_TRACE_BUFFER_SIZE
+// NOLINTNEXTLINE(*-macro-usage)
+#  define IMGV_TRACE_BUFFER_SIZE 16384
+#endif
+
+namespace imgv
+{
+constexpr usize trace_buffer_size = IMGV_TRACE_BUFFER_SIZE;
+
+namespace detail
+{
+extern std::atomic_bool trace_enabled;
+auto trace_now() -> i64;
+auto trace_record(const char* name, i64 start, i64 duration) -> void;
+}  // namespace detail
+
+inline auto tracing() -> bool
+{
+  return detail::trace_enabled.load(std::memory_order_relaxed);
+}
+
+// record spans from now on, write_trace() writes them to path
+auto start_tracing(string path) -> void;
+// write the spans recorded by every thread so far as Chrome trace event JSON,
+// which chrome://tracing and Perfetto open, returns false if tracing is off
+// or the file cannot be written
+auto write_trace() -> bool;
+// name the calling thread in the trace
+auto set_trace_thread_name(const char* name) -> void;
+
+// a timed region of the calling thread, from construction to destruction
+// name must be a string literal (or otherwise outlive the trace)
+//
+// when tracing is off this costs a relaxed load and a branch
+class trace_span
+{
+public:
+  explicit trace_span(const char* name)
+      : m_name {tracing() ? name : nullptr}
+      , m_start {m_name != nullptr ? detail::trace_now() : 0}
+  {
+  }
+
+  ~trace_span()
+  {
+    if (m_name != nullptr) {
+      detail::trace_record(m_name, m_start, detail::trace_now() - m_start);
+    }
+  }
+
+  trace_span(const trace_span&) = delete;
+  trace_span(trace_span&&) = delete;
+
+  auto operator=(const trace_span&) = delete;
+  auto operator=(trace_span&&) = delete;
+
+private:
+  const char* m_name;
+  i64 m_start;
+};
+
+// a point in time of the calling thread, such as the first present of a
+// window
+inline auto trace_instant(const char* name) -> void
+{
+  if (tracing()) {
+    detail::trace_record(name, detail::trace_now(), -1);
+  }
+}
+}  // namespace imgv
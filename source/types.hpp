@@ -49,7 +49,9 @@ overloaded(Ts...) -> overloaded<Ts...>;
 
 using u8 = std::uint8_t;
 using i32 = std::int32_t;
+using u32 = std::uint32_t;
 using i64 = std::int64_t;
+using u64 = std::uint64_t;
 using usize = std::size_t;
 
 // NOLINTNEXTLINE(*-macro-*)
@@ -58,8 +60,14 @@ using usize = std::size_t;
 inline auto dump_exception(const std::exception& e, usize level = 0) -> void
 {
   fmt::print("{}{}\n", std::string(level, ' '), e.what());
+  // IMGV_ERROR outside of a handler nests nothing, rethrowing that terminates
+  const auto* nested = dynamic_cast<const std::nested_exception*>(&e);
+  if (nested == nullptr || nested->nested_ptr() == nullptr) {
+    return;
+  }
+
   try {
-    std::rethrow_if_nested(e);
+    nested->rethrow_nested();
   } catch (const std::exception& nested_ex) {
     dump_exception(nested_ex, level + 1);
   } catch (...) {
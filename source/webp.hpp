@@ -1,12 +1,12 @@
 #pragma once
 
-#include <fstream>
-#include <iterator>
+#include <algorithm>
 
 #include <webp/decode.h>
 #include <webp/demux.h>
 
 #include "texture_load_common.hpp"
+#include "texture_stream.hpp"
 
 namespace imgv
 {
@@ -18,43 +18,19 @@ struct webp_loader
   };
 
   using decoder_t = unique_ptr<WebPAnimDecoder, decoder_deleter>;
-  vector<char> data {};
   WebPData webp_data {};
   decoder_t decoder;
   WebPAnimInfo info {};
   image_metadata metadata {};
-  vector<double> delays;
+  frame_delays delays;
 
-  explicit webp_loader(const char* path)
+  // contents is the whole file at path, the decoder reads the frames from it
+  // so it must outlive the loader
+  webp_loader(const char* path, const vector<u8>& contents)
   {
-    try {
-      std::ifstream stream {path, std::ios::binary};
-      auto size = [&]
-      {
-        stream.seekg(0, std::ios_base::end);
-        auto sz = stream.tellg();
-        stream.seekg(0, std::ios_base::beg);
-        return static_cast<usize>(std::max<std::streampos>(sz, 0));
-      }();
-      stream.exceptions(std::ios_base::badbit);
-      data.resize(size);
-      auto read_size =
-          stream.readsome(data.data(), static_cast<std::streampos>(size));
-      data.resize(static_cast<usize>(read_size));
-      if (data.size() == size) {
-        while (!stream.eof()) {
-          char ch = 0;
-          stream.read(&ch, 1);
-          data.push_back(ch);
-        }
-      }
-    } catch (std::exception&) {
-      IMGV_ERROR("unable to open and read file");
-    }
-
     WebPDataInit(&webp_data);
-    webp_data.bytes = reinterpret_cast<u8*>(data.data());
-    webp_data.size = data.size();
+    webp_data.bytes = contents.data();
+    webp_data.size = contents.size();
     WebPAnimDecoderOptions options {};
     if (!WebPAnimDecoderOptionsInit(&options)) {
       IMGV_ERROR("unable to init decoder config");
@@ -77,71 +53,127 @@ struct webp_loader
     metadata.animated = info.frame_count != 1;
   }
 
-  auto operator()(window* w) -> gl_texture
+  // the pixels are owned by the decoder, a deferred compression gets a copy
+  auto operator()(window* w, texture_uploader& uploader) -> gl_texture
   {
     return w->use_gl(
         [&, this](const GladGLContext& gl)
         {
           auto texture = gl_texture::create(w);
-          const GLenum target =
-              metadata.animated ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
-          gl.BindTexture(target, *texture);
-          if (metadata.animated) {
-            GLsizei num_frame = 0;
-            gl.TexImage3D(target,
+          gl.BindTexture(GL_TEXTURE_2D, *texture);
+          int timestamp = 0;
+          u8* pixels = nullptr;
+          WebPAnimDecoderGetNext(decoder.get(), &pixels, &timestamp);
+          const auto size = 4 * static_cast<usize>(metadata.width)
+              * static_cast<usize>(metadata.height);
+          shared_ptr<const u8> base {shared_ptr<void> {}, pixels};
+          if (uploader.deferred()) {
+            const auto copy =
+                std::make_shared<vector<u8>>(pixels, pixels + size);
+            base = {copy, copy->data()};
+          }
+          uploader.upload(gl,
                           0,
+                          *texture,
                           GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-                          static_cast<GLsizei>(metadata.width),
-                          static_cast<GLsizei>(metadata.height),
-                          static_cast<GLsizei>(info.frame_count),
-                          0,
                           GL_RGBA,
-                          GL_UNSIGNED_BYTE,
-                          nullptr);
+                          {move(base),
+                           metadata.width,
+                           metadata.height,
+                           4 * static_cast<usize>(metadata.width),
+                           4,
+                           {}});
 
-            while (WebPAnimDecoderHasMoreFrames(decoder.get())) {
-              int timestamp = 0;
-              u8* pixels = nullptr;
-              WebPAnimDecoderGetNext(decoder.get(), &pixels, &timestamp);
-              gl.TexSubImage3D(target,
-                               0,
-                               0,
-                               0,
-                               num_frame++,
-                               static_cast<GLsizei>(metadata.width),
-                               static_cast<GLsizei>(metadata.height),
-                               1,
-                               GL_RGBA,
-                               GL_UNSIGNED_BYTE,
-                               pixels);
-              delays.push_back(timestamp * 1e-3);
-            }
-          } else {
-            int timestamp = 0;
-            u8* pixels = nullptr;
-            WebPAnimDecoderGetNext(decoder.get(), &pixels, &timestamp);
-            gl.TexImage2D(target,
-                          0,
-                          GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-                          static_cast<GLsizei>(metadata.width),
-                          static_cast<GLsizei>(metadata.height),
-                          0,
-                          GL_RGBA,
-                          GL_UNSIGNED_BYTE,
-                          pixels);
+          if (!uploader.deferred()) {
+            dump_texture_compress_size(gl, size, GL_TEXTURE_2D);
           }
+          return texture;
+        });
+  }
 
-          gen_mipmap_and_set_filters(gl, target);
-          dump_texture_compress_size(
+  auto load_animation(window* w) -> paged_texture
+  {
+    return w->use_gl(
+        [&, this](const GladGLContext& gl)
+        {
+          paged_texture_builder builder {
+              w,
               gl,
-              sizeof(decltype(*std::declval<EasyGifReader::Frame>().pixels()))
-                  * static_cast<usize>(metadata.width * metadata.height)
-                  * info.frame_count,
-              target);
-          return texture;
+              compressed_rgba_format,
+              static_cast<GLsizei>(metadata.width),
+              static_cast<GLsizei>(metadata.height),
+              static_cast<usize>(info.frame_count)};
+          while (WebPAnimDecoderHasMoreFrames(decoder.get())) {
+            int timestamp = 0;
+            u8* pixels = nullptr;
+            {
+              const trace_span span {"decode frame"};
+              WebPAnimDecoderGetNext(decoder.get(), &pixels, &timestamp);
+            }
+            builder.push_frame(pixels);
+            delays.push_back(std::chrono::milliseconds {timestamp});
+          }
+          return builder.finish();
         });
   }
 
-  auto take_delays() -> vector<double> { return move(delays); }
+  auto take_delays() -> frame_delays { return move(delays); }
+
+  // the next frame as canvas sized RGBA, valid until the following call
+  auto next_frame() -> const u8*
+  {
+    int timestamp = 0;
+    u8* pixels = nullptr;
+    if (!WebPAnimDecoderGetNext(decoder.get(), &pixels, &timestamp)) {
+      IMGV_ERROR("unable to decode webp frame");
+    }
+    return pixels;
+  }
 };
+
+// decode a still WebP to RGBA, scaled by the decoder so that it fits in a
+// max_size square, nullopt for animations and invalid files
+inline auto decode_webp_scaled(const vector<u8>& data, int max_size)
+    -> optional<thumbnail>
+{
+  WebPDecoderConfig config {};
+  if (!WebPInitDecoderConfig(&config)
+      || WebPGetFeatures(data.data(), data.size(), &config.input)
+          != VP8_STATUS_OK
+      || config.input.has_animation)
+  {
+    return nullopt;
+  }
+
+  const auto longest = std::max(config.input.width, config.input.height);
+  if (longest > max_size) {
+    config.options.use_scaling = 1;
+    config.options.scaled_width =
+        std::max(1, config.input.width * max_size / longest);
+    config.options.scaled_height =
+        std::max(1, config.input.height * max_size / longest);
+  }
+
+  config.output.colorspace = MODE_RGBA;
+  if (WebPDecode(data.data(), data.size(), &config) != VP8_STATUS_OK) {
+    return nullopt;
+  }
+
+  thumbnail result;
+  result.width = config.output.width;
+  result.height = config.output.height;
+  const auto row_size = static_cast<usize>(result.width) * 4;
+  result.pixels.resize(row_size * static_cast<usize>(result.height));
+  for (usize y = 0; y < static_cast<usize>(result.height); ++y) {
+    std::copy_n(config.output.u.RGBA.rgba
+                    + y * static_cast<usize>(config.output.u.RGBA.stride),
+                row_size,
+                result.pixels.begin()
+                    + static_cast<std::ptrdiff_t>(y * row_size));
+  }
+
+  WebPFreeDecBuffer(&config.output);
+  return result;
+}
+
 }  // namespace imgv
@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <cmath>
-#include <fstream>
 
 #include "window.hpp"
 
@@ -17,17 +16,27 @@
 
 #include <thread>
 
-#include "animated_image_window.hpp"
 #include "context.hpp"
-#include "gif.hpp"
+#include "gl_wrapper.hpp"
+#include "grid_window.hpp"
+#include "hud.hpp"
+#include "image.hpp"
+#include "image_window.hpp"
 #include "mpv_window.hpp"
-#include "static_image_window.hpp"
-#include "stbi.hpp"
-#include "webp.hpp"
+#include "render_timer.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 namespace imgv
 {
 
+struct offscreen_target
+{
+  gl_framebuffer fbo;
+  gl_renderbuffer color;
+  int width {0}, height {0};
+};
+
 auto glfw_window_deleter::operator()(GLFWwindow* window) noexcept -> void
 {
   glfwDestroyWindow(window);
@@ -36,6 +45,10 @@ auto glfw_window_deleter::operator()(GLFWwindow* window) noexcept -> void
 static auto set_x11_window_mode(GLFWwindow* window) -> void
 {
 #ifdef IMGV_X11
+  if (headless()) {
+    return;
+  }
+
   auto* const x11_display = glfwGetX11Display();
   const auto x11_window = glfwGetX11Window(window);
   const auto window_type = XInternAtom(x11_display, "_NET_WM_WINDOW_TYPE", 0);
@@ -53,9 +66,12 @@ static auto set_x11_window_mode(GLFWwindow* window) -> void
 
 window::window(context* c)
     : m_context {c}
+    , m_id {c->allocate_window_id()}
     , m_root(root_window::get())
+    , m_counters {claim_window_counters(m_id)}
 {
   glfwDefaultWindowHints();
+  set_backend_window_hints();
   glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
   glfwWindowHint(GLFW_DECORATED, GLFW_FALSE);
   glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GLFW_TRUE);
@@ -80,8 +96,35 @@ window::window(context* c)
   glfwSetWindowUserPointer(m_window_handle.get(), this);
   glfwSetWindowRefreshCallback(
       m_window_handle.get(),
-      [](GLFWwindow* w) {
-        reinterpret_cast<window*>(glfwGetWindowUserPointer(w))->m_redraw = true;
+      [](GLFWwindow* w)
+      {
+        reinterpret_cast<window*>(glfwGetWindowUserPointer(w))->invalidate();
+      });
+  glfwSetFramebufferSizeCallback(
+      m_window_handle.get(),
+      [](GLFWwindow* w, int, int)
+      {
+        reinterpret_cast<window*>(glfwGetWindowUserPointer(w))->invalidate();
+      });
+  glfwSetWindowFocusCallback(
+      m_window_handle.get(),
+      [](GLFWwindow* w, int focused)
+      {
+        auto& self = *reinterpret_cast<window*>(glfwGetWindowUserPointer(w));
+        if (focused == GLFW_TRUE) {
+          self.m_context->budget().focus(self.id());
+        }
+      });
+  glfwSetWindowIconifyCallback(
+      m_window_handle.get(),
+      [](GLFWwindow* w, int iconified)
+      {
+        auto& self = *reinterpret_cast<window*>(glfwGetWindowUserPointer(w));
+        self.m_hidden = iconified == GLFW_TRUE;
+        self.m_context->budget().set_hidden(self.id(), self.m_hidden);
+        if (!self.m_hidden) {
+          self.invalidate();
+        }
       });
   glfwSetWindowCloseCallback(
       m_window_handle.get(),
@@ -95,24 +138,32 @@ window::window(context* c)
       [](GLFWwindow* w, int key, int, int action, int mods)
       {
         auto& self = *reinterpret_cast<window*>(glfwGetWindowUserPointer(w));
-        if (action == GLFW_RELEASE) {
+        if (action == GLFW_RELEASE || self.on_key(key, mods)) {
           return;
         }
         if (key == GLFW_KEY_RIGHT) {
-          self.push_event(imgv::seek_event {{self.weak_from_this()},
+          self.push_event(imgv::seek_event {{self.id()},
                                             {change_mode::add_or_cycle, 10.0}});
         } else if (key == GLFW_KEY_LEFT) {
           self.push_event(imgv::seek_event {
-              {self.weak_from_this()}, {change_mode::add_or_cycle, -10.0}});
+              {self.id()}, {change_mode::add_or_cycle, -10.0}});
         } else if (key == GLFW_KEY_LEFT_BRACKET) {
           self.push_event(imgv::speed_event {
-              {self.weak_from_this()}, {change_mode::add_or_cycle, -0.1}});
+              {self.id()}, {change_mode::add_or_cycle, -0.1}});
         } else if (key == GLFW_KEY_RIGHT_BRACKET) {
-          self.push_event(imgv::speed_event {{self.weak_from_this()},
+          self.push_event(imgv::speed_event {{self.id()},
                                              {change_mode::add_or_cycle, 0.1}});
+        } else if (key == GLFW_KEY_PAGE_DOWN) {
+          self.push_event(navigate_event {{self.id()}, 1});
+        } else if (key == GLFW_KEY_PAGE_UP) {
+          self.push_event(navigate_event {{self.id()}, -1});
+        } else if (key == GLFW_KEY_F3) {
+          self.toggle_hud();
+        } else if (key == GLFW_KEY_F12) {
+          write_trace();
         } else if (key == GLFW_KEY_SPACE) {
           self.push_event(imgv::play_pause_event {
-              {self.weak_from_this()}, {change_mode::add_or_cycle, true}});
+              {self.id()}, {change_mode::add_or_cycle, true}});
         } else if (key == GLFW_KEY_O && (mods & GLFW_MOD_CONTROL)) {
           std::thread {[&]
                        {
@@ -125,12 +176,15 @@ window::window(context* c)
       });
   glfwSetMouseButtonCallback(
       m_window_handle.get(),
-      [](GLFWwindow* w, int button, int action, int)
+      [](GLFWwindow* w, int button, int action, int mods)
       {
         auto& self = *reinterpret_cast<window*>(glfwGetWindowUserPointer(w));
+        if (self.on_mouse_button(button, action, mods)) {
+          return;
+        }
         if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
           self.push_event(play_pause_event {
-              {self.weak_from_this()},
+              {self.id()},
               {change_mode::add_or_cycle, true},
           });
         } else if (button == GLFW_MOUSE_BUTTON_LEFT) {
@@ -138,6 +192,7 @@ window::window(context* c)
             self.m_drag_state.holding = true;
             std::tie(self.m_drag_state.ox, self.m_drag_state.oy) =
                 window_drag_state::get_monitor_cursor_pos(w);
+            self.request_render();
           } else if (action == GLFW_RELEASE) {
             self.m_drag_state.holding = false;
             self.m_drag_state.ox = 0;
@@ -147,19 +202,28 @@ window::window(context* c)
       });
   glfwSetCursorPosCallback(
       m_window_handle.get(),
-      [](GLFWwindow* w, double, double)
+      [](GLFWwindow* w, double cx, double cy)
       {
         auto& self = *reinterpret_cast<window*>(glfwGetWindowUserPointer(w));
+        if (self.on_cursor_move(cx, cy)) {
+          return;
+        }
         if (self.m_drag_state.holding) {
           auto&& [x, y] = window_drag_state::get_monitor_cursor_pos(w);
           self.m_drag_state.dx = x - self.m_drag_state.ox;
           self.m_drag_state.dy = y - self.m_drag_state.oy;
+          self.request_render();
         }
       });
   glfwSetScrollCallback(
       m_window_handle.get(),
-      [](GLFWwindow* wnd, double, double sy)
+      [](GLFWwindow* wnd, double sx, double sy)
       {
+        if (reinterpret_cast<window*>(glfwGetWindowUserPointer(wnd))
+                ->on_scroll(sx, sy))
+        {
+          return;
+        }
         static constexpr int increment = 30;
         auto dw = static_cast<int>(sy * increment);
         int w = 0, h = 0;
@@ -172,11 +236,27 @@ window::window(context* c)
       });
 }
 
+window::~window()
+{
+  release_window_counters(m_counters);
+}
+
 auto window::push_event(event e) -> void
 {
   m_context->push_event(move(e));
 }
 
+auto window::request_render() -> void
+{
+  m_context->request_render(m_id);
+}
+
+auto window::invalidate() -> void
+{
+  m_redraw = true;
+  request_render();
+}
+
 auto window::dead() const -> bool
 {
   return m_dead;
@@ -192,9 +272,133 @@ auto window::make_context_non_current() -> void
   glfwMakeContextCurrent(nullptr);
 }
 
-auto window::swap_buffers() const -> void
+auto window::framebuffer() -> GLuint
 {
-  glfwSwapBuffers(m_window_handle.get());
+  if (!headless()) {
+    return 0;
+  }
+
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(m_window_handle.get(), &width, &height);
+  if (!m_offscreen) {
+    m_offscreen = std::make_unique<offscreen_target>();
+    m_offscreen->fbo = gl_framebuffer::create(this);
+  }
+
+  auto& target = *m_offscreen;
+  if (target.width != width || target.height != height) {
+    // a new renderbuffer, as the storage of a renderbuffer cannot change
+    // while it is attached
+    target.color = gl_renderbuffer::create(this);
+    m_gl.BindRenderbuffer(GL_RENDERBUFFER, *target.color);
+    m_gl.RenderbufferStorage(GL_RENDERBUFFER,
+                             GL_RGBA8,
+                             std::max(width, 1),
+                             std::max(height, 1));
+    m_gl.BindFramebuffer(GL_FRAMEBUFFER, *target.fbo);
+    m_gl.FramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                 GL_COLOR_ATTACHMENT0,
+                                 GL_RENDERBUFFER,
+                                 *target.color);
+    target.width = width;
+    target.height = height;
+  }
+
+  return *target.fbo;
+}
+
+auto window::toggle_hud() -> void
+{
+  if (m_hud_visible) {
+    m_hud_visible = false;
+    invalidate();
+    return;
+  }
+
+  try {
+    if (!m_hud) {
+      m_hud = std::make_unique<hud>(this);
+    }
+    m_hud->reset();
+    m_hud_visible = true;
+    invalidate();
+  } catch (std::exception& ex) {
+    fmt::print("warn: unable to show the performance overlay\n");
+    dump_exception(ex);
+  }
+}
+
+auto window::swap_buffers() -> void
+{
+  if (m_hud_visible) {
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(m_window_handle.get(), &width, &height);
+    m_gl.BindFramebuffer(GL_FRAMEBUFFER, framebuffer());
+    m_gl.Viewport(0, 0, width, height);
+    auto current = stats();
+    if (m_render_timer) {
+      if (!m_render_timer->cpu().empty()) {
+        current.cpu_render = m_render_timer->cpu().summary();
+      }
+      if (!m_render_timer->gpu().empty()) {
+        current.gpu_render = m_render_timer->gpu().summary();
+      }
+    }
+    m_hud->draw(m_gl, width, height, current);
+  }
+
+  {
+    const trace_span span {"swap"};
+    if (headless()) {
+      // there is nothing to present, but the frame must still be submitted
+      m_gl.Flush();
+    } else {
+      glfwSwapBuffers(m_window_handle.get());
+    }
+  }
+
+  if (m_hud_visible) {
+    m_hud->frame_presented();
+  }
+
+  if (m_counters != nullptr) {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    constexpr i64 fps_period = 1'000'000'000;
+    const auto now = stats_now();
+    m_counters->presents.fetch_add(1, relaxed);
+    m_counters->last_present.store(now, relaxed);
+    ++m_fps_frames;
+    if (now - m_fps_start >= fps_period) {
+      // a window idle for a while starts a new period with this present
+      if (now - m_fps_start < 2 * fps_period) {
+        m_counters->fps.store(static_cast<double>(m_fps_frames) * 1e9
+                                  / static_cast<double>(now - m_fps_start),
+                              relaxed);
+      }
+      m_fps_start = now;
+      m_fps_frames = 0;
+    }
+  }
+}
+
+auto window::begin_render_timing() -> void
+{
+  m_timing = m_hud_visible;
+  if (!m_timing) {
+    return;
+  }
+
+  if (!m_render_timer) {
+    m_render_timer = std::make_unique<render_timer>(this);
+  }
+  m_render_timer->begin(m_gl);
+}
+
+auto window::end_render_timing() -> void
+{
+  if (std::exchange(m_timing, false)) {
+    m_render_timer->end(m_gl);
+  }
 }
 
 auto window::show_window(int width, int height, const char* title) -> void
@@ -242,121 +446,24 @@ auto window_drag_state::get_monitor_cursor_pos(GLFWwindow* window)
   return std::make_tuple(wx + cx, wy + cy);
 }
 
-using namespace std::literals;
-struct path_checker
+auto create_window(context* c, const char* path) -> shared_ptr<window>
 {
-  const char* path;
-  std::ifstream file {};
-
-  constexpr static usize max_header_size = 16;
-  usize header_size = 0;
-  array<char, max_header_size> header {};
-
-  auto check_file_and_open() -> bool
-  {
-    file.open(path);
-    return !file.bad();
-  }
-  auto read_header() -> void
-  {
-    if (file.tellg() != 0) {
-      return;
-    }
-
-    header_size = static_cast<usize>(std::max<std::streamsize>(
-        file.readsome(header.data(), max_header_size), 0));
-  }
-
-  auto check_header(string_view check, usize offset = 0) -> bool
-  {
-    read_header();
-    return memcmp(check.data(), &header.at(offset), check.size()) == 0;
-  }
-
-  auto is_png() -> bool
-  {
-    return check_header("\x89\x50\x4E\x47\x0D\x0A\x1A\x0A"sv);
-  }
-
-  auto is_gif() -> bool
-  {
-    return check_header("GIF87a"sv) || check_header("GIF89a"sv);
-  }
-
-  auto is_jpeg() -> bool
-  {
-    return check_header("\xFF\xD8\xFF\xDB"sv)
-        || check_header("\xFF\xD8\xFF\xE0\x00\x10\x4A\x46\x49\x46\x00\x01"sv)
-        || check_header("\xFF\xD8\xFF\xEE"sv)
-        || (check_header("\xFF\xD8\xFF\xE1"sv)
-            && check_header("\x45\x78\x69\x66\x00\x00"sv, 6))
-        || check_header("\xFF\xD8\xFF\xE0"sv);
-  }
-
-  auto is_bmp() -> bool { return check_header("BM"); }
-  auto is_psd() -> bool { return check_header("8BPS"); }
-  auto is_hdr() -> bool { return check_header("#?RADIANCE."); }
-
-  auto is_ppm() -> bool
-  {
-    return check_header("\x50\x33\x0A"sv) || check_header("\x50\x36\x0A"sv);
-  }
-
-  auto stbi_supported() -> bool
-  {
-    return is_png() || is_gif() || is_jpeg() || is_bmp() || is_psd() || is_hdr()
-        || is_ppm();
-  }
-
-  auto is_webp() -> bool
-  {
-    return check_header("RIFF"sv) && check_header("WEBP"sv, 8);
+  if (std::error_code error; fs::is_directory(path, error)) {
+    fmt::print("opening directory using grid_window\n");
+    return std::make_shared<grid_window>(c, path);
   }
-};
 
-template<typename Loader>
-inline auto open_loader(context* c, Loader loader) -> shared_ptr<window>
-{
-  if (loader.metadata.animated) {
-    return std::make_shared<animated_image_window>(c, move(loader));
+  // the textures of a file already shown are shared, without decoding it
+  if (auto image = c->textures().find(path); image.has_value()) {
+    return std::make_shared<image_window>(c, move(*image));
   }
 
-  return std::make_shared<static_image_window>(c, loader);
-}
-
-auto create_window(context* c, const char* path) -> shared_ptr<window>
-{
-  using namespace std::placeholders;
-  path_checker checker {path};
-  if (checker.check_file_and_open()) {
-    if (checker.is_gif()) {
-      try {
-        fmt::print("opening file using gif_loader\n");
-        return open_loader(c, gif_loader {path});
-      } catch (std::exception& ex) {
-        fmt::print("warn: unable to load gif file using gif_loader\n");
-        dump_exception(ex);
-      }
-    }
-
-    if (checker.is_webp()) {
-      try {
-        fmt::print("opening file using webp_loader\n");
-        return open_loader(c, webp_loader {path});
-      } catch (std::exception& ex) {
-        fmt::print("warn: unable to load gif file using webp_loader\n");
-        dump_exception(ex);
-      }
-    }
-
-    if (checker.stbi_supported()) {
-      try {
-        fmt::print("opening file using stbi_loader\n");
-        return open_loader(c, stbi_loader {path});
-      } catch (std::exception& ex) {
-        fmt::print("warn: unable to load gif file using stbi_loader\n");
-        dump_exception(ex);
-      }
+  if (auto image = decode_image(path, &c->workers()); image.has_value()) {
+    try {
+      return std::make_shared<image_window>(c, move(*image));
+    } catch (std::exception& ex) {
+      fmt::print("warn: unable to display image using image_window\n");
+      dump_exception(ex);
     }
   }
 
@@ -3,10 +3,12 @@
 #define GLFW_INCLUDE_NONE
 #include <atomic>
 #include <functional>
+#include <limits>
 
 #include <GLFW/glfw3.h>
 #include <glad/gl.h>
 
+#include "budget.hpp"
 #include "events.hpp"
 #include "types.hpp"
 
@@ -38,13 +40,42 @@ struct window_drag_state
 };
 
 class context;
+class hud;
+class render_timer;
+struct offscreen_target;
+struct window_counters;
 
-class window : public std::enable_shared_from_this<window>
+// distribution of recent durations, in milliseconds
+struct timing_summary
+{
+  double mean {0}, p95 {0}, max {0};
+};
+
+// what the performance overlay shows about a window, besides frame times
+struct window_stats
+{
+  // video memory used by the window
+  usize texture_bytes {0};
+  // of the image being shown, in milliseconds
+  optional<double> decode_time, upload_time;
+  // index and count of the frames of an animation
+  optional<tuple<usize, usize>> frame;
+  // resampling filter of the image
+  optional<string> filter;
+  // zoom relative to the image fitted in its window
+  optional<double> zoom;
+  // frames dropped by mpv
+  optional<i64> dropped_frames;
+  // time the GL commands of a render take to be issued, and to run on the GPU
+  optional<timing_summary> cpu_render, gpu_render;
+};
+
+class window
 {
 public:
   constexpr static i32 default_size = 16;
   explicit window(context* c);
-  virtual ~window() = default;
+  virtual ~window();
 
   window(const window&) = delete;
   window(window&&) = delete;
@@ -54,15 +85,33 @@ public:
 
   virtual auto handle_event(event& /*e*/) -> void {}
   // return the wait time
-  // <0 indicates vsync
+  // <0 indicates vsync, infinity means that the window has nothing to do
+  // until it is damaged or receives an event
   virtual auto render() -> double
   {
+    // dragging is driven by the cursor callback, which requests a render
+    // every time the cursor moves
     m_drag_state.update(m_window_handle.get());
-    return 0.05;
+    return std::numeric_limits<double>::infinity();
   }
 
+  // give back texture memory when the budget is exceeded, the window must
+  // report its new usage to the budget
+  virtual auto release_memory(memory_kind /*kind*/) -> void {}
+
+  // only queried while the overlay is shown
+  virtual auto stats() -> window_stats { return {}; }
+  auto toggle_hud() -> void;
+
   auto push_event(event e) -> void;
+  // ask the main loop to call render() on its next iteration
+  auto request_render() -> void;
+  // mark the window contents as outdated and request a render
+  auto invalidate() -> void;
   auto dead() const -> bool;
+  // iconified, render() is only called again once the window is restored
+  auto hidden() const -> bool { return m_hidden; }
+  auto id() const -> window_id { return m_id; }
 
   template<typename Func>
   auto use_gl(Func&& func) const -> decltype(auto)
@@ -76,14 +125,54 @@ public:
   auto show_window(int width, int height, const char* title) -> void;
 
 protected:
-  auto swap_buffers() const -> void;
+  // the framebuffer to draw into, the default one of the window, or a
+  // framebuffer object of the window size when rendering headless
+  auto framebuffer() -> GLuint;
+  // draws the overlay if it is shown
+  auto swap_buffers() -> void;
+  // around the GL commands of a render, timed while the overlay is shown
+  auto begin_render_timing() -> void;
+  auto end_render_timing() -> void;
+
+  // input hooks called before the default bindings, which only run if the
+  // hook returns false
+  // key presses and repeats
+  virtual auto on_key(int /*key*/, int /*mods*/) -> bool { return false; }
+  virtual auto on_mouse_button(int /*button*/, int /*action*/, int /*mods*/)
+      -> bool
+  {
+    return false;
+  }
+  // cursor position in window coordinates
+  virtual auto on_cursor_move(double /*x*/, double /*y*/) -> bool
+  {
+    return false;
+  }
+  virtual auto on_scroll(double /*dx*/, double /*dy*/) -> bool
+  {
+    return false;
+  }
 
   context* m_context;
+  window_id m_id;
   shared_ptr<root_window> m_root;
   glfw_window m_window_handle;
   std::atomic_bool m_redraw {true}, m_dead {false};
+  bool m_hidden {false};
   GladGLContext m_gl {};
   window_drag_state m_drag_state {};
+  // headless only, destroyed before the window and its context
+  unique_ptr<offscreen_target> m_offscreen;
+  // created when the overlay is first shown
+  unique_ptr<hud> m_hud;
+  bool m_hud_visible {false};
+  unique_ptr<render_timer> m_render_timer;
+  bool m_timing {false};
+  // statistics served by the stats server, nullptr if there was no free slot
+  window_counters* m_counters {nullptr};
+  // presents since m_fps_start, in stats_now() nanoseconds
+  i64 m_fps_start {0};
+  u64 m_fps_frames {0};
 };
 
 auto create_window(context* c, const char* path) -> shared_ptr<window>;
@@ -0,0 +1,159 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include "clock.hpp"
+
+// simulates weeks of playback on the integer timeline, with speed changes,
+// pauses, reverse playback and seeks, and checks that the positions are
+// exact to the nanosecond
+
+namespace
+{
+using namespace imgv;
+
+int failures = 0;
+
+auto check(bool condition, const char* what) -> void
+{
+  if (!condition) {
+    fmt::print(stderr, "failed: {}\n", what);
+    ++failures;
+  }
+}
+
+constexpr chr::nanoseconds simulated {chr::hours {24 * 7 * 4}};
+
+// deterministic, so that a failure can be reproduced
+struct lcg
+{
+  std::uint64_t state {0x2545f4914f6cdd1dULL};
+
+  auto operator()(std::uint64_t bound) -> std::uint64_t
+  {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (state >> 33U) % bound;
+  }
+};
+
+auto test_real_time() -> void
+{
+  const imgv::clock::time_point start {};
+  const imgv::clock c {start};
+  check(c.at(start + simulated) == simulated, "four weeks at speed 1");
+  check(c.at(start + simulated + chr::nanoseconds {1})
+            == simulated + chr::nanoseconds {1},
+        "four weeks and one nanosecond at speed 1");
+}
+
+// rebasing at every speed change must not lose time: segments of whole
+// microseconds at speeds in 1/1000 steps are exact, so the position is known
+auto test_speed_changes() -> void
+{
+  const imgv::clock::time_point start {};
+  imgv::clock c {start};
+  lcg random;
+  auto now = start;
+  i64 expected = 0;
+  i64 numerator = playback_speed::denominator;
+  while (now - start < simulated) {
+    const auto micros = static_cast<i64>(random(6 * 3600 * 1'000'000ULL));
+    now += chr::microseconds {micros};
+    expected += micros * numerator;
+    check(c.at(now).count() == expected, "position after a segment");
+
+    // from -4x to 4x in steps of 0.1, including paused
+    numerator = (static_cast<i64>(random(81)) - 40) * 100;
+    c.set_speed(playback_speed::from_double(
+                    static_cast<double>(numerator)
+                    / static_cast<double>(playback_speed::denominator)),
+                now);
+  }
+}
+
+// setting the same speed again only rebases, the position must be the same
+// as that of a clock that was never touched
+auto test_rebase() -> void
+{
+  const imgv::clock::time_point start {};
+  const auto speed = playback_speed::from_double(1.5);
+  imgv::clock touched {start}, untouched {start};
+  touched.set_speed(speed, start);
+  untouched.set_speed(speed, start);
+  const auto step = simulated / 100'000;
+  for (auto now = start; now - start < simulated; now += step) {
+    touched.set_speed(speed, now);
+  }
+
+  const auto end = start + simulated;
+  check(touched.at(end) == untouched.at(end), "rebased clock");
+  check(untouched.at(end) == simulated * 3 / 2, "four weeks at speed 1.5");
+}
+
+// the 0.1 steps of speed_event are not exact in binary, but they must not
+// accumulate into the quantized speed
+auto test_speed_steps() -> void
+{
+  state_clock c;
+  for (int i = 0; i < 10'000; ++i) {
+    c.update_speed({{}, {change_mode::add_or_cycle, 0.1}});
+  }
+  for (int i = 0; i < 10'000; ++i) {
+    c.update_speed({{}, {change_mode::add_or_cycle, -0.1}});
+  }
+  // the fixed point speed is exact, so scaling by it is the identity again
+  check(c.speed().scale(chr::seconds {1}) == chr::seconds {1},
+        "speed back to 1 after 0.1 steps");
+}
+
+// seeks on a paused clock must cancel out exactly
+auto test_seeks() -> void
+{
+  state_clock c;
+  c.update_play_pause({{}, {change_mode::set, false}});
+  const auto before = c.now();
+  for (int i = 0; i < 100'000; ++i) {
+    c.update_seek({{}, {change_mode::add_or_cycle, 0.1}});
+  }
+  // seek_event carries seconds as a double, whose sum is only exact to a
+  // few nanoseconds, but the totals are rounded the same way both ways
+  check(chr::abs(c.now() - before - chr::seconds {10'000})
+            < chr::microseconds {1},
+        "seeks forwards");
+  for (int i = 0; i < 100'000; ++i) {
+    c.update_seek({{}, {change_mode::add_or_cycle, -0.1}});
+  }
+  check(c.now() == before, "seeks cancel out");
+  check(std::isinf(c.rescale(chr::seconds {1})), "paused clock never ends");
+}
+
+auto test_loop_position() -> void
+{
+  lcg random;
+  const chr::nanoseconds duration {1'234'567'891};
+  for (int i = 0; i < 100'000; ++i) {
+    const auto span = static_cast<std::uint64_t>(2 * simulated.count());
+    const auto time =
+        chr::nanoseconds {static_cast<i64>(random(span))} - simulated;
+    const auto position = loop_position(time, duration);
+    check(position >= chr::nanoseconds::zero() && position < duration,
+          "loop position in range");
+    check((time - position) % duration == chr::nanoseconds::zero(),
+          "loop position on the timeline");
+  }
+  check(loop_position(-chr::nanoseconds {1}, duration)
+            == duration - chr::nanoseconds {1},
+        "reverse playback wraps to the end");
+}
+}  // namespace
+
+auto main() -> int
+{
+  test_real_time();
+  test_speed_changes();
+  test_rebase();
+  test_speed_steps();
+  test_seeks();
+  test_loop_position();
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
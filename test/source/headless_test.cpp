@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+
+#include "context.hpp"
+#include "root_window.hpp"
+#include "stats.hpp"
+
+// opens a static image without a display server and checks that it is
+// presented once, after which the main loop, kept running while idle, must
+// not wake up or render again
+
+namespace
+{
+using namespace imgv;
+
+constexpr int skipped = 77;
+
+int failures = 0;
+
+auto check(bool condition, const char* what) -> void
+{
+  if (!condition) {
+    fmt::print(stderr, "failed: {}\n", what);
+    ++failures;
+  }
+}
+
+// a 2x2 24-bit BMP, the simplest file stbi reads
+auto write_bmp(const std::filesystem::path& path) -> void
+{
+  constexpr int width = 2, height = 2;
+  // rows are padded to 4 bytes
+  constexpr u32 row_size = 8;
+  constexpr u32 pixels_offset = 54;
+  constexpr u32 file_size = pixels_offset + row_size * height;
+
+  vector<u8> file;
+  const auto put = [&](u32 value, int bytes)
+  {
+    for (int i = 0; i < bytes; ++i) {
+      file.push_back(static_cast<u8>(value >> (8 * i)));
+    }
+  };
+  file.push_back('B');
+  file.push_back('M');
+  put(file_size, 4);
+  put(0, 4);
+  put(pixels_offset, 4);
+  // BITMAPINFOHEADER
+  put(40, 4);
+  put(width, 4);
+  put(height, 4);
+  put(1, 2);
+  put(24, 2);
+  put(0, 4);
+  put(row_size * height, 4);
+  put(2835, 4);
+  put(2835, 4);
+  put(0, 4);
+  put(0, 4);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      put(x == y ? 0xffffffU : 0x0000ffU, 3);
+    }
+    put(0, 2);
+  }
+
+  auto* out = std::fopen(path.string().c_str(), "wb");
+  if (out == nullptr) {
+    IMGV_ERROR(fmt::format("unable to write '{}'", path.string()));
+  }
+  std::fwrite(file.data(), 1, file.size(), out);
+  std::fclose(out);
+}
+
+auto total_presents() -> u64
+{
+  u64 total = 0;
+  for (const auto& slot : counters().windows) {
+    if (slot.used.load(std::memory_order_relaxed)) {
+      total += slot.presents.load(std::memory_order_relaxed);
+    }
+  }
+  return total;
+}
+}  // namespace
+
+auto main() -> int
+{
+  // unique, so that parallel runs do not share the file
+  const auto path = std::filesystem::temp_directory_path()
+      / fmt::format("imgv-cpp_headless_test-{:08x}.bmp",
+                    std::random_device {}());
+  write_bmp(path);
+  const auto path_string = path.string();
+
+  set_gl_backend(gl_backend::osmesa);
+  bool run = true;
+  optional<context> c;
+  try {
+    c.emplace(vector<const char*> {path_string.c_str()}, run);
+  } catch (exception& ex) {
+    // GLFW older than 3.4 or no OSMesa
+    fmt::print(stderr, "skipped: {}\n", ex.what());
+    run = false;
+  }
+  if (!run) {
+    std::filesystem::remove(path);
+    return skipped;
+  }
+
+  // returns once the image is drawn and nothing is left to do
+  c->run();
+  check(total_presents() == 1, "one present of the image");
+  const auto wakeups = counters().wakeups.load();
+  const auto renders = counters().renders.load();
+
+  // long enough for any forgotten timer, animation or polling to fire
+  c->run_until(deadline_scheduler::clock_type::now()
+               + chr::milliseconds {300});
+  check(total_presents() == 1, "no present once idle");
+  // the wait that ends the run is the only one
+  check(counters().wakeups.load() - wakeups <= 1, "no wakeup once idle");
+  check(counters().renders.load() == renders, "no render once idle");
+  c.reset();
+
+  std::filesystem::remove(path);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}